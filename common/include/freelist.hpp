@@ -4,12 +4,19 @@
  * Date Created: 2025-01-12
  *
  * I know it's backwards but 0 means free and 1 means taken.
+ *
+ * The bitmap is backed by two summary levels so that the lowest
+ * free index can be found with a handful of count-trailing-zeros
+ * operations instead of a scan:
+ *   - summary 1: bit i is set if word i of the bitmap has a free bit
+ *   - summary 2: bit i is set if word i of summary 1 is nonzero
 \* ---------------------------------------------------------------- */
 #ifndef ANTHRAX_FREELIST_HPP
 #define ANTHRAX_FREELIST_HPP
 
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
 namespace Anthrax
 {
@@ -22,14 +29,21 @@ public:
 	Freelist(const Freelist &other) { copy(other); }
 	void copy(const Freelist &other);
 	size_t alloc();
+	size_t allocRange(size_t num_elements);
 	void free(size_t index);
+	bool isTaken(size_t index);
 	void setRange(size_t offset, size_t num_elements, bool val);
 	void clear();
 
 private:
 	std::vector<uint64_t> freelist_;
+	std::vector<uint64_t> summary1_;
+	std::vector<uint64_t> summary2_;
 
 	size_t findNextFreeIndex();
+	size_t findNextFreeWord(size_t first_word);
+	void grow(size_t num_words);
+	void updateSummaries(size_t first_word, size_t last_word);
 };
 
 } // namespace Anthrax
@@ -0,0 +1,221 @@
+/* ---------------------------------------------------------------- *\
+ * slab_vector.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-23
+ *
+ * A vector of trivially copyable elements that never moves. A range
+ * of address space, as large as the vector may ever grow, is
+ * reserved up front (so owners should pass a realistic bound, such
+ * as the size of the GPU buffer the contents end up in) and committed in
+ * SLAB_VECTOR_SLAB_BYTES slabs (2MB, advised for transparent huge
+ * pages) as the vector grows, so growing is O(1) per slab with no
+ * copying, element addresses stay valid across resizes, and the
+ * contents are always one contiguous array (see data()).
+ *
+ * Elements past size() are kept zeroed, so growing value-initializes
+ * like std::vector. Slabs more than one past the end are given back
+ * to the system on shrink.
+ *
+ * Unlike a list of separately allocated slabs (a deque), every slab
+ * sits at its place in the one reserved range, which is what keeps
+ * the contents contiguous. The cost is that the vector can't grow
+ * past its reservation: commitSlabs() throws instead of moving.
+\* ---------------------------------------------------------------- */
+#ifndef SLAB_VECTOR_HPP
+#define SLAB_VECTOR_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+
+// address space reserved by vectors that aren't given a size; only
+// committed slabs use memory
+#ifndef SLAB_VECTOR_RESERVE_BYTES
+#define SLAB_VECTOR_RESERVE_BYTES (size_t(1) << 30)
+#endif
+#ifndef SLAB_VECTOR_SLAB_BYTES
+#define SLAB_VECTOR_SLAB_BYTES (size_t(1) << 21)
+#endif
+
+namespace Anthrax
+{
+
+template <class T>
+class SlabVector
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SlabVector elements are copied with memcpy");
+	static_assert(SLAB_VECTOR_SLAB_BYTES % sizeof(T) == 0, "Elements must not straddle slabs");
+public:
+	explicit SlabVector(size_t reserved_bytes = SLAB_VECTOR_RESERVE_BYTES);
+	~SlabVector();
+	SlabVector(const SlabVector<T> &other) = delete;
+	SlabVector<T> &operator=(const SlabVector<T> &other) = delete;
+	void swap(SlabVector<T> &other);
+
+	void resize(size_t new_size);
+	void append(const T *values, size_t num_values);
+	void assign(const T *values, size_t num_values);
+	T &operator[](size_t i) { return data_[i]; }
+	const T &operator[](size_t i) const { return data_[i]; }
+	T *data() { return data_; }
+	const T *data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t capacity() const { return num_committed_slabs_*SLAB_ELEMENTS; }
+	size_t getReservedBytes() const { return reserved_bytes_; }
+
+private:
+	static constexpr size_t SLAB_ELEMENTS = SLAB_VECTOR_SLAB_BYTES / sizeof(T);
+	T *data_ = nullptr;
+	size_t reserved_bytes_ = 0;
+	size_t size_ = 0;
+	size_t num_committed_slabs_ = 0;
+
+	void commitSlabs(size_t num_slabs);
+};
+
+
+/* ---------------------------------------------------------------- *\
+ * Reserve room for <reserved_bytes> (rounded up to whole slabs)
+\* ---------------------------------------------------------------- */
+template <class T>
+SlabVector<T>::SlabVector(size_t reserved_bytes)
+{
+	reserved_bytes_ = std::max((reserved_bytes + SLAB_VECTOR_SLAB_BYTES - 1) / SLAB_VECTOR_SLAB_BYTES, size_t(1))
+			* SLAB_VECTOR_SLAB_BYTES;
+	// over-reserve by one slab so the start can be aligned to a huge page
+	void *reservation = mmap(nullptr, reserved_bytes_ + SLAB_VECTOR_SLAB_BYTES,
+			PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reservation == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to reserve address space for SlabVector!");
+	}
+	uintptr_t start = reinterpret_cast<uintptr_t>(reservation);
+	uintptr_t aligned_start = (start + SLAB_VECTOR_SLAB_BYTES - 1) & ~(uintptr_t(SLAB_VECTOR_SLAB_BYTES) - 1);
+	if (aligned_start != start)
+	{
+		munmap(reservation, aligned_start - start);
+	}
+	munmap(reinterpret_cast<void*>(aligned_start + reserved_bytes_),
+			SLAB_VECTOR_SLAB_BYTES - (aligned_start - start));
+	data_ = reinterpret_cast<T*>(aligned_start);
+	return;
+}
+
+
+template <class T>
+SlabVector<T>::~SlabVector()
+{
+	if (data_)
+	{
+		munmap(data_, reserved_bytes_);
+		data_ = nullptr;
+	}
+	return;
+}
+
+
+template <class T>
+void SlabVector<T>::swap(SlabVector<T> &other)
+{
+	std::swap(data_, other.data_);
+	std::swap(reserved_bytes_, other.reserved_bytes_);
+	std::swap(size_, other.size_);
+	std::swap(num_committed_slabs_, other.num_committed_slabs_);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Commit or decommit slabs so exactly <num_slabs> are usable
+\* ---------------------------------------------------------------- */
+template <class T>
+void SlabVector<T>::commitSlabs(size_t num_slabs)
+{
+	char *base = reinterpret_cast<char*>(data_);
+	if (num_slabs > num_committed_slabs_)
+	{
+		if (num_slabs*SLAB_VECTOR_SLAB_BYTES > reserved_bytes_)
+		{
+			throw std::runtime_error("SlabVector outgrew its reserved address space!");
+		}
+		char *first = base + num_committed_slabs_*SLAB_VECTOR_SLAB_BYTES;
+		size_t num_bytes = (num_slabs - num_committed_slabs_)*SLAB_VECTOR_SLAB_BYTES;
+		if (mprotect(first, num_bytes, PROT_READ | PROT_WRITE) != 0)
+		{
+			throw std::runtime_error("Failed to commit memory for SlabVector!");
+		}
+#ifdef MADV_HUGEPAGE
+		// only a hint; small pages work too
+		madvise(first, num_bytes, MADV_HUGEPAGE);
+#endif
+	}
+	else if (num_slabs < num_committed_slabs_)
+	{
+		char *first = base + num_slabs*SLAB_VECTOR_SLAB_BYTES;
+		size_t num_bytes = (num_committed_slabs_ - num_slabs)*SLAB_VECTOR_SLAB_BYTES;
+		// the pages read back as zero if they're ever committed again
+		madvise(first, num_bytes, MADV_DONTNEED);
+		mprotect(first, num_bytes, PROT_NONE);
+	}
+	num_committed_slabs_ = num_slabs;
+	return;
+}
+
+
+template <class T>
+void SlabVector<T>::resize(size_t new_size)
+{
+	size_t num_slabs = (new_size + SLAB_ELEMENTS - 1) / SLAB_ELEMENTS;
+	if (new_size > size_)
+	{
+		if (num_slabs > num_committed_slabs_)
+		{
+			commitSlabs(num_slabs);
+		}
+	}
+	else if (new_size < size_)
+	{
+		// keep one spare slab so shrinking and growing across a slab
+		// boundary doesn't keep going back to the system
+		size_t num_kept_slabs = std::min(num_slabs+1, num_committed_slabs_);
+		size_t zero_end = std::min(size_, num_kept_slabs*SLAB_ELEMENTS);
+		if (zero_end > new_size)
+		{
+			memset(static_cast<void*>(data_+new_size), 0, (zero_end-new_size)*sizeof(T));
+		}
+		if (num_kept_slabs < num_committed_slabs_)
+		{
+			commitSlabs(num_kept_slabs);
+		}
+	}
+	size_ = new_size;
+	return;
+}
+
+
+template <class T>
+void SlabVector<T>::append(const T *values, size_t num_values)
+{
+	size_t old_size = size_;
+	resize(size_ + num_values);
+	memcpy(static_cast<void*>(data_+old_size), values, num_values*sizeof(T));
+	return;
+}
+
+
+template <class T>
+void SlabVector<T>::assign(const T *values, size_t num_values)
+{
+	resize(0);
+	append(values, num_values);
+	return;
+}
+
+} // namespace Anthrax
+
+#endif // SLAB_VECTOR_HPP
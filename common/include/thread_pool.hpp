@@ -0,0 +1,55 @@
+/* ---------------------------------------------------------------- *\
+ * thread_pool.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-30
+ *
+ * Fixed set of worker threads pulling jobs off a shared queue. Jobs
+ * are given the index of the worker running them (less than
+ * getNumThreads()), so callers can keep per-worker state without
+ * locking. wait() blocks until every submitted job has finished.
+\* ---------------------------------------------------------------- */
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Anthrax
+{
+
+class ThreadPool
+{
+public:
+	typedef std::function<void(unsigned int worker)> Job;
+
+	// 0 threads means one per hardware thread
+	ThreadPool(unsigned int num_threads);
+	ThreadPool() : ThreadPool(0) {};
+	~ThreadPool();
+	ThreadPool(const ThreadPool &other) = delete;
+	ThreadPool &operator=(const ThreadPool &other) = delete;
+
+	unsigned int getNumThreads() { return workers_.size(); }
+	void submit(Job job);
+	void wait();
+
+private:
+	std::vector<std::thread> workers_;
+	std::deque<Job> jobs_;
+	size_t num_unfinished_jobs_ = 0;
+	bool is_stopping_ = false;
+	std::mutex mutex_;
+	std::condition_variable job_available_;
+	std::condition_variable jobs_finished_;
+
+	void workerLoop(unsigned int worker);
+};
+
+} // namespace Anthrax
+
+#endif // THREAD_POOL_HPP
@@ -15,6 +15,8 @@ namespace Anthrax
 Freelist::Freelist()
 {
 	freelist_ = std::vector<uint64_t>(0);
+	summary1_ = std::vector<uint64_t>(0);
+	summary2_ = std::vector<uint64_t>(0);
 	return;
 }
 
@@ -22,6 +24,8 @@ Freelist::Freelist()
 void Freelist::copy(const Freelist &other)
 {
 	freelist_ = other.freelist_;
+	summary1_ = other.summary1_;
+	summary2_ = other.summary2_;
 	return;
 }
 
@@ -31,50 +35,243 @@ size_t Freelist::alloc()
 	size_t next_index = findNextFreeIndex();
 	size_t bigindex = next_index >> 6;
 	size_t subindex = next_index & 0x3F;
-	freelist_[bigindex] |= (0x8000000000000000ull >> subindex);
+	freelist_[bigindex] |= (1ull << subindex);
+	if (freelist_[bigindex] == 0xFFFFFFFFFFFFFFFFull)
+	{
+		updateSummaries(bigindex, bigindex);
+	}
 	return next_index;
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Allocate <num_elements> contiguous indices and return the first.
+ * The lowest run that fits is used; if none fits, the run starts at
+ * the trailing free space (or at the end) and the list is grown.
+\* ---------------------------------------------------------------- */
+size_t Freelist::allocRange(size_t num_elements)
+{
+	if (num_elements == 0)
+	{
+		return 0;
+	}
+	if (num_elements == 1)
+	{
+		return alloc();
+	}
+	size_t run_start = 0;
+	size_t run_length = 0;
+	for (size_t bigindex = 0; bigindex < freelist_.size(); bigindex++)
+	{
+		uint64_t word = freelist_[bigindex];
+		if (word == 0xFFFFFFFFFFFFFFFFull)
+		{
+			// a run can't cross a full word, so jump past all of them
+			run_length = 0;
+			bigindex = findNextFreeWord(bigindex) - 1;
+			continue;
+		}
+		size_t subindex = 0;
+		while (subindex < 64)
+		{
+			uint64_t remaining = word >> subindex;
+			if (remaining & 1ull)
+			{
+				// taken - skip to the next free bit
+				run_length = 0;
+				subindex += __builtin_ctzll(~remaining);
+				continue;
+			}
+			size_t free_length = (remaining == 0ull) ? (64 - subindex) : __builtin_ctzll(remaining);
+			if (run_length == 0)
+			{
+				run_start = (bigindex << 6) + subindex;
+			}
+			run_length += free_length;
+			if (run_length >= num_elements)
+			{
+				setRange(run_start, num_elements, true);
+				return run_start;
+			}
+			subindex += free_length;
+		}
+	}
+	if (run_length == 0)
+	{
+		run_start = freelist_.size() << 6;
+	}
+	setRange(run_start, num_elements, true);
+	return run_start;
+}
+
+
 void Freelist::free(size_t index)
 {
 	size_t bigindex = index >> 6;
 	size_t subindex = index & 0x3F;
-	freelist_[bigindex] &= ~(0x8000000000000000ull >> subindex);
+	if (bigindex >= freelist_.size())
+	{
+		return;
+	}
+	bool was_full = (freelist_[bigindex] == 0xFFFFFFFFFFFFFFFFull);
+	freelist_[bigindex] &= ~(1ull << subindex);
+	if (was_full)
+	{
+		updateSummaries(bigindex, bigindex);
+	}
 	return;
 }
 
 
+bool Freelist::isTaken(size_t index)
+{
+	size_t bigindex = index >> 6;
+	size_t subindex = index & 0x3F;
+	if (bigindex >= freelist_.size())
+	{
+		return false;
+	}
+	return (freelist_[bigindex] & (1ull << subindex)) != 0ull;
+}
+
+
 size_t Freelist::findNextFreeIndex()
 {
-	for (size_t index = 0; index < freelist_.size(); index++)
+	for (size_t index2 = 0; index2 < summary2_.size(); index2++)
 	{
-		if (freelist_[index] != 0xFFFFFFFFFFFFFFFFull)
+		if (summary2_[index2] == 0ull)
 		{
-			for (int subindex = 0; subindex < 64; subindex++)
-			{
-				if (((0x8000000000000000ull >> subindex) & freelist_[index]) == 0ull)
-				{
-					return ((index<<6) + subindex);
-				}
-			}
-
+			continue;
 		}
+		size_t index1 = (index2 << 6) + __builtin_ctzll(summary2_[index2]);
+		size_t index = (index1 << 6) + __builtin_ctzll(summary1_[index1]);
+		return (index << 6) + __builtin_ctzll(~freelist_[index]);
 	}
-	freelist_.push_back(static_cast<uint64_t>(0));
+	grow(freelist_.size()+1);
 	return (static_cast<size_t>(freelist_.size()-1)) << 6;
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Index of the first bitmap word at or after <first_word> with a free
+ * bit, or the number of words if there is none. Whole runs of full
+ * words are skipped through the summaries, as in findNextFreeIndex().
+\* ---------------------------------------------------------------- */
+size_t Freelist::findNextFreeWord(size_t first_word)
+{
+	if (first_word >= freelist_.size())
+	{
+		return freelist_.size();
+	}
+	size_t index1 = first_word >> 6;
+	uint64_t bits1 = summary1_[index1] & (0xFFFFFFFFFFFFFFFFull << (first_word & 0x3F));
+	if (bits1 != 0ull)
+	{
+		return (index1 << 6) + __builtin_ctzll(bits1);
+	}
+	index1++;
+	if (index1 >= summary1_.size())
+	{
+		return freelist_.size();
+	}
+	size_t index2 = index1 >> 6;
+	uint64_t bits2 = summary2_[index2] & (0xFFFFFFFFFFFFFFFFull << (index1 & 0x3F));
+	while (true)
+	{
+		if (bits2 != 0ull)
+		{
+			index1 = (index2 << 6) + __builtin_ctzll(bits2);
+			return (index1 << 6) + __builtin_ctzll(summary1_[index1]);
+		}
+		index2++;
+		if (index2 >= summary2_.size())
+		{
+			return freelist_.size();
+		}
+		bits2 = summary2_[index2];
+	}
+}
+
+
 void Freelist::setRange(size_t offset, size_t num_elements, bool val)
 {
-	// TODO
+	if (num_elements == 0)
+	{
+		return;
+	}
+	size_t last_index = offset + num_elements - 1;
+	if (freelist_.size() <= (last_index >> 6))
+	{
+		grow((last_index >> 6) + 1);
+	}
+	for (size_t index = offset; index <= last_index; index++)
+	{
+		size_t bigindex = index >> 6;
+		size_t subindex = index & 0x3F;
+		if (subindex == 0 && last_index - index >= 63)
+		{
+			// whole word can be set at once
+			freelist_[bigindex] = val ? 0xFFFFFFFFFFFFFFFFull : 0ull;
+			index += 63;
+			continue;
+		}
+		if (val)
+			freelist_[bigindex] |= (1ull << subindex);
+		else
+			freelist_[bigindex] &= ~(1ull << subindex);
+	}
+	updateSummaries(offset >> 6, last_index >> 6);
+	return;
 }
 
 
 void Freelist::clear()
 {
 	freelist_.clear();
+	summary1_.clear();
+	summary2_.clear();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Extend the bitmap to <num_words> words. New words are all free.
+\* ---------------------------------------------------------------- */
+void Freelist::grow(size_t num_words)
+{
+	size_t old_num_words = freelist_.size();
+	if (num_words <= old_num_words)
+	{
+		return;
+	}
+	freelist_.resize(num_words, 0ull);
+	summary1_.resize(((num_words-1) >> 6) + 1, 0ull);
+	summary2_.resize(((summary1_.size()-1) >> 6) + 1, 0ull);
+	updateSummaries(old_num_words, num_words-1);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Recompute the summary bits covering bitmap words
+ * <first_word> through <last_word> (inclusive).
+\* ---------------------------------------------------------------- */
+void Freelist::updateSummaries(size_t first_word, size_t last_word)
+{
+	for (size_t index = first_word; index <= last_word; index++)
+	{
+		if (freelist_[index] != 0xFFFFFFFFFFFFFFFFull)
+			summary1_[index >> 6] |= (1ull << (index & 0x3F));
+		else
+			summary1_[index >> 6] &= ~(1ull << (index & 0x3F));
+	}
+	for (size_t index1 = (first_word >> 6); index1 <= (last_word >> 6); index1++)
+	{
+		if (summary1_[index1] != 0ull)
+			summary2_[index1 >> 6] |= (1ull << (index1 & 0x3F));
+		else
+			summary2_[index1 >> 6] &= ~(1ull << (index1 & 0x3F));
+	}
 	return;
 }
 
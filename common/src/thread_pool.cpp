@@ -0,0 +1,88 @@
+/* ---------------------------------------------------------------- *\
+ * thread_pool.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-30
+\* ---------------------------------------------------------------- */
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace Anthrax
+{
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	if (num_threads == 0)
+	{
+		num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	workers_.reserve(num_threads);
+	for (unsigned int worker = 0; worker < num_threads; worker++)
+	{
+		workers_.emplace_back(&ThreadPool::workerLoop, this, worker);
+	}
+	return;
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_stopping_ = true;
+	}
+	job_available_.notify_all();
+	for (std::thread &worker : workers_)
+	{
+		worker.join();
+	}
+	return;
+}
+
+
+void ThreadPool::submit(Job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(std::move(job));
+		num_unfinished_jobs_++;
+	}
+	job_available_.notify_one();
+	return;
+}
+
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	jobs_finished_.wait(lock, [this] { return num_unfinished_jobs_ == 0; });
+	return;
+}
+
+
+void ThreadPool::workerLoop(unsigned int worker)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		job_available_.wait(lock, [this] { return is_stopping_ || !jobs_.empty(); });
+		if (jobs_.empty())
+		{
+			// stopping, and nothing left to run
+			return;
+		}
+		Job job = std::move(jobs_.front());
+		jobs_.pop_front();
+		lock.unlock();
+		job(worker);
+		lock.lock();
+		num_unfinished_jobs_--;
+		if (num_unfinished_jobs_ == 0)
+		{
+			jobs_finished_.notify_all();
+		}
+	}
+}
+
+} // namespace Anthrax
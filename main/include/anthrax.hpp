@@ -21,6 +21,7 @@
 #include <glm/gtx/vector_angle.hpp>
 
 #include <vector>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <ft2build.h>
@@ -56,6 +57,7 @@ public:
 	void renderFrame();
 	bool windowShouldClose() const { return false; }//glfwWindowShouldClose(window_); }
 	float getFrameTimeAvg() { return vulkan_manager_->getFrameTimeAvg(); }
+	size_t getBytesUploaded() { return bytes_uploaded_; }
 
 	unsigned int addText(std::string text, float x, float y, float scale, glm::vec3 color);
 	unsigned int addText(std::string text, float x, float y, float scale, float colorx, float colory, float colorz) { return addText(text, x, y, scale, glm::vec3(colorx, colory, colorz)); }
@@ -107,6 +109,7 @@ private:
 	std::vector<Material> materials_;
 	World *world_;
 	Model *test_model_;
+	World::DynamicModelId test_model_id_;
 	Camera camera_;
 	//GLuint indirection_pool_ssbo_ = 0, voxel_type_pool_ssbo_ = 0, lod_pool_ssbo_ = 0;
 
@@ -117,8 +120,18 @@ private:
 	IDMap<Text> texts_;
 
 	// ssbos
-	Buffer materials_staging_ssbo_, octree_pool_staging_ssbo_;
-	Buffer materials_ssbo_, octree_pool_ssbo_;
+	Buffer materials_staging_ssbo_, octree_pool_staging_ssbo_, brick_pool_staging_ssbo_;
+	Buffer materials_ssbo_, octree_pool_ssbo_, brick_pool_ssbo_;
+	Buffer instance_model_pool_staging_ssbo_, instances_staging_ssbo_;
+	Buffer instance_model_pool_ssbo_, instances_ssbo_;
+	uint64_t uploaded_instance_version_ = UINT64_MAX; // of the world's InstanceTable
+	Buffer oriented_model_pool_staging_ssbo_, oriented_models_staging_ssbo_;
+	Buffer oriented_model_pool_ssbo_, oriented_models_ssbo_;
+	uint64_t uploaded_oriented_model_version_ = UINT64_MAX; // of the world's OrientedModelTable
+	uint64_t uploaded_oriented_model_pool_version_ = UINT64_MAX;
+	size_t bytes_uploaded_ = 0; // by the last loadWorld()
+	std::ofstream stats_file_; // see OCTREE_STATS_FILE
+	size_t frame_number_ = 0;
 	std::vector<Image> raymarched_images_;
 	// ubos
 	Buffer num_levels_ubo_, focal_distance_ubo_, screen_width_ubo_, screen_height_ubo_, camera_position_ubo_, camera_right_ubo_, camera_up_ubo_, camera_forward_ubo_, sunlight_ubo_;
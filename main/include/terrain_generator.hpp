@@ -0,0 +1,117 @@
+/* ---------------------------------------------------------------- *\
+ * terrain_generator.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-27
+ *
+ * Procedural terrain, written straight into an Octree's pool: a
+ * heightfield of fractal value noise, layered grass (or sand near the
+ * bottom of the valleys) over dirt over stone, and caves carved out
+ * of the stone wherever 3D noise rises past a threshold. The same
+ * parameters always give the same world, however many threads build
+ * it.
+ *
+ * The heightfield is evaluated first, along with a pyramid of its
+ * minimum and maximum over each node's columns. Then each subtree
+ * SPLIT_LEVELS below the root is built as its own job: nodes above
+ * the terrain are air and nodes in the stone that the cave noise
+ * can't reach (going by a bound on how fast it changes) are stone,
+ * without looking at their voxels; everything else is split down to
+ * single voxels and merged back up where the children match. Pool
+ * blocks are emitted as each node is finished, and the subtrees are
+ * stitched under the top layers in a fixed order at the end.
+\* ---------------------------------------------------------------- */
+#ifndef TERRAIN_GENERATOR_HPP
+#define TERRAIN_GENERATOR_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "octree.hpp"
+#include "thread_pool.hpp"
+
+namespace Anthrax
+{
+
+class TerrainGenerator
+{
+public:
+	struct Parameters
+	{
+		uint32_t seed = 1;
+		// as fractions of the world's side
+		float base_height = 0.45;
+		float height_amplitude = 0.06;
+		float hill_width = 0.125; // of the largest hills
+		int height_octaves = 7;
+		float sand_height = 0.42; // surfaces below this are sand instead of grass
+		// in voxels
+		uint32_t dirt_depth = 4; // at least
+		// the top of the stone is rounded down to a multiple of this, so
+		// it lines up with nodes instead of following every column
+		uint32_t stone_step = 4;
+		float cave_width = 48.0;
+		int cave_octaves = 2;
+		float cave_threshold = 0.45; // noise is in [-1, 1]
+		uint32_t cave_min_depth = 12; // caves are only this far below the surface
+		uint32_t cave_max_depth = 96;
+	};
+	static constexpr VoxelTypeElement GRASS = 1;
+	static constexpr VoxelTypeElement DIRT = 2;
+	static constexpr VoxelTypeElement STONE = 3;
+	static constexpr VoxelTypeElement SAND = 4;
+	static constexpr int SPLIT_LEVELS = 3; // build up to 8^3 subtrees in parallel
+
+	TerrainGenerator(const Parameters &parameters) : parameters_(parameters) {}
+	void generate(Octree *octree, ThreadPool &thread_pool);
+
+	// single lookups for an octree of <num_layers>, without generating it
+	uint32_t getHeight(uint32_t x, uint32_t z, int num_layers);
+	VoxelTypeElement getVoxel(uint32_t x, uint32_t y, uint32_t z, int num_layers);
+
+private:
+	Parameters parameters_;
+
+	// set up by generate()
+	int num_layers_ = 0;
+	uint32_t side_ = 0;
+	float base_height_, height_amplitude_, height_frequency_, sand_height_;
+	float cave_frequency_, cave_lipschitz_; // bound on |gradient| of the cave noise, per voxel
+	// height_pyramid_[k] holds the (min, max) height over each 2^k by 2^k tile of columns
+	struct HeightRange
+	{
+		uint32_t min, max;
+	};
+	std::vector<std::vector<HeightRange>> height_pyramid_;
+
+	struct Subtree
+	{
+		uint32_t x, y, z;
+		std::vector<Octree::OctreeNode> blocks; // block i is referred to as i+1
+		Octree::OctreeNode root;
+	};
+
+	void setup(int num_layers);
+	void buildHeightPyramid(ThreadPool &thread_pool);
+	HeightRange getHeightRange(uint32_t x, uint32_t z, int layer)
+	{
+		return height_pyramid_[layer][(z >> layer)*(side_ >> layer) + (x >> layer)];
+	}
+	Octree::OctreeNode buildNode(Subtree &subtree, uint32_t x, uint32_t y, uint32_t z, int layer);
+	Octree::OctreeNode stitchNode(std::vector<Subtree> &subtrees, std::vector<Octree::OctreeNode> &pool,
+			uint32_t x, uint32_t y, uint32_t z, int layer, int subtree_layer);
+	uint32_t evaluateHeight(uint32_t x, uint32_t z);
+	VoxelTypeElement evaluateVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t height);
+	int64_t getStoneTop(uint32_t height)
+	{
+		int64_t stone_top = static_cast<int64_t>(height) - 1 - parameters_.dirt_depth;
+		return stone_top - ((stone_top % parameters_.stone_step) + parameters_.stone_step) % parameters_.stone_step;
+	}
+	float caveNoise(float x, float y, float z);
+	float valueNoise(float x, float z, uint32_t octave);
+	float valueNoise(float x, float y, float z, uint32_t octave);
+	float hashLattice(int32_t x, int32_t y, int32_t z, uint32_t octave);
+};
+
+} // namespace Anthrax
+
+#endif // TERRAIN_GENERATOR_HPP
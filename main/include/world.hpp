@@ -15,9 +15,19 @@
 #include "device.hpp"
 #include "octree.hpp"
 #include "model.hpp"
+#include "chunk_streamer.hpp"
+#include "instance_table.hpp"
+#include "oriented_model_table.hpp"
+#include "terrain_generator.hpp"
 
 #define LOG2K 1
 
+// Must match BRICK_LAYER in shaders/main.comp. If nonzero, the world is uploaded as a
+// BrickedOctree with (2^BRICK_LAYER)^3 bricks (2 or 3 make sense), rebuilt every upload
+#ifndef BRICK_LAYER
+#define BRICK_LAYER 0
+#endif
+
 namespace Anthrax
 {
 
@@ -30,6 +40,7 @@ public:
 	~World();
 	World& operator=(const World &other);
 
+	Octree *getOctree() { return octree_; }
 	Octree::OctreeNode *getOctreePool() { return octree_->getOctreePool(); }
 	int getNumLayers() { return octree_->getLayer(); }
 	Material* getMaterialsPtr() { return materials_; }
@@ -39,18 +50,113 @@ public:
 		return octree_->getOctreePoolSize()*sizeof(Octree::OctreeNode);
 	}
 	size_t getMaxOctreePoolSize() { return max_gpu_buffer_size_; }
+	std::vector<Octree::DirtyRange> takeDirtyRanges() { return octree_->takeDirtyRanges(); }
+	Octree::Stats getStats() { return octree_->stats(); }
+	Json::Value getStatsJson();
 	// TODO: variable buffers/descriptors?
 
 	void generate();
+	void generateTerrain(const TerrainGenerator::Parameters &parameters, unsigned int num_threads = 0);
 	void setVoxel(int32_t x, int32_t y, int32_t z, int32_t voxel_type);
-	void clear() { octree_->clear(); }
+	void buildFromVoxels(const std::vector<Octree::VoxelRecord> &voxels);
+	void addVoxels(const std::vector<Octree::VoxelRecord> &voxels);
+	void deduplicate() { octree_->deduplicate(); }
+	void save(const std::string &filename);
+	void load(const std::string &filename);
+	bool relayout(Octree::LayoutOrder order, long long time_budget_us = 0)
+	{
+		return octree_->relayout(order, time_budget_us);
+	}
+	void clear();
 	void addModel(Model *model, int32_t x_offset, int32_t y_offset,
 			int32_t z_offset);
+	void applyModel(Model *model, int32_t x_offset, int32_t y_offset,
+			int32_t z_offset, Octree::CsgOperation operation);
+
+	// models that move or change often (see updateDynamicModels())
+	typedef size_t DynamicModelId;
+	DynamicModelId addDynamicModel(Model *model, int32_t x_offset, int32_t y_offset,
+			int32_t z_offset);
+	void moveDynamicModel(DynamicModelId id, int32_t x_offset, int32_t y_offset,
+			int32_t z_offset);
+	void removeDynamicModel(DynamicModelId id);
+	bool updateDynamicModels();
+
+	// models placed many times without copying their voxels (see InstanceTable)
+	InstanceTable::ModelId addInstanceModel(Model *model);
+	InstanceTable::InstanceId addInstance(InstanceTable::ModelId model_id, int32_t x_offset,
+			int32_t y_offset, int32_t z_offset, int orientation = 0);
+	void removeInstance(InstanceTable::InstanceId id);
+	InstanceTable *getInstanceTable() { return &instance_table_; }
+	size_t getMaxInstanceModelPoolSize() { return max_instance_model_pool_size_; }
+	size_t getMaxInstancesSize() { return max_instances_size_; }
+	VoxelTypeElement getVoxel(int32_t x, int32_t y, int32_t z);
+
+	// models drawn at their Model::setOrientation() without being voxelized into the world
+	// (see OrientedModelTable)
+	OrientedModelTable::OrientedModelId addOrientedModel(Model *model, int32_t x_offset,
+			int32_t y_offset, int32_t z_offset);
+	void moveOrientedModel(OrientedModelTable::OrientedModelId id, int32_t x_offset,
+			int32_t y_offset, int32_t z_offset);
+	void removeOrientedModel(OrientedModelTable::OrientedModelId id) { oriented_model_table_.remove(id); }
+	bool updateOrientedModels();
+	OrientedModelTable *getOrientedModelTable() { return &oriented_model_table_; }
+	size_t getMaxOrientedModelPoolSize() { return max_oriented_model_pool_size_; }
+	size_t getMaxOrientedModelsSize() { return max_oriented_models_size_; }
+
+	void openStreaming(const std::string &directory, int chunk_layers, size_t memory_budget);
+	void updateStreaming(int32_t camera_x, int32_t camera_y, int32_t camera_z);
+	void closeStreaming();
+	ChunkStreamer *getStreamer() { return streamer_; }
 
 private:
 	void mainSetup(int num_layers);
 
 	Octree *octree_;
+	ChunkStreamer *streamer_ = nullptr; // null unless the world is paged from disk
+
+	// Dynamic models are stamped over the static world in order of id.
+	// Each keeps a copy of the nodes it was stamped over (its backdrop),
+	// split BACKDROP_SPLIT_LAYERS below the model's size, so erasing it
+	// is grafting those back.
+	static constexpr int BACKDROP_SPLIT_LAYERS = 2;
+	struct Region
+	{
+		uint32_t min[3], max[3]; // voxels, inclusive
+		bool overlaps(const Region &other) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (min[axis] > other.max[axis] || other.min[axis] > max[axis])
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+	struct DynamicModel
+	{
+		Model *model = nullptr; // null once removed
+		uint32_t x, y, z; // center, as an unsigned octree location
+		bool is_stamped = false;
+		uint32_t stamped_x, stamped_y, stamped_z;
+		uint64_t stamped_version = 0;
+		Region backdrop_region; // covered by the backdrop, while stamped
+		int backdrop_layer = 1;
+		// one raw pool (see Octree::loadPool()) per node of <backdrop_region>, x fastest
+		std::vector<std::vector<Octree::OctreeNode>> backdrops;
+	};
+	std::vector<DynamicModel> dynamic_models_;
+	void checkModelPlacement(Model *model, uint32_t x, uint32_t y, uint32_t z);
+	Region getModelBox(Model *model, uint32_t x, uint32_t y, uint32_t z);
+	Region getModelRegion(Model *model, uint32_t x, uint32_t y, uint32_t z, int *backdrop_layer = nullptr);
+	std::vector<DynamicModelId> eraseDynamicModels(std::vector<Region> touched_regions, bool include_changed);
+	void stampDynamicModel(DynamicModel &dynamic_model);
+	void eraseDynamicModel(DynamicModel &dynamic_model);
+	void liftDynamicModels(const Region &region);
+	void markRegionDirty(const Region &region);
+	void dropDynamicModels();
 
 	size_t num_materials_ = 4096;
 	Material materials_[4096];
@@ -60,6 +166,14 @@ private:
 
 	size_t max_gpu_buffer_size_ = MB(512); // The maximum size of a buffer in the GPU
 
+	InstanceTable instance_table_;
+	size_t max_instance_model_pool_size_ = MB(64);
+	size_t max_instances_size_ = MB(4);
+
+	OrientedModelTable oriented_model_table_;
+	size_t max_oriented_model_pool_size_ = MB(64);
+	size_t max_oriented_models_size_ = MB(1);
+
 	Device device_;
 
 };
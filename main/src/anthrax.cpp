@@ -6,7 +6,9 @@
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <filesystem>
 #include "anthrax.hpp"
+#include "bricked_octree.hpp"
 
 #ifndef WINDOW_NAME
 #define WINDOW_NAME Anthrax
@@ -16,6 +18,27 @@
 #define FONT_DIRECTORY fonts
 #endif
 
+#ifndef BAKED_MODEL_FILE
+#define BAKED_MODEL_FILE models/baked/sponza.octree
+#endif
+
+// if defined, the world's statistics are appended to this file every
+// frame, one JSON object per line (slow, since the whole octree is walked)
+//#define OCTREE_STATS_FILE octree_stats.jsonl
+
+// if defined, the test model spins, so it's rotated and stamped into
+// the world again every frame; otherwise frames don't touch the octree
+//#define SPIN_TEST_MODEL
+
+// if defined, the test model is drawn as an oriented model (see OrientedModelTable), so
+// spinning it only rewrites its bounding box's rotation instead of re-voxelizing it
+//#define ORIENT_TEST_MODEL
+
+// if defined, the world is filled with procedural terrain (see
+// TerrainGenerator) before the test model is added; with the default
+// parameters it only fits in GPU memory for worlds up to 2048 across
+//#define GENERATE_TERRAIN
+
 
 namespace Anthrax
 {
@@ -47,8 +70,18 @@ Anthrax::~Anthrax()
 		raymarched_images_[i].destroy();
 	materials_staging_ssbo_.destroy();
 	octree_pool_staging_ssbo_.destroy();
+	brick_pool_staging_ssbo_.destroy();
 	materials_ssbo_.destroy();
 	octree_pool_ssbo_.destroy();
+	brick_pool_ssbo_.destroy();
+	instance_model_pool_staging_ssbo_.destroy();
+	instances_staging_ssbo_.destroy();
+	instance_model_pool_ssbo_.destroy();
+	instances_ssbo_.destroy();
+	oriented_model_pool_staging_ssbo_.destroy();
+	oriented_models_staging_ssbo_.destroy();
+	oriented_model_pool_ssbo_.destroy();
+	oriented_models_ssbo_.destroy();
 	num_levels_ubo_.destroy();
 	focal_distance_ubo_.destroy();
 	screen_width_ubo_.destroy();
@@ -86,6 +119,9 @@ int Anthrax::init()
 
 	vulkan_manager_->start();
 
+#ifdef OCTREE_STATS_FILE
+	stats_file_.open(xstr(OCTREE_STATS_FILE), std::ios::app);
+#endif
 	loadWorld();
 	loadMaterials();
 
@@ -279,6 +315,16 @@ void Anthrax::loadMaterials()
 
 void Anthrax::createTestModel()
 {
+	// voxelizing takes a long time, so reuse the result from a previous run if there is one
+	std::string baked_model_filename = xstr(BAKED_MODEL_FILE);
+	if (std::filesystem::is_regular_file(baked_model_filename))
+	{
+		test_model_ = new Model();
+		test_model_->load(baked_model_filename, &materials_);
+		materials_[0] = Material(0.0, 0.0, 0.0, 0.0);
+		return;
+	}
+
 	GltfHandler gltf_handler;
 	Voxelizer voxelizer(gltf_handler.getMeshPtr(), vulkan_manager_->getDevice());
 	test_model_ = voxelizer.createModel();
@@ -290,6 +336,9 @@ void Anthrax::createTestModel()
 		materials_.push_back(materials[i]);
 	}
 	materials_[0] = Material(0.0, 0.0, 0.0, 0.0);
+
+	std::filesystem::create_directories(std::filesystem::path(baked_model_filename).parent_path());
+	test_model_->save(baked_model_filename, materials_);
 	return;
 }
 
@@ -302,6 +351,14 @@ void Anthrax::createWorld()
 	*/
 	int world_size = 4096;
 	world_ = new World(log2(world_size)/log2(1u<<LOG2K), vulkan_manager_->getDevice());
+#ifdef GENERATE_TERRAIN
+	world_->generateTerrain(TerrainGenerator::Parameters());
+#endif
+#ifdef ORIENT_TEST_MODEL
+	world_->addOrientedModel(test_model_, 0, 0, 0);
+#else
+	test_model_id_ = world_->addDynamicModel(test_model_, 0, 0, 0);
+#endif
 	return;
 }
 
@@ -310,7 +367,7 @@ void Anthrax::loadWorld()
 {
 	Timer timer(Timer::MILLISECONDS);
 	timer.start();
-	world_->clear();
+#ifdef SPIN_TEST_MODEL
 	auto time_now = std::chrono::system_clock::now();
 	auto time_since_epoch = time_now.time_since_epoch();
 	auto time_duration = std::chrono::duration_cast<std::chrono::milliseconds>(time_since_epoch);
@@ -321,19 +378,143 @@ void Anthrax::loadWorld()
 
 	Quaternion rot(yaw, pitch, roll);
 	rot.normalize();
+#ifdef ORIENT_TEST_MODEL
+	test_model_->setOrientation(rot);
+#else
 	test_model_->rotate(rot);
-	//test_model_->addToWorld(world_, 2048, 2048, 2048);
-	//world_->addModel(test_model_, 2048, 2048, 2048);
-	//world_->addModel(test_model_, 0, 0, 0);
-	world_->addModel(test_model_, 0, 0, 0);
+#endif
+#endif
+	// only the models that moved or changed are erased and stamped again
+	world_->updateDynamicModels();
+
+#if BRICK_LAYER > 0
+	// the bricked layout is rebuilt from scratch, so all of it is uploaded
+	// (if anything changed since the last upload)
+	bytes_uploaded_ = 0;
+	if (!world_->takeDirtyRanges().empty())
+	{
+		BrickedOctree bricked_world(world_->getOctree(), BRICK_LAYER);
+		size_t node_pool_size = bricked_world.getNodePoolSize()*sizeof(Octree::OctreeNode);
+		size_t brick_pool_size = bricked_world.getBrickPoolSize()*sizeof(VoxelTypeElement);
+		if (node_pool_size > octree_pool_staging_ssbo_.size() || brick_pool_size > brick_pool_staging_ssbo_.size())
+		{
+			throw std::runtime_error("Bricked world is too large for the GPU buffers!");
+		}
+		memcpy(octree_pool_staging_ssbo_.getMappedPtr(), bricked_world.getNodePool(), node_pool_size);
+		memcpy(brick_pool_staging_ssbo_.getMappedPtr(), bricked_world.getBrickPool(), brick_pool_size);
+		VkBufferCopy copy_region{};
+		copy_region.size = node_pool_size;
+		octree_pool_ssbo_.copy(octree_pool_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+		if (brick_pool_size > 0)
+		{
+			copy_region.size = brick_pool_size;
+			brick_pool_ssbo_.copy(brick_pool_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+		}
+		bytes_uploaded_ = node_pool_size + brick_pool_size;
+		std::cout << "Time to load world: " << timer.stop() << "ms (" << bytes_uploaded_ << " bytes uploaded, "
+		          << bricked_world.getNumBricks() << " bricks)" << std::endl;
+	}
+#else
+	// only the parts of the pool written since the last upload are copied
+	std::vector<Octree::DirtyRange> dirty_ranges = world_->takeDirtyRanges();
+	const Octree::OctreeNode *octree_pool = world_->getOctreePool();
+	size_t upload_size = 0;
+	for (Octree::DirtyRange range : dirty_ranges)
+	{
+		if ((range.first_node + range.num_nodes)*sizeof(Octree::OctreeNode) > octree_pool_ssbo_.size())
+		{
+			throw std::runtime_error("World is too large for the GPU buffers!");
+		}
+		upload_size += range.num_nodes*sizeof(Octree::OctreeNode);
+	}
+	if (upload_size > octree_pool_staging_ssbo_.size())
+	{
+		throw std::runtime_error("World is too large for the GPU buffers!");
+	}
 
 	//std::cout << "Copying world to staging buffers" << std::endl;
-	memcpy(octree_pool_staging_ssbo_.getMappedPtr(), world_->getOctreePool(), world_->getOctreePoolSize());
+	// Buffer::copy() waits for the transfer to finish, so the staging
+	// buffer is free again by the next upload and can always be filled from the start
+	std::vector<VkBufferCopy> copy_regions;
+	copy_regions.reserve(dirty_ranges.size());
+	char *staging_ptr = static_cast<char*>(octree_pool_staging_ssbo_.getMappedPtr());
+	size_t staging_offset = 0;
+	for (Octree::DirtyRange range : dirty_ranges)
+	{
+		VkBufferCopy copy_region{};
+		copy_region.srcOffset = staging_offset;
+		copy_region.dstOffset = range.first_node*sizeof(Octree::OctreeNode);
+		copy_region.size = range.num_nodes*sizeof(Octree::OctreeNode);
+		memcpy(staging_ptr + copy_region.srcOffset, octree_pool + range.first_node, copy_region.size);
+		copy_regions.push_back(copy_region);
+		staging_offset += copy_region.size;
+	}
 
 	//std::cout << "Moving world to local memory" << std::endl;
-	octree_pool_ssbo_.copy(octree_pool_staging_ssbo_);
+	octree_pool_ssbo_.copy(octree_pool_staging_ssbo_, copy_regions);
+	bytes_uploaded_ = upload_size;
 	//std::cout << "Done!" << std::endl;
-	std::cout << "Time to load world: " << timer.stop() << "ms" << std::endl;
+	std::cout << "Time to load world: " << timer.stop() << "ms (" << bytes_uploaded_ << " bytes uploaded in "
+	          << copy_regions.size() << " regions)" << std::endl;
+#endif // BRICK_LAYER > 0
+
+	// instance models and records are small next to the world, so they're re-sent whole when changed
+	InstanceTable *instance_table = world_->getInstanceTable();
+	if (instance_table->getVersion() != uploaded_instance_version_)
+	{
+		size_t model_pool_size = instance_table->getModelPoolSize()*sizeof(Octree::OctreeNode);
+		size_t instances_size = instance_table->getInstancesSize()*sizeof(InstanceTable::Instance);
+		VkBufferCopy copy_region{};
+		if (model_pool_size > 0)
+		{
+			memcpy(instance_model_pool_staging_ssbo_.getMappedPtr(), instance_table->getModelPool(), model_pool_size);
+			copy_region.size = model_pool_size;
+			instance_model_pool_ssbo_.copy(instance_model_pool_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+		}
+		if (instances_size > 0)
+		{
+			memcpy(instances_staging_ssbo_.getMappedPtr(), instance_table->getInstances(), instances_size);
+			copy_region.size = instances_size;
+			instances_ssbo_.copy(instances_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+		}
+		bytes_uploaded_ += model_pool_size + instances_size;
+		uploaded_instance_version_ = instance_table->getVersion();
+	}
+
+	// turning or moving an oriented model only changes its record, so usually just those are sent
+	world_->updateOrientedModels();
+	OrientedModelTable *oriented_model_table = world_->getOrientedModelTable();
+	if (oriented_model_table->getVersion() != uploaded_oriented_model_version_)
+	{
+		size_t model_pool_size = oriented_model_table->getModelPoolSize()*sizeof(Octree::OctreeNode);
+		size_t records_size = oriented_model_table->getNumRecords()*sizeof(OrientedModelTable::Record);
+		VkBufferCopy copy_region{};
+		if (model_pool_size > 0 && oriented_model_table->getModelPoolVersion() != uploaded_oriented_model_pool_version_)
+		{
+			memcpy(oriented_model_pool_staging_ssbo_.getMappedPtr(), oriented_model_table->getModelPool(), model_pool_size);
+			copy_region.size = model_pool_size;
+			oriented_model_pool_ssbo_.copy(oriented_model_pool_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+			bytes_uploaded_ += model_pool_size;
+		}
+		uploaded_oriented_model_pool_version_ = oriented_model_table->getModelPoolVersion();
+		char *staging_ptr = static_cast<char*>(oriented_models_staging_ssbo_.getMappedPtr());
+		*reinterpret_cast<uint32_t*>(staging_ptr) = oriented_model_table->getNumRecords();
+		memcpy(staging_ptr + OrientedModelTable::RECORDS_OFFSET, oriented_model_table->getRecords(), records_size);
+		copy_region.size = OrientedModelTable::RECORDS_OFFSET + records_size;
+		oriented_models_ssbo_.copy(oriented_models_staging_ssbo_, std::vector<VkBufferCopy>(1, copy_region));
+		bytes_uploaded_ += copy_region.size;
+		uploaded_oriented_model_version_ = oriented_model_table->getVersion();
+	}
+
+#ifdef OCTREE_STATS_FILE
+	Json::Value stats = world_->getStatsJson();
+	stats["frame"] = static_cast<Json::UInt64>(frame_number_);
+	stats["bytes_uploaded"] = static_cast<Json::UInt64>(bytes_uploaded_);
+	Json::StreamWriterBuilder writer_builder;
+	writer_builder["indentation"] = "";
+	stats_file_ << Json::writeString(writer_builder, stats) << std::endl;
+#endif
+	frame_number_++;
 	return;
 }
 
@@ -657,6 +838,78 @@ void Anthrax::createBuffers()
 			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 			);
+	// the brick pool is still bound when bricks are disabled, so it can't be empty
+	size_t brick_pool_size = (BRICK_LAYER > 0) ? world_->getMaxOctreePoolSize() : sizeof(VoxelTypeElement);
+	brick_pool_staging_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			brick_pool_size,
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			);
+	brick_pool_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			brick_pool_size,
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
+	instance_model_pool_staging_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxInstanceModelPoolSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			);
+	instance_model_pool_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxInstanceModelPoolSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
+	instances_staging_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxInstancesSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			);
+	instances_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxInstancesSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
+	oriented_model_pool_staging_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxOrientedModelPoolSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			);
+	oriented_model_pool_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxOrientedModelPoolSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
+	oriented_models_staging_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxOrientedModelsSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+			);
+	oriented_models_ssbo_ = Buffer(
+			vulkan_manager_->getDevice(),
+			world_->getMaxOrientedModelsSize(),
+			Buffer::STORAGE_TYPE,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
 
 	// ubos
 	num_levels_ubo_= Buffer(
@@ -758,7 +1011,7 @@ void Anthrax::createDescriptors()
 	// main compute pass
 	buffers.clear();
 	images.clear();
-	buffers.resize(11);
+	buffers.resize(16);
 	images.resize(1);
 	main_compute_descriptors_.clear();
 	
@@ -773,6 +1026,11 @@ void Anthrax::createDescriptors()
 	buffers[8] = camera_up_ubo_;
 	buffers[9] = camera_forward_ubo_;
 	buffers[10] = sunlight_ubo_;
+	buffers[11] = brick_pool_ssbo_;
+	buffers[12] = instance_model_pool_ssbo_;
+	buffers[13] = instances_ssbo_;
+	buffers[14] = oriented_model_pool_ssbo_;
+	buffers[15] = oriented_models_ssbo_;
 	for (unsigned int i = 0; i < raymarched_images_.size(); i++)
 	{
 		images[0] = raymarched_images_[i];
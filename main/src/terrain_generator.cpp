@@ -0,0 +1,410 @@
+/* ---------------------------------------------------------------- *\
+ * terrain_generator.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-27
+\* ---------------------------------------------------------------- */
+
+#include "terrain_generator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace Anthrax
+{
+
+// rows of the heightfield (or of a pyramid level) evaluated per job
+#define TERRAIN_ROWS_PER_JOB 16
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the contents of <octree> with the terrain. The pool is
+ * built in one go and loaded with Octree::loadPool(), so no voxel is
+ * ever written through setVoxel().
+\* ---------------------------------------------------------------- */
+void TerrainGenerator::generate(Octree *octree, ThreadPool &thread_pool)
+{
+	setup(octree->getLayer());
+	buildHeightPyramid(thread_pool);
+
+	int split_levels = std::min(SPLIT_LEVELS, num_layers_);
+	int subtree_layer = num_layers_ - split_levels;
+	uint32_t subtrees_per_axis = 1u << split_levels;
+	std::vector<Subtree> subtrees(subtrees_per_axis*subtrees_per_axis*subtrees_per_axis);
+	for (size_t subtree_index = 0; subtree_index < subtrees.size(); subtree_index++)
+	{
+		Subtree &subtree = subtrees[subtree_index];
+		subtree.x = (subtree_index % subtrees_per_axis) << subtree_layer;
+		subtree.y = ((subtree_index / subtrees_per_axis) % subtrees_per_axis) << subtree_layer;
+		subtree.z = (subtree_index / (subtrees_per_axis*subtrees_per_axis)) << subtree_layer;
+		thread_pool.submit([this, &subtree, subtree_layer](unsigned int)
+			{
+				subtree.root = buildNode(subtree, subtree.x, subtree.y, subtree.z, subtree_layer);
+			});
+	}
+	thread_pool.wait();
+
+	// the root block comes first, then each subtree's blocks in
+	// order, then the blocks of the layers above the subtrees
+	size_t num_nodes = 8;
+	for (const Subtree &subtree : subtrees)
+	{
+		num_nodes += subtree.blocks.size();
+	}
+	std::vector<Octree::OctreeNode> pool(8);
+	pool.reserve(num_nodes + 8*subtrees.size());
+	for (Subtree &subtree : subtrees)
+	{
+		IndirectionElement base = (pool.size() >> 3) - 1;
+		for (Octree::OctreeNode node : subtree.blocks)
+		{
+			if (node.indirection != 0)
+				node.indirection += base;
+			pool.push_back(node);
+		}
+		if (subtree.root.indirection != 0)
+		{
+			subtree.root.indirection += base;
+		}
+		std::vector<Octree::OctreeNode>().swap(subtree.blocks);
+	}
+	uint32_t half_side = side_ >> 1;
+	for (int child = 0; child < 8; child++)
+	{
+		Octree::OctreeNode node = stitchNode(subtrees, pool,
+				(child & 1) ? half_side : 0, (child & 2) ? half_side : 0, (child & 4) ? half_side : 0,
+				num_layers_-1, subtree_layer);
+		pool[child] = node;
+	}
+	if (pool.size()*sizeof(Octree::OctreeNode) > octree->getMaxPoolBytes())
+	{
+		throw std::runtime_error("Generated terrain (" + std::to_string((pool.size()*sizeof(Octree::OctreeNode)) >> 20)
+				+ "MB) is too big for the octree's pool!");
+	}
+	octree->loadPool(num_layers_, pool.data(), pool.size());
+	height_pyramid_.clear();
+	return;
+}
+
+
+uint32_t TerrainGenerator::getHeight(uint32_t x, uint32_t z, int num_layers)
+{
+	setup(num_layers);
+	return evaluateHeight(x, z);
+}
+
+
+VoxelTypeElement TerrainGenerator::getVoxel(uint32_t x, uint32_t y, uint32_t z, int num_layers)
+{
+	setup(num_layers);
+	return evaluateVoxel(x, y, z, evaluateHeight(x, z));
+}
+
+
+void TerrainGenerator::setup(int num_layers)
+{
+	if (num_layers < 1 || num_layers > 31)
+	{
+		throw std::runtime_error("TerrainGenerator: octree must have between 1 and 31 layers!");
+	}
+	num_layers_ = num_layers;
+	side_ = 1u << num_layers;
+	base_height_ = parameters_.base_height*side_;
+	height_amplitude_ = parameters_.height_amplitude*side_;
+	height_frequency_ = 1.0/(parameters_.hill_width*side_);
+	sand_height_ = parameters_.sand_height*side_;
+	cave_frequency_ = 1.0/parameters_.cave_width;
+	// Each partial derivative of one octave of value noise is at most
+	// smoothstep's steepest slope (1.5) times the largest difference
+	// between lattice values (2), per lattice cell.
+	float octave_weight = 1.0, total_weight = 0.0, weighted_frequency = 0.0;
+	for (int octave = 0; octave < parameters_.cave_octaves; octave++)
+	{
+		weighted_frequency += octave_weight * cave_frequency_*(1u << octave);
+		total_weight += octave_weight;
+		octave_weight *= 0.5;
+	}
+	cave_lipschitz_ = 3.0*std::sqrt(3.0) * weighted_frequency/total_weight;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Evaluate the height of every column, then the (min, max) over
+ * tiles of each size up to the subtrees' (the top layers are few
+ * enough to take from those)
+\* ---------------------------------------------------------------- */
+void TerrainGenerator::buildHeightPyramid(ThreadPool &thread_pool)
+{
+	height_pyramid_.assign(num_layers_+1, std::vector<HeightRange>());
+	height_pyramid_[0].resize(static_cast<size_t>(side_)*side_);
+	for (uint32_t first_row = 0; first_row < side_; first_row += TERRAIN_ROWS_PER_JOB)
+	{
+		thread_pool.submit([this, first_row](unsigned int)
+			{
+				uint32_t end_row = std::min(first_row + TERRAIN_ROWS_PER_JOB, side_);
+				for (uint32_t z = first_row; z < end_row; z++)
+				{
+					for (uint32_t x = 0; x < side_; x++)
+					{
+						uint32_t height = evaluateHeight(x, z);
+						height_pyramid_[0][static_cast<size_t>(z)*side_ + x] = {height, height};
+					}
+				}
+			});
+	}
+	thread_pool.wait();
+	for (int level = 1; level <= num_layers_; level++)
+	{
+		uint32_t level_side = side_ >> level;
+		height_pyramid_[level].resize(static_cast<size_t>(level_side)*level_side);
+		for (uint32_t first_row = 0; first_row < level_side; first_row += TERRAIN_ROWS_PER_JOB)
+		{
+			thread_pool.submit([this, first_row, level, level_side](unsigned int)
+				{
+					const std::vector<HeightRange> &below = height_pyramid_[level-1];
+					uint32_t end_row = std::min(first_row + TERRAIN_ROWS_PER_JOB, level_side);
+					for (uint32_t z = first_row; z < end_row; z++)
+					{
+						for (uint32_t x = 0; x < level_side; x++)
+						{
+							HeightRange range = {UINT32_MAX, 0};
+							for (int corner = 0; corner < 4; corner++)
+							{
+								const HeightRange &quarter = below[static_cast<size_t>(2*z + (corner >> 1))*(2*level_side)
+										+ 2*x + (corner & 1)];
+								range.min = std::min(range.min, quarter.min);
+								range.max = std::max(range.max, quarter.max);
+							}
+							height_pyramid_[level][static_cast<size_t>(z)*level_side + x] = range;
+						}
+					}
+				});
+		}
+		thread_pool.wait();
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Build the node covering 2^layer voxels from corner (x, y, z) of a
+ * subtree, emitting its descendants' blocks into the subtree, and
+ * return it. Nodes whose voxels are known to all be air or all be
+ * stone are leaves right away.
+\* ---------------------------------------------------------------- */
+Octree::OctreeNode TerrainGenerator::buildNode(Subtree &subtree, uint32_t x, uint32_t y, uint32_t z, int layer)
+{
+	HeightRange heights = getHeightRange(x, z, layer);
+	if (y >= heights.max)
+	{
+		return {0, 0};
+	}
+	if (layer == 0)
+	{
+		return {0, evaluateVoxel(x, y, z, heights.min)};
+	}
+	// signed, so the bands below the surface can reach under the world
+	int64_t y_end = static_cast<int64_t>(y) + (1u << layer);
+	int64_t min_height = heights.min, max_height = heights.max;
+	bool is_all_stone = (y_end <= getStoneTop(heights.min));
+	bool is_all_cave_depth = (y_end + parameters_.cave_min_depth <= min_height &&
+			static_cast<int64_t>(y) + parameters_.cave_max_depth >= max_height);
+	bool is_below_caves = (y_end + parameters_.cave_max_depth <= min_height);
+	if (is_all_stone && is_below_caves)
+	{
+		return {0, STONE};
+	}
+	if (is_all_stone || is_all_cave_depth)
+	{
+		// the cave noise can't change by more than this within the node
+		float half_span = 0.5*((1u << layer) - 1);
+		float noise = caveNoise(x + half_span, y + half_span, z + half_span);
+		float noise_bound = cave_lipschitz_ * half_span*std::sqrt(3.0);
+		if (is_all_stone && noise + noise_bound < parameters_.cave_threshold)
+		{
+			return {0, STONE};
+		}
+		if (is_all_cave_depth && noise - noise_bound > parameters_.cave_threshold)
+		{
+			return {0, 0};
+		}
+	}
+
+	Octree::OctreeNode children[8];
+	uint32_t half_size = 1u << (layer-1);
+	for (int child = 0; child < 8; child++)
+	{
+		children[child] = buildNode(subtree,
+				x + ((child & 1) ? half_size : 0),
+				y + ((child & 2) ? half_size : 0),
+				z + ((child & 4) ? half_size : 0),
+				layer-1);
+	}
+	if (Octree::isUniformBlock(children))
+	{
+		return children[0];
+	}
+	IndirectionElement block = (subtree.blocks.size() >> 3) + 1;
+	subtree.blocks.insert(subtree.blocks.end(), children, children+8);
+	return {block, Octree::calculateMaterialTypeFromChildren(children)};
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Build the node above the subtrees covering 2^layer voxels from
+ * corner (x, y, z), out of the (already placed) subtrees' roots
+\* ---------------------------------------------------------------- */
+Octree::OctreeNode TerrainGenerator::stitchNode(std::vector<Subtree> &subtrees, std::vector<Octree::OctreeNode> &pool,
+		uint32_t x, uint32_t y, uint32_t z, int layer, int subtree_layer)
+{
+	if (layer == subtree_layer)
+	{
+		uint32_t subtrees_per_axis = 1u << (num_layers_ - subtree_layer);
+		size_t subtree_index = (static_cast<size_t>(z >> subtree_layer)*subtrees_per_axis + (y >> subtree_layer))
+				*subtrees_per_axis + (x >> subtree_layer);
+		return subtrees[subtree_index].root;
+	}
+	Octree::OctreeNode children[8];
+	uint32_t half_size = 1u << (layer-1);
+	for (int child = 0; child < 8; child++)
+	{
+		children[child] = stitchNode(subtrees, pool,
+				x + ((child & 1) ? half_size : 0),
+				y + ((child & 2) ? half_size : 0),
+				z + ((child & 4) ? half_size : 0),
+				layer-1, subtree_layer);
+	}
+	if (Octree::isUniformBlock(children))
+	{
+		return children[0];
+	}
+	IndirectionElement block = pool.size() >> 3;
+	pool.insert(pool.end(), children, children+8);
+	return {block, Octree::calculateMaterialTypeFromChildren(children)};
+}
+
+
+uint32_t TerrainGenerator::evaluateHeight(uint32_t x, uint32_t z)
+{
+	float height = 0.0, octave_weight = 1.0, total_weight = 0.0;
+	float frequency = height_frequency_;
+	for (int octave = 0; octave < parameters_.height_octaves; octave++)
+	{
+		height += octave_weight * valueNoise(x*frequency, z*frequency, octave);
+		total_weight += octave_weight;
+		octave_weight *= 0.5;
+		frequency *= 2.0;
+	}
+	float world_height = base_height_ + height_amplitude_*height/total_weight;
+	return static_cast<uint32_t>(std::clamp(world_height, 0.0f, static_cast<float>(side_)));
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The voxel at (x, y, z) in a column of <height>: the top voxel is
+ * grass, then dirt, then stone, with sand instead of grass and dirt
+ * in low columns, and air wherever a cave is
+\* ---------------------------------------------------------------- */
+VoxelTypeElement TerrainGenerator::evaluateVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t height)
+{
+	if (y >= height)
+	{
+		return 0;
+	}
+	int64_t depth = static_cast<int64_t>(height) - y; // 1 at the top voxel
+	if (depth > parameters_.cave_min_depth && depth <= parameters_.cave_max_depth &&
+	    caveNoise(x, y, z) > parameters_.cave_threshold)
+	{
+		return 0;
+	}
+	if (static_cast<int64_t>(y) < getStoneTop(height))
+	{
+		return STONE;
+	}
+	bool is_sand = height < sand_height_;
+	if (depth == 1)
+	{
+		return is_sand ? SAND : GRASS;
+	}
+	return is_sand ? SAND : DIRT;
+}
+
+
+float TerrainGenerator::caveNoise(float x, float y, float z)
+{
+	float noise = 0.0, octave_weight = 1.0, total_weight = 0.0;
+	float frequency = cave_frequency_;
+	for (int octave = 0; octave < parameters_.cave_octaves; octave++)
+	{
+		// octaves after the height's, so the two aren't correlated
+		noise += octave_weight * valueNoise(x*frequency, y*frequency, z*frequency,
+				parameters_.height_octaves + octave);
+		total_weight += octave_weight;
+		octave_weight *= 0.5;
+		frequency *= 2.0;
+	}
+	return noise/total_weight;
+}
+
+
+// smoothstep interpolation of random values in [-1, 1] at the integer lattice
+float TerrainGenerator::valueNoise(float x, float z, uint32_t octave)
+{
+	float x_floor = std::floor(x), z_floor = std::floor(z);
+	int32_t lattice_x = static_cast<int32_t>(x_floor), lattice_z = static_cast<int32_t>(z_floor);
+	float tx = x - x_floor, tz = z - z_floor;
+	tx = tx*tx*(3.0f - 2.0f*tx);
+	tz = tz*tz*(3.0f - 2.0f*tz);
+	float near_row = hashLattice(lattice_x, 0, lattice_z, octave)
+			+ tx*(hashLattice(lattice_x+1, 0, lattice_z, octave) - hashLattice(lattice_x, 0, lattice_z, octave));
+	float far_row = hashLattice(lattice_x, 0, lattice_z+1, octave)
+			+ tx*(hashLattice(lattice_x+1, 0, lattice_z+1, octave) - hashLattice(lattice_x, 0, lattice_z+1, octave));
+	return near_row + tz*(far_row - near_row);
+}
+
+
+float TerrainGenerator::valueNoise(float x, float y, float z, uint32_t octave)
+{
+	float x_floor = std::floor(x), y_floor = std::floor(y), z_floor = std::floor(z);
+	int32_t lattice_x = static_cast<int32_t>(x_floor);
+	int32_t lattice_y = static_cast<int32_t>(y_floor);
+	int32_t lattice_z = static_cast<int32_t>(z_floor);
+	float t[3] = {x - x_floor, y - y_floor, z - z_floor};
+	for (int axis = 0; axis < 3; axis++)
+	{
+		t[axis] = t[axis]*t[axis]*(3.0f - 2.0f*t[axis]);
+	}
+	float corners[8];
+	for (int corner = 0; corner < 8; corner++)
+	{
+		corners[corner] = hashLattice(lattice_x + (corner & 1), lattice_y + ((corner >> 1) & 1),
+				lattice_z + (corner >> 2), octave);
+	}
+	for (int corner = 0; corner < 4; corner++)
+	{
+		corners[corner] = corners[2*corner] + t[0]*(corners[2*corner+1] - corners[2*corner]);
+	}
+	for (int corner = 0; corner < 2; corner++)
+	{
+		corners[corner] = corners[2*corner] + t[1]*(corners[2*corner+1] - corners[2*corner]);
+	}
+	return corners[0] + t[2]*(corners[1] - corners[0]);
+}
+
+
+float TerrainGenerator::hashLattice(int32_t x, int32_t y, int32_t z, uint32_t octave)
+{
+	uint32_t hash = parameters_.seed*0x9E3779B9u ^ octave*0x85EBCA6Bu;
+	hash ^= static_cast<uint32_t>(x)*0x27D4EB2Du;
+	hash = (hash ^ (hash >> 15))*0x2C1B3C6Du;
+	hash ^= static_cast<uint32_t>(y)*0x165667B1u;
+	hash = (hash ^ (hash >> 12))*0x297A2D39u;
+	hash ^= static_cast<uint32_t>(z)*0xC2B2AE35u;
+	hash = (hash ^ (hash >> 16))*0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	return static_cast<float>(hash >> 8)*(2.0f/16777215.0f) - 1.0f;
+}
+
+} // namespace Anthrax
@@ -13,6 +13,7 @@
 
 #include "vox_handler.hpp"
 #include "gltf_handler.hpp"
+#include "octree_file.hpp"
 
 namespace Anthrax
 {
@@ -39,13 +40,16 @@ void World::mainSetup(int num_layers)
 	{
 		throw std::runtime_error("World must have at least 1 layer!");
 	}
-	octree_ = new Octree(num_layers);
+	// the pool can never outgrow the GPU buffer it's uploaded to
+	octree_ = new Octree(num_layers, max_gpu_buffer_size_);
 	generate();
 }
 
 
 World::~World()
 {
+	delete streamer_;
+	dropDynamicModels();
 	delete octree_;
 }
 
@@ -64,7 +68,7 @@ void World::generate()
 	std::cout << "generating world... " << std::flush;
 
 	// set up world as empty node
-	octree_->clear();
+	clear();
 	materials_[0] = Material(0.0, 0.0, 0.0, 0.0);
 	
 
@@ -229,6 +233,35 @@ void World::generate()
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Replace the world with procedural terrain (see TerrainGenerator),
+ * built on <num_threads> threads (0 for one per hardware thread).
+ * The same parameters always give the same world.
+\* ---------------------------------------------------------------- */
+void World::generateTerrain(const TerrainGenerator::Parameters &parameters, unsigned int num_threads)
+{
+	if (streamer_)
+	{
+		throw std::runtime_error("generateTerrain(): can't replace a world that is being streamed!");
+	}
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	dropDynamicModels();
+	instance_table_.clearInstances();
+	ThreadPool thread_pool(num_threads);
+	TerrainGenerator generator(parameters);
+	// throws, leaving the octree as it was, if the terrain won't fit in the pool (and so the GPU buffer)
+	generator.generate(octree_, thread_pool);
+	materials_[TerrainGenerator::GRASS] = Material(0.30, 0.55, 0.20);
+	materials_[TerrainGenerator::DIRT] = Material(0.45, 0.32, 0.20);
+	materials_[TerrainGenerator::STONE] = Material(0.50, 0.50, 0.52);
+	materials_[TerrainGenerator::SAND] = Material(0.85, 0.78, 0.55);
+	std::cout << "Time to generate terrain: " << timer.stop() << "ms ("
+	          << (getOctreePoolSize() >> 10) << "KB, " << thread_pool.getNumThreads() << " threads)" << std::endl;
+	return;
+}
+
+
 void World::generateSerpinskiPyramidNode(unsigned int index)
 {
 	generateSingleSerpinskiPyramidNode(index, LOG2K, LOG2K, 0, 0, 0, false);
@@ -291,18 +324,710 @@ void World::addModel(
 	Octree::convertToUnsignedLoc(octree_->getLayer(),
 			x_offset, y_offset, z_offset,
 			&new_x, &new_y, &new_z);
+	markRegionDirty(getModelBox(model, new_x, new_y, new_z));
+	liftDynamicModels(getModelRegion(model, new_x, new_y, new_z));
 	return octree_->mergeOctree(model->getOctree(), new_x, new_y, new_z);
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Combine a model into the world, centered on the offset like
+ * addModel(), e.g. to carve it out (SUBTRACT) or stamp it in (UNION).
+ * Only the voxels where the two differ are touched (see
+ * Octree::applyCsg).
+\* ---------------------------------------------------------------- */
+void World::applyModel(
+		Model *model,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset,
+		Octree::CsgOperation operation
+		)
+{
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&new_x, &new_y, &new_z);
+	Octree *model_octree = model->getOctree();
+	uint32_t half_size = 1u << (model_octree->getLayer()-1);
+	if (new_x < half_size || new_y < half_size || new_z < half_size)
+	{
+		throw std::runtime_error("applyModel(): model must be within the world!");
+	}
+	markRegionDirty(getModelBox(model, new_x, new_y, new_z));
+	liftDynamicModels(getModelRegion(model, new_x, new_y, new_z));
+	return octree_->applyCsg(operation, model_octree,
+			new_x - half_size, new_y - half_size, new_z - half_size);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Store a model for instancing. Its voxels are copied once, however
+ * many instances of it are placed.
+\* ---------------------------------------------------------------- */
+InstanceTable::ModelId World::addInstanceModel(Model *model)
+{
+	Octree *model_octree = model->getOctree();
+	if ((instance_table_.getModelPoolSize() + model_octree->size())*sizeof(Octree::OctreeNode)
+	    > max_instance_model_pool_size_)
+	{
+		throw std::runtime_error("Instance model pool is too big to fit in GPU memory!");
+	}
+	return instance_table_.addModel(model_octree);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Place an instance of a stored model, centered on the offset like
+ * addModel() and turned to one of the 24 axis-aligned orientations
+ * (see InstanceTable). Its box is filled with the instance's voxel
+ * type, so a box aligned to its own size is a single node write; an
+ * unaligned one splits the nodes along its surface.
+\* ---------------------------------------------------------------- */
+InstanceTable::InstanceId World::addInstance(
+		InstanceTable::ModelId model_id,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset,
+		int orientation
+		)
+{
+	if ((instance_table_.getInstancesSize()+1)*sizeof(InstanceTable::Instance) > max_instances_size_)
+	{
+		throw std::runtime_error("Too many instances to fit in GPU memory!");
+	}
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&new_x, &new_y, &new_z);
+	uint32_t half_size = 1u << (instance_table_.getModelLayer(model_id)-1);
+	uint64_t world_size = uint64_t(1) << octree_->getLayer();
+	if (new_x < half_size || new_y < half_size || new_z < half_size ||
+	    new_x + half_size > world_size || new_y + half_size > world_size || new_z + half_size > world_size)
+	{
+		throw std::runtime_error("addInstance(): instance must be within the world!");
+	}
+	Region box = {{new_x - half_size, new_y - half_size, new_z - half_size},
+			{new_x + half_size - 1, new_y + half_size - 1, new_z + half_size - 1}};
+	markRegionDirty(box);
+	InstanceTable::InstanceId id = instance_table_.addInstance(model_id,
+			new_x - half_size, new_y - half_size, new_z - half_size, orientation);
+	liftDynamicModels(box);
+	octree_->fillBox(new_x - half_size, new_y - half_size, new_z - half_size,
+			new_x + half_size - 1, new_y + half_size - 1, new_z + half_size - 1,
+			InstanceTable::getVoxelType(id));
+	return id;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Clear whatever is left of an instance to air and free its id
+\* ---------------------------------------------------------------- */
+void World::removeInstance(InstanceTable::InstanceId id)
+{
+	if (id >= instance_table_.getInstancesSize() || instance_table_.getInstances()[id].model_layer < 0)
+	{
+		throw std::runtime_error("removeInstance(): no such instance!");
+	}
+	const InstanceTable::Instance &instance = instance_table_.getInstances()[id];
+	uint32_t max_offset = (1u << instance.model_layer) - 1;
+	Region region = {{instance.corner[0], instance.corner[1], instance.corner[2]},
+			{instance.corner[0] + max_offset, instance.corner[1] + max_offset, instance.corner[2] + max_offset}};
+	markRegionDirty(region);
+	liftDynamicModels(region);
+	std::vector<Octree::Leaf> leaves;
+	VoxelTypeElement voxel_type = InstanceTable::getVoxelType(id);
+	octree_->visitLeaves(region.min[0], region.min[1], region.min[2], region.max[0], region.max[1], region.max[2],
+		[&](const Octree::Leaf &leaf)
+		{
+			if (leaf.voxel_type == voxel_type)
+			{
+				leaves.push_back(leaf);
+			}
+		});
+	for (const Octree::Leaf &leaf : leaves)
+	{
+		octree_->setVoxelAtLayer(leaf.x >> leaf.layer, leaf.y >> leaf.layer, leaf.z >> leaf.layer, 0, leaf.layer);
+	}
+	return instance_table_.removeInstance(id);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The voxel type at a location, looking through instances
+\* ---------------------------------------------------------------- */
+VoxelTypeElement World::getVoxel(int32_t x, int32_t y, int32_t z)
+{
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x, y, z,
+			&new_x, &new_y, &new_z);
+	return instance_table_.resolve(octree_->getVoxel(new_x, new_y, new_z), new_x, new_y, new_z);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Draw a model centered on the offset (like addModel()), turned by
+ * its orientation rather than voxelized into the octree. Moving it
+ * or calling Model::setOrientation() only changes a small record,
+ * seen from the next updateOrientedModels().
+\* ---------------------------------------------------------------- */
+OrientedModelTable::OrientedModelId World::addOrientedModel(
+		Model *model,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset
+		)
+{
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&new_x, &new_y, &new_z);
+	checkModelPlacement(model, new_x, new_y, new_z);
+	return oriented_model_table_.add(model, new_x, new_y, new_z);
+}
+
+
+void World::moveOrientedModel(
+		OrientedModelTable::OrientedModelId id,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset
+		)
+{
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&new_x, &new_y, &new_z);
+	Model *model = oriented_model_table_.getModel(id);
+	if (!model)
+	{
+		throw std::runtime_error("moveOrientedModel(): no such oriented model!");
+	}
+	checkModelPlacement(model, new_x, new_y, new_z);
+	return oriented_model_table_.move(id, new_x, new_y, new_z);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Pick up moved, turned and edited oriented models. Returns whether
+ * anything changed.
+\* ---------------------------------------------------------------- */
+bool World::updateOrientedModels()
+{
+	bool changed = oriented_model_table_.update();
+	if (oriented_model_table_.getModelPoolSize()*sizeof(Octree::OctreeNode) > max_oriented_model_pool_size_)
+	{
+		throw std::runtime_error("Oriented model pool is too big to fit in GPU memory!");
+	}
+	if (OrientedModelTable::RECORDS_OFFSET + oriented_model_table_.getNumRecords()*sizeof(OrientedModelTable::Record)
+	    > max_oriented_models_size_)
+	{
+		throw std::runtime_error("Too many oriented models to fit in GPU memory!");
+	}
+	return changed;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Empty the world. Dynamic models are stamped again by the next
+ * updateDynamicModels(); instances are gone, but their models stay.
+\* ---------------------------------------------------------------- */
+void World::clear()
+{
+	if (streamer_)
+	{
+		throw std::runtime_error("clear(): can't replace a world that is being streamed!");
+	}
+	dropDynamicModels();
+	instance_table_.clearInstances();
+	return octree_->clear();
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Dynamic models are kept out of the static world: they're stamped
+ * over it by updateDynamicModels(), which only touches the ones that
+ * moved or whose voxels changed (see Model::getVersion()). Erasing a
+ * model puts back what was under it, so the static world doesn't
+ * need rebuilding. The model must stay alive until it's removed.
+ *
+ * Edits to the static world (setVoxel(), addModel(), ...) lift the
+ * dynamic models they overlap, which are stamped back over the edit
+ * on the next update. So do streamed chunks being saved, evicted or
+ * loaded, and saving the world.
+\* ---------------------------------------------------------------- */
+World::DynamicModelId World::addDynamicModel(
+		Model *model,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset
+		)
+{
+	DynamicModel dynamic_model;
+	dynamic_model.model = model;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&dynamic_model.x, &dynamic_model.y, &dynamic_model.z);
+	checkModelPlacement(model, dynamic_model.x, dynamic_model.y, dynamic_model.z);
+	dynamic_models_.push_back(dynamic_model);
+	return dynamic_models_.size()-1;
+}
+
+
+void World::moveDynamicModel(
+		DynamicModelId id,
+		int32_t x_offset,
+		int32_t y_offset,
+		int32_t z_offset
+		)
+{
+	if (id >= dynamic_models_.size() || !dynamic_models_[id].model)
+	{
+		throw std::runtime_error("moveDynamicModel(): no such dynamic model!");
+	}
+	DynamicModel &dynamic_model = dynamic_models_[id];
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			x_offset, y_offset, z_offset,
+			&new_x, &new_y, &new_z);
+	checkModelPlacement(dynamic_model.model, new_x, new_y, new_z);
+	dynamic_model.x = new_x;
+	dynamic_model.y = new_y;
+	dynamic_model.z = new_z;
+	return;
+}
+
+
+void World::removeDynamicModel(DynamicModelId id)
+{
+	if (id >= dynamic_models_.size() || !dynamic_models_[id].model)
+	{
+		throw std::runtime_error("removeDynamicModel(): no such dynamic model!");
+	}
+	dynamic_models_[id].model = nullptr;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Bring the octree up to date with the dynamic models. Returns
+ * whether anything was written; if not, the octree wasn't touched.
+\* ---------------------------------------------------------------- */
+bool World::updateDynamicModels()
+{
+	std::vector<DynamicModelId> redone_ids = eraseDynamicModels({}, true);
+	for (DynamicModelId id : redone_ids)
+	{
+		if (dynamic_models_[id].model)
+		{
+			stampDynamicModel(dynamic_models_[id]);
+		}
+	}
+	return !redone_ids.empty();
+}
+
+
+void World::checkModelPlacement(Model *model, uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t half_size = 1u << (model->getOctree()->getLayer()-1);
+	uint64_t world_size = uint64_t(1) << octree_->getLayer();
+	if (x < half_size || y < half_size || z < half_size ||
+	    x + half_size > world_size || y + half_size > world_size || z + half_size > world_size)
+	{
+		throw std::runtime_error("Model must be within the world!");
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The voxels a model centered on (x, y, z) covers, clamped to the
+ * world for models merged partly outside of it
+\* ---------------------------------------------------------------- */
+World::Region World::getModelBox(Model *model, uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t half_size = 1u << (model->getOctree()->getLayer()-1);
+	const uint32_t center[3] = {x, y, z};
+	Region box;
+	uint64_t max_coordinate = (uint64_t(1) << octree_->getLayer()) - 1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		box.min[axis] = (center[axis] > half_size) ? (center[axis] - half_size) : 0;
+		box.max[axis] = std::min(uint64_t(center[axis]) + half_size - 1, max_coordinate);
+	}
+	return box;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The voxels a model centered on (x, y, z) would be stamped over,
+ * rounded out to whole backdrop nodes
+\* ---------------------------------------------------------------- */
+World::Region World::getModelRegion(Model *model, uint32_t x, uint32_t y, uint32_t z, int *backdrop_layer)
+{
+	int node_layer = std::max(model->getOctree()->getLayer() - BACKDROP_SPLIT_LAYERS, 1);
+	if (backdrop_layer)
+	{
+		*backdrop_layer = node_layer;
+	}
+	uint32_t node_mask = ~((1u << node_layer) - 1);
+	Region region = getModelBox(model, x, y, z);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		region.min[axis] &= node_mask;
+		region.max[axis] = (region.max[axis] & node_mask) + (1u << node_layer) - 1;
+	}
+	return region;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Erase dynamic models so that <touched_regions> can be rewritten.
+ * Models are erased from the last stamped down, so each backdrop
+ * goes back over exactly what it was copied from. A stamped model
+ * has to go if it overlaps a touched region, and then its own region
+ * is touched too. With <include_changed>, models that moved, changed
+ * or were removed go as well, and the regions they'll be stamped
+ * over count as touched. Returns the ids that went, in order.
+\* ---------------------------------------------------------------- */
+std::vector<World::DynamicModelId> World::eraseDynamicModels(std::vector<Region> touched_regions, bool include_changed)
+{
+	std::vector<DynamicModelId> erased_ids;
+	for (DynamicModelId id = 0; id < dynamic_models_.size(); id++)
+	{
+		DynamicModel &dynamic_model = dynamic_models_[id];
+		bool is_erased = false;
+		if (include_changed)
+		{
+			if (dynamic_model.model)
+			{
+				is_erased = !dynamic_model.is_stamped
+						|| dynamic_model.x != dynamic_model.stamped_x
+						|| dynamic_model.y != dynamic_model.stamped_y
+						|| dynamic_model.z != dynamic_model.stamped_z
+						|| dynamic_model.model->getVersion() != dynamic_model.stamped_version;
+			}
+			else
+			{
+				is_erased = dynamic_model.is_stamped;
+			}
+		}
+		if (!is_erased && dynamic_model.is_stamped)
+		{
+			for (const Region &region : touched_regions)
+			{
+				if (dynamic_model.backdrop_region.overlaps(region))
+				{
+					is_erased = true;
+					break;
+				}
+			}
+		}
+		if (!is_erased)
+		{
+			continue;
+		}
+		erased_ids.push_back(id);
+		if (dynamic_model.is_stamped)
+		{
+			touched_regions.push_back(dynamic_model.backdrop_region);
+		}
+		if (include_changed && dynamic_model.model)
+		{
+			touched_regions.push_back(getModelRegion(dynamic_model.model,
+					dynamic_model.x, dynamic_model.y, dynamic_model.z));
+		}
+	}
+	for (size_t erased_index = erased_ids.size(); erased_index-- > 0; )
+	{
+		DynamicModel &dynamic_model = dynamic_models_[erased_ids[erased_index]];
+		if (dynamic_model.is_stamped)
+		{
+			eraseDynamicModel(dynamic_model);
+		}
+	}
+	return erased_ids;
+}
+
+
+void World::stampDynamicModel(DynamicModel &dynamic_model)
+{
+	int backdrop_layer;
+	Region region = getModelRegion(dynamic_model.model, dynamic_model.x, dynamic_model.y, dynamic_model.z,
+			&backdrop_layer);
+	uint32_t node_size = 1u << backdrop_layer;
+	for (uint64_t z = region.min[2]; z <= region.max[2]; z += node_size)
+	{
+		for (uint64_t y = region.min[1]; y <= region.max[1]; y += node_size)
+		{
+			for (uint64_t x = region.min[0]; x <= region.max[0]; x += node_size)
+			{
+				dynamic_model.backdrops.emplace_back();
+				octree_->extractSubtree(x, y, z, backdrop_layer, dynamic_model.backdrops.back());
+			}
+		}
+	}
+	octree_->mergeOctree(dynamic_model.model->getOctree(), dynamic_model.x, dynamic_model.y, dynamic_model.z);
+	dynamic_model.is_stamped = true;
+	dynamic_model.stamped_x = dynamic_model.x;
+	dynamic_model.stamped_y = dynamic_model.y;
+	dynamic_model.stamped_z = dynamic_model.z;
+	dynamic_model.stamped_version = dynamic_model.model->getVersion();
+	dynamic_model.backdrop_region = region;
+	dynamic_model.backdrop_layer = backdrop_layer;
+	return;
+}
+
+
+void World::eraseDynamicModel(DynamicModel &dynamic_model)
+{
+	const Region &region = dynamic_model.backdrop_region;
+	uint32_t node_size = 1u << dynamic_model.backdrop_layer;
+	uint32_t half_node_size = node_size >> 1;
+	// one octree is loaded with each backdrop in turn, so it's sized for the biggest
+	size_t max_backdrop_size = 0;
+	for (const std::vector<Octree::OctreeNode> &backdrop : dynamic_model.backdrops)
+	{
+		max_backdrop_size = std::max(max_backdrop_size, backdrop.size());
+	}
+	Octree backdrop_octree(dynamic_model.backdrop_layer, max_backdrop_size*sizeof(Octree::OctreeNode));
+	size_t backdrop_index = 0;
+	for (uint64_t z = region.min[2]; z <= region.max[2]; z += node_size)
+	{
+		for (uint64_t y = region.min[1]; y <= region.max[1]; y += node_size)
+		{
+			for (uint64_t x = region.min[0]; x <= region.max[0]; x += node_size)
+			{
+				const std::vector<Octree::OctreeNode> &backdrop = dynamic_model.backdrops[backdrop_index++];
+				backdrop_octree.loadPool(dynamic_model.backdrop_layer, backdrop.data(), backdrop.size(), true);
+				// aligned to the node size, so the backdrop is grafted in as-is
+				octree_->mergeOctree(&backdrop_octree, x + half_node_size, y + half_node_size, z + half_node_size);
+			}
+		}
+	}
+	dynamic_model.backdrops.clear();
+	dynamic_model.is_stamped = false;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Erase the dynamic models overlapping <region> before the static
+ * world is edited there. They're stamped again by the next update.
+\* ---------------------------------------------------------------- */
+void World::liftDynamicModels(const Region &region)
+{
+	if (dynamic_models_.empty())
+	{
+		return;
+	}
+	eraseDynamicModels({region}, false);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Note an edit to <region> of the static world, so the streamed
+ * chunks it overlaps are saved before they're evicted. Throws,
+ * before anything is written, if any of them isn't resident.
+\* ---------------------------------------------------------------- */
+void World::markRegionDirty(const Region &region)
+{
+	if (!streamer_)
+	{
+		return;
+	}
+	return streamer_->markDirty(region.min[0], region.min[1], region.min[2],
+			region.max[0], region.max[1], region.max[2]);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Forget what was under the dynamic models, when the static world is
+ * replaced wholesale
+\* ---------------------------------------------------------------- */
+void World::dropDynamicModels()
+{
+	for (DynamicModel &dynamic_model : dynamic_models_)
+	{
+		dynamic_model.backdrops.clear();
+		dynamic_model.is_stamped = false;
+	}
+	return;
+}
+
+
 void World::setVoxel(int32_t x, int32_t y, int32_t z, int32_t voxel_type)
 {
 	uint32_t new_x, new_y, new_z;
 	Octree::convertToUnsignedLoc(octree_->getLayer(),
 			x, y, z,
 			&new_x, &new_y, &new_z);
+	markRegionDirty({{new_x, new_y, new_z}, {new_x, new_y, new_z}});
+	liftDynamicModels({{new_x, new_y, new_z}, {new_x, new_y, new_z}});
 	return octree_->setVoxel(new_x, new_y, new_z, voxel_type);
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Page the world in and out of a directory of chunk files (see
+ * ChunkStreamer), keeping at most memory_budget bytes of chunks
+ * resident. The world starts out empty and fills in around the
+ * camera as updateStreaming() is called.
+\* ---------------------------------------------------------------- */
+void World::openStreaming(const std::string &directory, int chunk_layers, size_t memory_budget)
+{
+	if (memory_budget > max_gpu_buffer_size_)
+	{
+		throw std::runtime_error("World streaming budget is bigger than the GPU buffer!");
+	}
+	closeStreaming();
+	clear();
+	streamer_ = new ChunkStreamer(octree_, directory, chunk_layers, memory_budget);
+	// dynamic models are lifted off a chunk before it's saved, evicted or
+	// loaded, so they're never saved with it or left under it
+	streamer_->setBeforeChunkChange([this](uint32_t x, uint32_t y, uint32_t z, uint32_t size)
+		{
+			liftDynamicModels({{x, y, z}, {x + size - 1, y + size - 1, z + size - 1}});
+		});
+	return;
+}
+
+
+void World::updateStreaming(int32_t camera_x, int32_t camera_y, int32_t camera_z)
+{
+	if (!streamer_)
+	{
+		return;
+	}
+	uint32_t new_x, new_y, new_z;
+	Octree::convertToUnsignedLoc(octree_->getLayer(),
+			camera_x, camera_y, camera_z,
+			&new_x, &new_y, &new_z);
+	return streamer_->update(new_x, new_y, new_z);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Save every edited chunk and stop streaming. The resident chunks
+ * stay in the octree.
+\* ---------------------------------------------------------------- */
+void World::closeStreaming()
+{
+	delete streamer_;
+	streamer_ = nullptr;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The octree's statistics (see Octree::stats()), plus how much of
+ * the GPU's octree buffer the pool would fill
+\* ---------------------------------------------------------------- */
+Json::Value World::getStatsJson()
+{
+	Octree::Stats stats = octree_->stats();
+	Json::Value json;
+	json["octree"] = stats.toJson();
+	json["max_gpu_buffer_bytes"] = static_cast<Json::UInt64>(max_gpu_buffer_size_);
+	json["gpu_buffer_fraction"] = static_cast<double>(stats.bytes_pool) / max_gpu_buffer_size_;
+	return json;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the world's contents with a batch of voxels. Coordinates
+ * are unsigned octree locations (see Octree::convertToUnsignedLoc).
+\* ---------------------------------------------------------------- */
+void World::buildFromVoxels(const std::vector<Octree::VoxelRecord> &voxels)
+{
+	if (streamer_)
+	{
+		throw std::runtime_error("buildFromVoxels(): can't replace a world that is being streamed!");
+	}
+	dropDynamicModels();
+	instance_table_.clearInstances();
+	return octree_->build(voxels);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Write a batch of voxels into the world, leaving everything else
+ * as it was (unlike buildFromVoxels()). The batch is built into an
+ * octree of its own and unioned in, so its air doesn't overwrite
+ * anything. Coordinates are unsigned octree locations.
+\* ---------------------------------------------------------------- */
+void World::addVoxels(const std::vector<Octree::VoxelRecord> &voxels)
+{
+	if (voxels.empty())
+	{
+		return;
+	}
+	Region box = {{voxels[0].x, voxels[0].y, voxels[0].z}, {voxels[0].x, voxels[0].y, voxels[0].z}};
+	for (const Octree::VoxelRecord &voxel : voxels)
+	{
+		const uint32_t position[3] = {voxel.x, voxel.y, voxel.z};
+		for (int axis = 0; axis < 3; axis++)
+		{
+			box.min[axis] = std::min(box.min[axis], position[axis]);
+			box.max[axis] = std::max(box.max[axis], position[axis]);
+		}
+	}
+	markRegionDirty(box);
+	liftDynamicModels(box);
+	Octree batch(octree_->getLayer(), octree_->getMaxPoolBytes());
+	batch.build(voxels);
+	return octree_->applyCsg(Octree::CsgOperation::UNION, &batch, 0, 0, 0);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Bake the world's octree and material table to a native octree
+ * file (see OctreeFile).
+\* ---------------------------------------------------------------- */
+void World::save(const std::string &filename)
+{
+	if (instance_table_.getNumInstances() > 0)
+	{
+		throw std::runtime_error("Worlds with instances can't be saved yet!");
+	}
+	// dynamic models aren't part of the saved world
+	uint32_t max_coordinate = static_cast<uint32_t>((uint64_t(1) << octree_->getLayer()) - 1);
+	liftDynamicModels({{0, 0, 0}, {max_coordinate, max_coordinate, max_coordinate}});
+	std::vector<Material> materials(materials_, materials_+num_materials_);
+	return OctreeFile::save(filename, octree_, materials);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the world with one baked by save(). Materials past the
+ * world's material table size are dropped.
+\* ---------------------------------------------------------------- */
+void World::load(const std::string &filename)
+{
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	if (streamer_)
+	{
+		throw std::runtime_error("load(): can't replace a world that is being streamed!");
+	}
+	OctreeFile file(filename);
+	if (file.getPoolSize()*sizeof(Octree::OctreeNode) > max_gpu_buffer_size_)
+	{
+		throw std::runtime_error("World file " + filename + " is too big to fit in GPU memory!");
+	}
+	dropDynamicModels();
+	instance_table_.clearInstances();
+	file.loadInto(octree_);
+	std::vector<Material> materials = file.getMaterials();
+	for (size_t i = 0; i < materials.size() && i < num_materials_; i++)
+	{
+		materials_[i] = materials[i];
+	}
+	std::cout << "Time to load world " << filename << ": " << timer.stop() << "ms" << std::endl;
+	return;
+}
+
+
 } // namespace Anthrax
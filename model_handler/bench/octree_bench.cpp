@@ -0,0 +1,1140 @@
+/* ---------------------------------------------------------------- *\
+ * octree_bench.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2026-10-17
+ *
+ * Timings for the octree operations, each against the simple way of
+ * doing the same thing. Run with the name of a benchmark (see
+ * benchmarks below), or no name to run them all:
+ *   octree_bench build [model.octree]
+ *       bulk build vs one setVoxel per voxel, on every voxel of a
+ *       baked model (the demo's sponza by default, if it's been baked),
+ *       on 2M random voxels and on a 3M voxel surface given in a random
+ *       order, and adding that surface to an octree that isn't empty
+ *   octree_bench freelist
+ *       5M free/alloc pairs on a freelist that is 90% taken, and
+ *       allocRange on one that is full up to its last few words
+ *   octree_bench dedup [model.octree]
+ *       how far deduplicate() shrinks a baked model (sponza by
+ *       default) and a heightfield, and how long it takes
+ *   octree_bench relayout
+ *       rays through a heightfield edited in a random order, before
+ *       and after each relayout() order: rays/s and cache misses
+ *   octree_bench copy
+ *       taking a copy-on-write copy of a heightfield, editing it, and
+ *       making it private, vs editing an unshared one
+ *   octree_bench graft
+ *       mergeOctree() grafting a model at several alignments vs
+ *       merging it leaf by leaf
+ *   octree_bench cone
+ *       steps per ray through a heightfield with and without stopping
+ *       at nodes smaller than a pixel (CONE_TERMINATION in main.comp)
+ *   octree_bench bricks
+ *       memory use and CPU ray throughput of a heightfield as an
+ *       octree and as a BrickedOctree with 2^3, 4^3 and 8^3 bricks
+ *   octree_bench kary
+ *       size, lookup and ray steps of a heightfield as a KaryOctree
+ *       with 2^3 and 4^3 children per node
+ *   octree_bench getvoxels
+ *       one getVoxels() call vs getVoxel() per position, on random
+ *       and coherent queries against a heightfield
+ *   octree_bench accessor
+ *       cursor moves and steps vs getVoxel on a heightfield
+ *   octree_bench visit
+ *       visitLeaves vs parallelVisitLeaves on 1 to 8 threads (or one
+ *       per hardware thread, if more) over a whole 4096^3 world
+ *   octree_bench csg
+ *       applyCsg vs reading and writing each voxel of a prefab
+ *   octree_bench streaming [directory]
+ *       a camera flight over a world 16x the streaming budget; the
+ *       chunks are generated into <directory> on the first run
+\* ---------------------------------------------------------------- */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bricked_octree.hpp"
+#include "chunk_streamer.hpp"
+#include "freelist.hpp"
+#include "kary_octree.hpp"
+#include "octree.hpp"
+#include "octree_file.hpp"
+#include "thread_pool.hpp"
+#include "timer.hpp"
+
+using namespace Anthrax;
+
+namespace
+{
+
+// a rolling surface 3 voxels thick through the middle of the octree
+std::vector<Octree::VoxelRecord> generateHeightfield(int layer, std::mt19937 &rng)
+{
+	uint32_t size = 1u << layer;
+	std::vector<Octree::VoxelRecord> voxels;
+	for (uint32_t x = 0; x < size; x++)
+		for (uint32_t z = 0; z < size; z++)
+		{
+			double height = size / 2 + 60 * sin(x * 0.02) * cos(z * 0.03) + 20 * sin(x * 0.13 + z * 0.07);
+			for (uint32_t depth = 0; depth < 3; depth++)
+				voxels.push_back({x, uint32_t(height) - depth, z, VoxelTypeElement(1 + rng() % 3)});
+		}
+	return voxels;
+}
+
+void compareBuild(const char *name, int layer, const std::vector<Octree::VoxelRecord> &voxels)
+{
+	Timer timer(Timer::MILLISECONDS);
+	Octree built(layer), set(layer);
+	timer.start();
+	built.build(voxels);
+	long long build_time = timer.stop();
+	timer.start();
+	for (const Octree::VoxelRecord &voxel : voxels)
+		set.setVoxel(voxel.x, voxel.y, voxel.z, voxel.voxel_type);
+	long long set_time = timer.stop();
+	std::cout << name << ": build() " << build_time << "ms, setVoxel() " << set_time << "ms" << std::endl;
+	return;
+}
+
+// build and union the result in (see World::addVoxels()) vs setVoxel(), on a copy of <base>
+void compareAdd(const char *name, Octree &base, const std::vector<Octree::VoxelRecord> &voxels)
+{
+	Timer timer(Timer::MILLISECONDS);
+	Octree added(base), set(base);
+	timer.start();
+	Octree batch(base.getLayer());
+	batch.build(voxels);
+	added.applyCsg(Octree::CsgOperation::UNION, &batch, 0, 0, 0);
+	long long add_time = timer.stop();
+	timer.start();
+	for (const Octree::VoxelRecord &voxel : voxels)
+		set.setVoxel(voxel.x, voxel.y, voxel.z, voxel.voxel_type);
+	long long set_time = timer.stop();
+	std::cout << name << ": build() and union " << add_time << "ms, setVoxel() " << set_time << "ms" << std::endl;
+	return;
+}
+
+// last level cache misses of this thread, or -1 if the kernel won't count them
+class CacheMissCounter
+{
+public:
+	CacheMissCounter()
+	{
+		perf_event_attr attributes = {};
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.size = sizeof(attributes);
+		attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+		attributes.disabled = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		fd_ = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+	}
+	~CacheMissCounter() { if (fd_ >= 0) close(fd_); }
+	void start()
+	{
+		if (fd_ >= 0)
+		{
+			ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		return;
+	}
+	long long stop()
+	{
+		long long count = -1;
+		if (fd_ < 0)
+			return -1;
+		ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd_, &count, sizeof(count)) != sizeof(count))
+			return -1;
+		return count;
+	}
+private:
+	int fd_;
+};
+
+// a ray walked through an octree's pool by castPoolRay()
+struct PoolRay
+{
+	const Octree::OctreeNode *pool;
+	float origin[3];
+	float direction[3];
+	float direction_reciprocal[3];
+	float cone_angle = 0.0f; // nonzero stops at nodes smaller than the ray's footprint
+	const VoxelTypeElement *brick_pool = nullptr; // for a BrickedOctree's node pool
+	int brick_layer = 0;
+	size_t num_steps = 0;
+};
+
+// walk <ray> voxel by voxel through a brick (see BrickedOctree), each voxel a step
+VoxelTypeElement castBrickRay(PoolRay &ray, uint32_t brick, const float brick_min[3], float t_enter)
+{
+	int side = 1 << ray.brick_layer;
+	const VoxelTypeElement *voxel_types = ray.brick_pool + (size_t(brick) << (3 * ray.brick_layer));
+	int cell[3];
+	int cell_step[3];
+	float t_next[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float position = ray.origin[axis] + ray.direction[axis] * t_enter - brick_min[axis];
+		cell[axis] = std::clamp(int(std::floor(position)), 0, side - 1);
+		cell_step[axis] = (ray.direction[axis] > 0.0f) ? 1 : -1;
+		float boundary = brick_min[axis] + cell[axis] + ((cell_step[axis] > 0) ? 1 : 0);
+		t_next[axis] = (boundary - ray.origin[axis]) * ray.direction_reciprocal[axis];
+	}
+	while (true)
+	{
+		VoxelTypeElement voxel_type = voxel_types[(cell[2] * side + cell[1]) * side + cell[0]];
+		ray.num_steps++;
+		if (voxel_type != 0)
+			return voxel_type;
+		int axis = (t_next[0] <= t_next[1] && t_next[0] <= t_next[2]) ? 0 : ((t_next[1] <= t_next[2]) ? 1 : 2);
+		cell[axis] += cell_step[axis];
+		t_next[axis] += std::fabs(ray.direction_reciprocal[axis]);
+		if (cell[axis] < 0 || cell[axis] >= side)
+			return 0;
+	}
+}
+
+/* ---------------------------------------------------------------- *\
+ * Walk <ray> front to back through the children of <block> with a
+ * 2x2x2 DDA, descending into non-air children, the way main.comp
+ * walks the pool. Every node entered counts as a step. With a cone
+ * angle, a non-air node smaller than the ray's footprint is taken as
+ * the hit (see CONE_TERMINATION in main.comp).
+\* ---------------------------------------------------------------- */
+VoxelTypeElement castPoolRay(PoolRay &ray, IndirectionElement block, const float node_min[3], float node_size,
+		float t_enter)
+{
+	float child_size = node_size / 2;
+	int cell[3];
+	int cell_step[3];
+	float t_next[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float position = ray.origin[axis] + ray.direction[axis] * t_enter - node_min[axis];
+		cell[axis] = std::clamp(int(std::floor(position / child_size)), 0, 1);
+		cell_step[axis] = (ray.direction[axis] > 0.0f) ? 1 : -1;
+		float boundary = node_min[axis] + (cell[axis] + ((cell_step[axis] > 0) ? 1 : 0)) * child_size;
+		t_next[axis] = (boundary - ray.origin[axis]) * ray.direction_reciprocal[axis];
+	}
+	float t = t_enter;
+	while (true)
+	{
+		const Octree::OctreeNode &node = ray.pool[(block << 3) | cell[0] | (cell[1] << 1) | (cell[2] << 2)];
+		ray.num_steps++;
+		if (node.voxel_type != 0)
+		{
+			if (node.indirection == 0 || child_size < t * ray.cone_angle)
+				return node.voxel_type;
+			float child_min[3] = {node_min[0] + cell[0] * child_size, node_min[1] + cell[1] * child_size,
+				node_min[2] + cell[2] * child_size};
+			bool is_brick = ray.brick_pool && (node.indirection & BrickedOctree::BRICK_FLAG);
+			VoxelTypeElement voxel_type = is_brick
+				? castBrickRay(ray, node.indirection & ~BrickedOctree::BRICK_FLAG, child_min, t)
+				: castPoolRay(ray, node.indirection, child_min, child_size, t);
+			if (voxel_type != 0)
+				return voxel_type;
+		}
+		int axis = (t_next[0] <= t_next[1] && t_next[0] <= t_next[2]) ? 0 : ((t_next[1] <= t_next[2]) ? 1 : 2);
+		t = t_next[axis];
+		cell[axis] += cell_step[axis];
+		t_next[axis] += child_size * std::fabs(ray.direction_reciprocal[axis]);
+		if (cell[axis] < 0 || cell[axis] > 1)
+			return 0;
+	}
+}
+
+// a width x width image of rays from above the middle of a heightfield, looking along it and down,
+// cast in row order or (as incoherent secondary rays would be) in a random order
+struct RayImage
+{
+	size_t num_rays = 0;
+	size_t num_hits = 0;
+	size_t num_steps = 0;
+};
+
+std::vector<uint32_t> rayImagePixels(uint32_t width, bool is_shuffled)
+{
+	std::vector<uint32_t> pixels(width * width);
+	for (uint32_t pixel = 0; pixel < pixels.size(); pixel++)
+		pixels[pixel] = pixel;
+	if (is_shuffled)
+	{
+		std::mt19937 rng(1);
+		std::shuffle(pixels.begin(), pixels.end(), rng);
+	}
+	return pixels;
+}
+
+void rayImageRay(uint32_t pixel, uint32_t width, float size, float origin[3], float direction[3])
+{
+	uint32_t row = pixel / width, column = pixel % width;
+	float u = (column + 0.5f) / width * 2 - 1, v = (row + 0.5f) / width * 2 - 1;
+	float unnormalized[3] = {u, -0.4f + 0.5f * v, 1.0f};
+	float length = std::sqrt(unnormalized[0] * unnormalized[0] + unnormalized[1] * unnormalized[1] + 1.0f);
+	origin[0] = size / 2;
+	origin[1] = size * 0.75f;
+	origin[2] = 1.0f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		direction[axis] = unnormalized[axis] / length;
+		if (std::fabs(direction[axis]) < 1e-6f)
+			direction[axis] = 1e-6f;
+	}
+	return;
+}
+
+RayImage castRayImage(PoolRay ray, int layer, uint32_t width, bool is_shuffled = false)
+{
+	float size = float(1u << layer);
+	RayImage image;
+	std::vector<uint32_t> pixels = rayImagePixels(width, is_shuffled);
+	const float root_min[3] = {0.0f, 0.0f, 0.0f};
+	for (uint32_t pixel : pixels)
+	{
+		rayImageRay(pixel, width, size, ray.origin, ray.direction);
+		float t_enter = 0.0f, t_exit = INFINITY;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			ray.direction_reciprocal[axis] = 1.0f / ray.direction[axis];
+			float t_min = -ray.origin[axis] * ray.direction_reciprocal[axis];
+			float t_max = (size - ray.origin[axis]) * ray.direction_reciprocal[axis];
+			t_enter = std::max(t_enter, std::min(t_min, t_max));
+			t_exit = std::min(t_exit, std::max(t_min, t_max));
+		}
+		image.num_rays++;
+		if (t_enter <= t_exit)
+			image.num_hits += castPoolRay(ray, 0, root_min, size, t_enter) != 0;
+	}
+	image.num_steps = ray.num_steps;
+	return image;
+}
+
+void benchBuild(const char *argument)
+{
+	std::mt19937 rng(1);
+	// baked by the demo on its first run (see BAKED_MODEL_FILE in anthrax.cpp)
+	std::string model_filename = argument ? argument : "models/baked/sponza.octree";
+	if (std::filesystem::is_regular_file(model_filename))
+	{
+		OctreeFile file(model_filename);
+		Octree model(file.getNumLayers());
+		file.loadInto(&model);
+		std::vector<Octree::VoxelRecord> model_voxels;
+		model.visitLeaves([&](const Octree::Leaf &leaf)
+			{
+				uint32_t leaf_size = 1u << leaf.layer;
+				for (uint32_t z = 0; z < leaf_size; z++)
+					for (uint32_t y = 0; y < leaf_size; y++)
+						for (uint32_t x = 0; x < leaf_size; x++)
+							model_voxels.push_back({leaf.x + x, leaf.y + y, leaf.z + z, leaf.voxel_type});
+			});
+		std::shuffle(model_voxels.begin(), model_voxels.end(), rng);
+		std::string name = model_filename + " (" + std::to_string(model_voxels.size()) + " voxels)";
+		compareBuild(name.c_str(), model.getLayer(), model_voxels);
+	}
+	else
+	{
+		std::cout << "No model at " << model_filename << ", skipping it" << std::endl;
+	}
+
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::vector<Octree::VoxelRecord> voxels;
+	for (int i = 0; i < 2000000; i++)
+	{
+		uint32_t x = rng() % size, y = rng() % size;
+		voxels.push_back({x, y, (x + y) / 2, 1 + (x & 3)});
+	}
+	compareBuild("2M random voxels", layer, voxels);
+
+	// loaders hand over voxels in file order, not octree order
+	voxels = generateHeightfield(layer, rng);
+	std::shuffle(voxels.begin(), voxels.end(), rng);
+	compareBuild("3M voxel surface", layer, voxels);
+
+	Octree ground(layer);
+	ground.fillBox(0, 0, 0, size - 1, size / 2 - 40, size - 1, 4);
+	compareAdd("3M voxel surface onto ground", ground, voxels);
+	return;
+}
+
+void benchFreelist(const char *)
+{
+	size_t num_elements = 1 << 22;
+	std::mt19937_64 rng(1);
+	Freelist freelist;
+	freelist.setRange(0, num_elements, true);
+	for (size_t i = 0; i < num_elements / 10; i++)
+	{
+		size_t index = rng() % num_elements;
+		if (freelist.isTaken(index))
+			freelist.free(index);
+	}
+
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	for (int i = 0; i < 5000000; i++)
+	{
+		size_t index = rng() % num_elements;
+		while (!freelist.isTaken(index))
+			index = rng() % num_elements;
+		freelist.free(index);
+		freelist.alloc();
+	}
+	std::cout << "5M free/alloc pairs at 90% taken: " << timer.stop() << "ms" << std::endl;
+
+	// ranges, with the only holes at the end of a full list
+	freelist.setRange(0, num_elements, true);
+	for (size_t offset = num_elements - 4096; offset < num_elements; offset += 64)
+		freelist.setRange(offset, 16, false);
+	timer.start();
+	for (int i = 0; i < 100000; i++)
+	{
+		size_t offset = freelist.allocRange(8 + i % 8);
+		freelist.setRange(offset, 8 + i % 8, false);
+	}
+	std::cout << "100k allocRange/free pairs, holes only in the last 0.1%: " << timer.stop() << "ms" << std::endl;
+	return;
+}
+
+// reachable blocks before and after deduplicate(), and how long it took
+void reportDeduplicate(const std::string &name, Octree &octree)
+{
+	size_t num_blocks = octree.stats().num_reachable_blocks;
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	octree.deduplicate();
+	long long deduplicate_time = timer.stop();
+	size_t num_deduplicated_blocks = octree.stats().num_reachable_blocks;
+	std::cout << name << ": " << num_blocks << " -> " << num_deduplicated_blocks << " blocks ("
+		<< double(num_blocks) / num_deduplicated_blocks << "x) in " << deduplicate_time << "ms" << std::endl;
+	return;
+}
+
+void benchDeduplicate(const char *argument)
+{
+	std::string model_filename = argument ? argument : "models/baked/sponza.octree";
+	if (std::filesystem::is_regular_file(model_filename))
+	{
+		OctreeFile file(model_filename);
+		Octree model(file.getNumLayers());
+		file.loadInto(&model);
+		reportDeduplicate(model_filename, model);
+	}
+	else
+	{
+		std::cout << "No model at " << model_filename << ", skipping it" << std::endl;
+	}
+
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(3);
+	std::vector<Octree::VoxelRecord> voxels = generateHeightfield(layer, rng);
+	Octree terrain(layer);
+	terrain.build(voxels);
+	terrain.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	reportDeduplicate("heightfield, random materials", terrain);
+
+	// materials in 16 voxel patches, like the streaming bench's chunks
+	for (Octree::VoxelRecord &voxel : voxels)
+		voxel.voxel_type = 1 + (voxel.x / 16 + voxel.z / 16) % 3;
+	terrain.clear();
+	terrain.build(voxels);
+	terrain.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	reportDeduplicate("heightfield, patched materials", terrain);
+	return;
+}
+
+void benchRelayout(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(9);
+	// edited in a random order, so neighbouring blocks end up far apart in the pool
+	std::vector<Octree::VoxelRecord> voxels = generateHeightfield(layer, rng);
+	std::shuffle(voxels.begin(), voxels.end(), rng);
+	Octree edited(layer);
+	edited.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	for (const Octree::VoxelRecord &voxel : voxels)
+		edited.setVoxel(voxel.x, voxel.y, voxel.z, voxel.voxel_type);
+	std::cout << edited.stats().num_reachable_blocks * 8 * sizeof(Octree::OctreeNode) / 1000000
+		<< "MB reachable, 1024x1024 rays" << std::endl;
+
+	const std::pair<int, const char *> layouts[] =
+	{
+		{-1, "as edited"},
+		{int(Octree::LayoutOrder::DEPTH_FIRST), "depth first"},
+		{int(Octree::LayoutOrder::BREADTH_FIRST), "breadth first"},
+		{int(Octree::LayoutOrder::VAN_EMDE_BOAS), "van Emde Boas"},
+	};
+	CacheMissCounter cache_misses;
+	for (const auto &[layout, name] : layouts)
+	{
+		Octree octree(edited);
+		Timer timer(Timer::MICROSECONDS);
+		timer.start();
+		if (layout >= 0)
+			octree.relayout(Octree::LayoutOrder(layout));
+		std::cout << name << ": relayout() " << timer.stop() / 1000 << "ms" << std::endl;
+		octree.data();
+		for (bool is_shuffled : {false, true})
+		{
+			timer.start();
+			cache_misses.start();
+			PoolRay ray;
+			ray.pool = octree.data();
+			RayImage image = castRayImage(ray, layer, 1024, is_shuffled);
+			long long num_cache_misses = cache_misses.stop();
+			long long ray_time = timer.stop();
+			std::cout << "  " << (is_shuffled ? "random order" : "row order") << ": " << ray_time / 1000 << "ms, "
+				<< image.num_rays / (ray_time / 1e6) / 1e6 << "M rays/s, "
+				<< image.num_steps / image.num_rays << " steps/ray, cache misses ";
+			if (num_cache_misses >= 0)
+				std::cout << num_cache_misses / double(image.num_rays) << "/ray" << std::endl;
+			else
+				std::cout << "not available" << std::endl;
+		}
+	}
+	return;
+}
+
+void benchCopy(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(11);
+	Octree world(layer);
+	world.build(generateHeightfield(layer, rng));
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	std::cout << world.size() * sizeof(Octree::OctreeNode) / 1000000 << "MB pool" << std::endl;
+	std::vector<glm::uvec3> edits(10000);
+	for (glm::uvec3 &edit : edits)
+		edit = {uint32_t(rng() % size), uint32_t(size / 2 - 100 + rng() % 200), uint32_t(rng() % size)};
+
+	Timer timer(Timer::MICROSECONDS);
+	timer.start();
+	Octree *snapshot = new Octree(world);
+	long long copy_time = timer.stop();
+	timer.start();
+	snapshot->setVoxel(edits[0].x, edits[0].y, edits[0].z, 7);
+	long long first_edit_time = timer.stop();
+	timer.start();
+	for (const glm::uvec3 &edit : edits)
+		snapshot->setVoxel(edit.x, edit.y, edit.z, 7);
+	long long shared_edit_time = timer.stop();
+	timer.start();
+	snapshot->detach();
+	long long detach_time = timer.stop();
+	timer.start();
+	for (const glm::uvec3 &edit : edits)
+		snapshot->setVoxel(edit.x, edit.y, edit.z, 8);
+	long long private_edit_time = timer.stop();
+	delete snapshot;
+
+	// an undo history: a snapshot before each of 100 small edits
+	std::vector<Octree> history;
+	history.reserve(100);
+	timer.start();
+	for (int i = 0; i < 100; i++)
+	{
+		history.emplace_back(world);
+		for (int j = 0; j < 100; j++)
+			world.setVoxel(edits[i * 100 + j].x, edits[i * 100 + j].y, edits[i * 100 + j].z, 9);
+	}
+	long long history_time = timer.stop();
+	size_t shared_pool_bytes = world.size() * sizeof(Octree::OctreeNode);
+
+	std::cout << "copy " << copy_time << "us, first edit of the copy " << first_edit_time
+		<< "us, full private copy (detach()) " << detach_time / 1000 << "ms" << std::endl;
+	std::cout << "10k edits: on a shared copy " << shared_edit_time / 1000 << "ms, on a private one "
+		<< private_edit_time / 1000 << "ms" << std::endl;
+	std::cout << "100 snapshots with 100 edits between each: " << history_time / 1000 << "ms, "
+		<< shared_pool_bytes / 1000000 << "MB pool shared by all of them" << std::endl;
+	return;
+}
+
+void benchGraft(const char *)
+{
+	int layer = 10, model_layer = 9;
+	uint32_t size = 1u << layer, model_size = 1u << model_layer;
+	std::mt19937 rng(13);
+	Octree model(model_layer);
+	model.build(generateHeightfield(model_layer, rng));
+	model.fillBox(0, 0, 0, model_size - 1, model_size / 2 - 50, model_size - 1, 2);
+	// the same model in the corner of one as big as the world, which
+	// can't be grafted, so is merged leaf by leaf
+	Octree big_model(layer);
+	big_model.mergeOctree(&model, model_size / 2, model_size / 2, model_size / 2);
+	std::cout << "Merging a " << model.stats().num_leaves << " leaf model into an empty world" << std::endl;
+
+	Timer timer(Timer::MILLISECONDS);
+	for (uint32_t alignment : {model_size, 64u, 8u, 1u})
+	{
+		Octree world(layer);
+		uint32_t center = model_size / 2 + ((alignment == model_size) ? 0 : alignment);
+		timer.start();
+		world.mergeOctree(&model, center, center, center);
+		std::cout << "graft, corner aligned to " << alignment << ": " << timer.stop() << "ms" << std::endl;
+	}
+	Octree world(layer);
+	timer.start();
+	world.mergeOctree(&big_model, size / 2, size / 2, size / 2);
+	std::cout << "leaf by leaf: " << timer.stop() << "ms" << std::endl;
+	return;
+}
+
+void benchCone(const char *)
+{
+	int layer = 11;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(15);
+	Octree world(layer);
+	world.build(generateHeightfield(layer, rng));
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+
+	// 512x512 of the rays of a 90 degree view, footprints as main.comp works them out
+	const std::pair<float, const char *> cones[] =
+	{
+		{0.0f, "off"},
+		{2.0f / 1920, "1920 pixels wide"},
+		{2.0f / 960, "1920 pixels wide, CONE_TERMINATION 2.0"},
+		{2.0f / 480, "1920 pixels wide, CONE_TERMINATION 4.0"},
+	};
+	for (const auto &[cone_angle, name] : cones)
+	{
+		Timer timer(Timer::MILLISECONDS);
+		timer.start();
+		PoolRay ray;
+		ray.pool = world.data();
+		ray.cone_angle = cone_angle;
+		RayImage image = castRayImage(ray, layer, 512);
+		long long ray_time = timer.stop();
+		std::cout << name << ": " << double(image.num_steps) / image.num_rays << " steps/ray, "
+			<< ray_time << "ms" << std::endl;
+	}
+	return;
+}
+
+void benchBricks(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(17);
+	Octree world(layer);
+	world.build(generateHeightfield(layer, rng));
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	world.compact();
+
+	for (int brick_layer : {0, 1, 2, 3})
+	{
+		Timer timer(Timer::MILLISECONDS);
+		PoolRay ray;
+		size_t num_bytes;
+		long long convert_time = 0;
+		BrickedOctree *bricked = nullptr;
+		if (brick_layer == 0)
+		{
+			ray.pool = world.data();
+			num_bytes = world.size() * sizeof(Octree::OctreeNode);
+		}
+		else
+		{
+			timer.start();
+			bricked = new BrickedOctree(&world, brick_layer);
+			convert_time = timer.stop();
+			ray.pool = bricked->getNodePool();
+			ray.brick_pool = bricked->getBrickPool();
+			ray.brick_layer = brick_layer;
+			num_bytes = bricked->sizeInBytes();
+		}
+		timer.start();
+		RayImage image = castRayImage(ray, layer, 1024);
+		long long ray_time = timer.stop();
+		std::cout << ((brick_layer == 0) ? std::string("octree") : std::to_string(1 << brick_layer) + "^3 bricks")
+			<< ": " << num_bytes / 1000000 << "MB, converted in " << convert_time << "ms, "
+			<< image.num_rays / (ray_time / 1e3) / 1e6 << "M rays/s, "
+			<< double(image.num_steps) / image.num_rays << " steps/ray" << std::endl;
+		delete bricked;
+	}
+	return;
+}
+
+// the same image as castRayImage(), through a KaryOctree
+template <int LOG2K>
+RayImage castKaryRayImage(KaryOctree<LOG2K> &tree, int layer, uint32_t width)
+{
+	RayImage image;
+	for (uint32_t pixel : rayImagePixels(width, false))
+	{
+		float origin[3], direction[3];
+		rayImageRay(pixel, width, float(1u << layer), origin, direction);
+		image.num_rays++;
+		image.num_hits += tree.castRay(origin, direction, nullptr, &image.num_steps) != 0;
+	}
+	return image;
+}
+
+template <int LOG2K>
+void reportKaryOctree(Octree &octree, const std::vector<Octree::VoxelRecord> &lookups)
+{
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	KaryOctree<LOG2K> tree(&octree);
+	long long convert_time = timer.stop();
+	size_t num_lookup_steps = 0;
+	size_t num_mismatches = 0;
+	timer.start();
+	for (const Octree::VoxelRecord &lookup : lookups)
+		num_mismatches += tree.getVoxel(lookup.x, lookup.y, lookup.z, &num_lookup_steps) != lookup.voxel_type;
+	long long lookup_time = timer.stop();
+	timer.start();
+	RayImage image = castKaryRayImage(tree, octree.getLayer(), 1024);
+	long long ray_time = timer.stop();
+	std::cout << "k=" << (1 << LOG2K) << ": " << tree.getNumNodes() << " nodes, " << tree.sizeInBytes() / 1000000
+		<< "MB, converted in " << convert_time << "ms" << std::endl;
+	std::cout << "  " << lookups.size() << " lookups " << lookup_time << "ms, "
+		<< double(num_lookup_steps) / lookups.size() << " steps each" << ((num_mismatches != 0) ? " (WRONG)" : "")
+		<< std::endl;
+	std::cout << "  " << image.num_rays << " rays " << ray_time << "ms, " << double(image.num_steps) / image.num_rays
+		<< " steps/ray, " << image.num_hits << " hits" << std::endl;
+	return;
+}
+
+void benchKary(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(19);
+	Octree world(layer);
+	std::vector<Octree::VoxelRecord> voxels = generateHeightfield(layer, rng);
+	world.build(voxels);
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	std::shuffle(voxels.begin(), voxels.end(), rng);
+	std::cout << "Binary pool " << world.size() * sizeof(Octree::OctreeNode) / 1000000 << "MB" << std::endl;
+	reportKaryOctree<1>(world, voxels);
+	reportKaryOctree<2>(world, voxels);
+	return;
+}
+
+// getVoxel() on each position vs one getVoxels() call, checking they agree
+void compareGetVoxels(const char *name, Octree &octree, const std::vector<glm::uvec3> &positions)
+{
+	std::vector<VoxelTypeElement> single(positions.size()), batched(positions.size()), sorted(positions.size());
+	Timer timer(Timer::MICROSECONDS);
+	timer.start();
+	for (size_t i = 0; i < positions.size(); i++)
+		single[i] = octree.getVoxel(positions[i].x, positions[i].y, positions[i].z);
+	long long single_time = timer.stop();
+	timer.start();
+	octree.getVoxels(positions.data(), positions.size(), batched.data());
+	long long batched_time = timer.stop();
+	timer.start();
+	octree.getVoxels(positions.data(), positions.size(), sorted.data(), true);
+	long long sorted_time = timer.stop();
+	std::cout << name << ": getVoxel() " << single_time / 1000.0 << "ms, getVoxels() " << batched_time / 1000.0
+		<< "ms (" << double(single_time) / batched_time << "x), morton sorted " << sorted_time / 1000.0
+		<< "ms (" << double(single_time) / sorted_time << "x)"
+		<< ((single != batched || single != sorted) ? " MISMATCH" : "") << std::endl;
+	return;
+}
+
+void benchGetVoxels(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	size_t num_queries = 1000000;
+	std::mt19937 rng(21);
+	Octree world(layer);
+	std::vector<Octree::VoxelRecord> voxels = generateHeightfield(layer, rng);
+	world.build(voxels);
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+	world.data();
+	std::cout << world.size() * sizeof(Octree::OctreeNode) / 1000000 << "MB pool, "
+		<< num_queries / 1000000 << "M queries each" << std::endl;
+
+	std::vector<glm::uvec3> positions(num_queries);
+	for (glm::uvec3 &position : positions)
+		position = {uint32_t(rng() % size), uint32_t(rng() % size), uint32_t(rng() % size)};
+	compareGetVoxels("random, whole cube", world, positions);
+	for (glm::uvec3 &position : positions)
+		position = {uint32_t(rng() % size), uint32_t(size / 2 - 100 + rng() % 200), uint32_t(rng() % size)};
+	compareGetVoxels("random, near the surface", world, positions);
+	for (glm::uvec3 &position : positions)
+	{
+		const Octree::VoxelRecord &voxel = voxels[rng() % voxels.size()];
+		position = {voxel.x, voxel.y, voxel.z};
+	}
+	compareGetVoxels("random, on the surface", world, positions);
+
+	// a physics-style sweep of a 100^3 box, then points along rays
+	size_t i = 0;
+	for (uint32_t z = 300; z < 400; z++)
+		for (uint32_t y = size / 2 - 50; y < size / 2 + 50; y++)
+			for (uint32_t x = 600; x < 700; x++)
+				positions[i++] = {x, y, z};
+	compareGetVoxels("coherent, 100^3 box", world, positions);
+	for (i = 0; i < num_queries; i++)
+	{
+		size_t ray = i / 1000, step = i % 1000;
+		double angle = ray * 0.0063;
+		positions[i] = {uint32_t(size / 2 + step * 0.5 * cos(angle)), uint32_t(size / 2 - 60 + step * 0.05),
+			uint32_t(size / 2 + step * 0.5 * sin(angle))};
+	}
+	compareGetVoxels("coherent, along rays", world, positions);
+	return;
+}
+
+void benchAccessor(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(3);
+	std::vector<Octree::VoxelRecord> voxels = generateHeightfield(layer, rng);
+	Octree octree(layer);
+	octree.build(voxels);
+	Octree::Accessor *accessor = octree.createAccessor();
+	Timer timer(Timer::MILLISECONDS);
+
+	// 3x3x3 neighbourhoods around surface voxels, in random order
+	std::vector<size_t> picks(200000);
+	for (size_t &pick : picks)
+		pick = rng() % voxels.size();
+	uint64_t getvoxel_sum = 0, accessor_sum = 0;
+	timer.start();
+	for (size_t pick : picks)
+		for (int dz = -1; dz <= 1; dz++)
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dx = -1; dx <= 1; dx++)
+					getvoxel_sum += octree.getVoxel(voxels[pick].x + dx, voxels[pick].y + dy, voxels[pick].z + dz);
+	long long getvoxel_time = timer.stop();
+	timer.start();
+	for (size_t pick : picks)
+		for (int dz = -1; dz <= 1; dz++)
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					accessor->moveTo(voxels[pick].x + dx, voxels[pick].y + dy, voxels[pick].z + dz);
+					accessor_sum += accessor->getVoxelType();
+				}
+	long long accessor_time = timer.stop();
+	if (getvoxel_sum != accessor_sum)
+		throw std::runtime_error("Accessor and getVoxel() disagree!");
+	std::cout << "200k neighbourhoods: getVoxel() " << getvoxel_time << "ms, moveTo() " << accessor_time << "ms" << std::endl;
+
+	// rows along x through the surface
+	getvoxel_sum = accessor_sum = 0;
+	timer.start();
+	for (uint32_t z = 0; z < size; z += 16)
+		for (uint32_t y = size / 2 - 64; y < size / 2 + 64; y += 4)
+			for (uint32_t x = 0; x < size; x++)
+				getvoxel_sum += octree.getVoxel(x, y, z);
+	getvoxel_time = timer.stop();
+	timer.start();
+	for (uint32_t z = 0; z < size; z += 16)
+		for (uint32_t y = size / 2 - 64; y < size / 2 + 64; y += 4)
+		{
+			accessor->moveTo(0, y, z);
+			accessor_sum += accessor->getVoxelType();
+			for (uint32_t x = 1; x < size; x++)
+			{
+				accessor->step(0, 1);
+				accessor_sum += accessor->getVoxelType();
+			}
+		}
+	accessor_time = timer.stop();
+	if (getvoxel_sum != accessor_sum)
+		throw std::runtime_error("Accessor and getVoxel() disagree!");
+	std::cout << "2M voxels in rows: getVoxel() " << getvoxel_time << "ms, step() " << accessor_time << "ms" << std::endl;
+
+	size_t num_leaves = 0;
+	accessor->moveTo(0, 0, 0);
+	timer.start();
+	do
+	{
+		num_leaves++;
+	} while (accessor->nextLeaf());
+	std::cout << num_leaves << " leaves: nextLeaf() " << timer.stop() << "ms" << std::endl;
+	accessor->destroy();
+	return;
+}
+
+VoxelTypeElement applyCsgToVoxel(Octree::CsgOperation operation,
+		VoxelTypeElement voxel_type, VoxelTypeElement other_voxel_type)
+{
+	switch (operation)
+	{
+		case Octree::CsgOperation::UNION:
+			return other_voxel_type ? other_voxel_type : voxel_type;
+		case Octree::CsgOperation::SUBTRACT:
+			return other_voxel_type ? 0 : voxel_type;
+		case Octree::CsgOperation::INTERSECT:
+			return other_voxel_type ? voxel_type : 0;
+		case Octree::CsgOperation::REPLACE:
+			return (voxel_type && other_voxel_type) ? other_voxel_type : voxel_type;
+	}
+	return voxel_type;
+}
+
+void benchVisit(const char *)
+{
+	// a 4096^3 world: 16 grafted 1024^3 terrain tiles over a solid base
+	int layer = 12, tile_layer = 10;
+	uint32_t size = 1u << layer, tile_size = 1u << tile_layer;
+	std::mt19937 rng(18);
+	Octree tile(tile_layer);
+	tile.build(generateHeightfield(tile_layer, rng));
+	tile.fillBox(0, 0, 0, tile_size - 1, tile_size / 2 - 90, tile_size - 1, 2);
+	Octree world(layer, size_t(4) << 30);
+	world.fillBox(0, 0, 0, size - 1, size / 2 - tile_size / 2 - 1, size - 1, 3);
+	for (uint32_t tile_z = 0; tile_z < size; tile_z += tile_size)
+		for (uint32_t tile_x = 0; tile_x < size; tile_x += tile_size)
+			world.mergeOctree(&tile, tile_x + tile_size / 2, size / 2, tile_z + tile_size / 2);
+	std::cout << world.size() * sizeof(Octree::OctreeNode) / 1000000 << "MB pool, "
+		<< std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+	Timer timer(Timer::MILLISECONDS);
+	uint64_t num_leaves = 0, volume = 0;
+	timer.start();
+	world.visitLeaves([&](const Octree::Leaf &leaf)
+	{
+		num_leaves++;
+		volume += uint64_t(1) << (3 * leaf.layer);
+	});
+	long long serial_time = timer.stop();
+	std::cout << "visitLeaves: " << num_leaves << " solid leaves in " << serial_time << "ms" << std::endl;
+	std::vector<unsigned int> thread_counts = {1, 2, 4, 8};
+	if (std::thread::hardware_concurrency() > 8)
+		thread_counts.push_back(std::thread::hardware_concurrency());
+	for (unsigned int num_threads : thread_counts)
+	{
+		ThreadPool thread_pool(num_threads);
+		std::vector<uint64_t> worker_leaves(num_threads), worker_volume(num_threads);
+		timer.start();
+		world.parallelVisitLeaves(thread_pool, [&](const Octree::Leaf &leaf, unsigned int worker)
+		{
+			worker_leaves[worker]++;
+			worker_volume[worker] += uint64_t(1) << (3 * leaf.layer);
+		});
+		long long parallel_time = timer.stop();
+		uint64_t parallel_leaves = 0, parallel_volume = 0;
+		for (unsigned int worker = 0; worker < num_threads; worker++)
+		{
+			parallel_leaves += worker_leaves[worker];
+			parallel_volume += worker_volume[worker];
+		}
+		if (parallel_leaves != num_leaves || parallel_volume != volume)
+			throw std::runtime_error("parallelVisitLeaves and visitLeaves disagree!");
+		std::cout << "parallelVisitLeaves, " << num_threads << " threads: " << parallel_time << "ms ("
+			<< double(serial_time) / parallel_time << "x)" << std::endl;
+	}
+	return;
+}
+
+void benchCsg(const char *)
+{
+	int layer = 10;
+	uint32_t size = 1u << layer;
+	std::mt19937 rng(5);
+	Octree world(layer);
+	world.build(generateHeightfield(layer, rng));
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 90, size - 1, 1);
+
+	// the voxel-by-voxel side doesn't clear outside the prefab, so INTERSECT is left out
+	const std::pair<Octree::CsgOperation, const char *> operations[] =
+	{
+		{Octree::CsgOperation::UNION, "union"},
+		{Octree::CsgOperation::SUBTRACT, "subtract"},
+		{Octree::CsgOperation::REPLACE, "replace"},
+	};
+	for (int prefab_layer : {5, 7})
+	{
+		uint32_t prefab_size = 1u << prefab_layer;
+		double center = (prefab_size - 1) / 2.0, radius = prefab_size / 2.0 - 1;
+		Octree prefab(prefab_layer);
+		for (uint32_t z = 0; z < prefab_size; z++)
+			for (uint32_t y = 0; y < prefab_size; y++)
+				for (uint32_t x = 0; x < prefab_size; x++)
+					if (std::hypot(x - center, y - center, z - center) <= radius)
+						prefab.setVoxel(x, y, z, 10 + (x / 4 + y / 4) % 2);
+
+		// unaligned, so the prefab straddles node boundaries
+		uint32_t x_min = 301, y_min = size / 2 - prefab_size / 2 + 3, z_min = 517;
+		for (const auto &[operation, name] : operations)
+		{
+			Octree csg_world(world), voxel_world(world);
+			Timer timer(Timer::MICROSECONDS);
+			timer.start();
+			csg_world.applyCsg(operation, &prefab, x_min, y_min, z_min);
+			long long csg_time = timer.stop();
+			timer.start();
+			for (uint32_t z = 0; z < prefab_size; z++)
+				for (uint32_t y = 0; y < prefab_size; y++)
+					for (uint32_t x = 0; x < prefab_size; x++)
+					{
+						VoxelTypeElement voxel_type = voxel_world.getVoxel(x_min + x, y_min + y, z_min + z);
+						VoxelTypeElement new_voxel_type = applyCsgToVoxel(operation, voxel_type, prefab.getVoxel(x, y, z));
+						if (new_voxel_type != voxel_type)
+							voxel_world.setVoxel(x_min + x, y_min + y, z_min + z, new_voxel_type);
+					}
+			long long voxel_time = timer.stop();
+			std::cout << prefab_size << "^3 " << name << ": applyCsg() " << csg_time / 1000.0
+				<< "ms, voxel by voxel " << voxel_time / 1000.0 << "ms" << std::endl;
+		}
+	}
+	return;
+}
+
+double streamingHeight(double x, double z)
+{
+	return 2048 + 60 * sin(x * 0.02) * cos(z * 0.03) + 20 * sin(x * 0.13 + z * 0.07)
+		+ 300 * sin(x * 0.0011) * cos(z * 0.0013);
+}
+
+void benchStreaming(const char *argument)
+{
+	int layer = 12, chunk_layers = 8;
+	uint32_t chunk_size = 1u << chunk_layers, num_chunks = 1u << (layer - chunk_layers);
+	std::string directory = argument ? argument
+		: (std::filesystem::temp_directory_path() / "anthrax_bench_chunks").string();
+	Timer timer(Timer::MILLISECONDS);
+
+	if (!std::filesystem::exists(directory + "/complete"))
+	{
+		std::filesystem::create_directories(directory);
+		timer.start();
+		for (uint32_t chunk_z = 0; chunk_z < num_chunks; chunk_z++)
+			for (uint32_t chunk_x = 0; chunk_x < num_chunks; chunk_x++)
+			{
+				std::vector<std::vector<Octree::VoxelRecord>> columns(num_chunks);
+				for (uint32_t z = 0; z < chunk_size; z++)
+					for (uint32_t x = 0; x < chunk_size; x++)
+					{
+						uint32_t world_x = chunk_x * chunk_size + x, world_z = chunk_z * chunk_size + z;
+						uint32_t height = streamingHeight(world_x, world_z);
+						for (uint32_t depth = 0; depth < 3; depth++)
+						{
+							uint32_t y = height - depth;
+							columns[y >> chunk_layers].push_back({x, y & (chunk_size - 1), z,
+									VoxelTypeElement(1 + (world_x / 16 + world_z / 16) % 3)});
+						}
+					}
+				for (uint32_t chunk_y = 0; chunk_y < num_chunks; chunk_y++)
+				{
+					Octree chunk(chunk_layers);
+					if (!columns[chunk_y].empty())
+						chunk.build(columns[chunk_y]);
+					else if (chunk_y < (1700u >> chunk_layers))
+						chunk.fillBox(0, 0, 0, chunk_size - 1, chunk_size - 1, chunk_size - 1, 1);
+					else
+						continue;
+					ChunkStreamer::saveChunk(directory, chunk_layers, chunk_x, chunk_y, chunk_z, &chunk);
+				}
+			}
+		std::ofstream(directory + "/complete") << "1";
+		std::cout << "Generated chunks in " << timer.stop() << "ms" << std::endl;
+	}
+	size_t disk_bytes = 0;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(directory))
+		disk_bytes += entry.file_size();
+
+	Octree world(layer);
+	ChunkStreamer streamer(&world, directory, chunk_layers, disk_bytes / 16);
+	streamer.setViewDistance(1024);
+	double camera[3] = {100, streamingHeight(100, 100) + 40, 100};
+	timer.start();
+	while (!streamer.isResident(camera[0], camera[1], camera[2]))
+		streamer.update(camera[0], camera[1], camera[2]);
+	std::cout << "Camera's chunk resident after " << timer.stop() << "ms" << std::endl;
+
+	// 8 voxels a frame along a curve across the world, at 60 frames a second
+	std::vector<long long> update_times;
+	size_t num_missing_frames = 0, peak_resident_bytes = 0;
+	Timer update_timer(Timer::MICROSECONDS);
+	for (double s = 0; s < 1.0; s += 8.0 / (4096 * 1.5))
+	{
+		camera[0] = 100 + 3800 * s;
+		camera[2] = 100 + 3800 * (0.5 - 0.5 * cos(s * M_PI));
+		camera[1] = streamingHeight(camera[0], camera[2]) + 40;
+		std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+		update_timer.start();
+		streamer.update(camera[0], camera[1], camera[2]);
+		update_times.push_back(update_timer.stop());
+		std::this_thread::sleep_until(frame_start + std::chrono::microseconds(16667));
+		if (!streamer.isResident(camera[0], camera[1] - 40, camera[2]))
+			num_missing_frames++;
+		peak_resident_bytes = std::max(peak_resident_bytes, streamer.getResidentBytes());
+	}
+	std::sort(update_times.begin(), update_times.end());
+	ChunkStreamer::Counters counters = streamer.getCounters();
+	std::cout << "Budget " << disk_bytes / 16 / 1e6 << "MB (1/16 of " << disk_bytes / 1e6 << "MB on disk), "
+		<< update_times.size() << " frames" << std::endl;
+	std::cout << "update(): p50 " << update_times[update_times.size() / 2] / 1000.0
+		<< "ms, p99 " << update_times[update_times.size() * 99 / 100] / 1000.0
+		<< "ms, max " << update_times.back() / 1000.0 << "ms" << std::endl;
+	std::cout << counters.num_loads << " loads, " << counters.num_evictions << " evictions, "
+		<< num_missing_frames << " frames without the ground chunk, peak resident "
+		<< peak_resident_bytes / 1e6 << "MB" << std::endl;
+	return;
+}
+
+struct Benchmark
+{
+	const char *name;
+	void (*run)(const char *argument);
+};
+
+const Benchmark benchmarks[] =
+{
+	{"build", benchBuild},
+	{"freelist", benchFreelist},
+	{"dedup", benchDeduplicate},
+	{"relayout", benchRelayout},
+	{"copy", benchCopy},
+	{"graft", benchGraft},
+	{"cone", benchCone},
+	{"bricks", benchBricks},
+	{"kary", benchKary},
+	{"getvoxels", benchGetVoxels},
+	{"accessor", benchAccessor},
+	{"visit", benchVisit},
+	{"csg", benchCsg},
+	{"streaming", benchStreaming},
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	bool ran_any = false;
+	for (const Benchmark &benchmark : benchmarks)
+	{
+		if (argc > 1 && strcmp(argv[1], benchmark.name) != 0)
+			continue;
+		std::cout << "-- " << benchmark.name << std::endl;
+		benchmark.run((argc > 2) ? argv[2] : nullptr);
+		ran_any = true;
+	}
+	if (!ran_any)
+	{
+		std::cerr << "No benchmark named " << argv[1] << std::endl;
+		return 1;
+	}
+	return 0;
+}
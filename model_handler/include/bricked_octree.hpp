@@ -0,0 +1,76 @@
+/* ---------------------------------------------------------------- *\
+ * bricked_octree.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-09
+ *
+ * Read-only, render-side layout of an Octree where the bottom
+ * <brick_layer> layers of detailed regions are stored as dense
+ * bricks of voxel types instead of pointer nodes. Nodes above the
+ * brick layer keep the usual OctreeNode layout (so traversal down
+ * to the brick layer is unchanged). A node at the brick layer either:
+ *   - is a leaf, as usual
+ *   - points to a block of children, as usual (kept when its subtree
+ *     is sparse enough that the brick would take more memory)
+ *   - has BRICK_FLAG set in its indirection, and the remaining bits
+ *     are the index of its brick in the brick pool
+ * Bricked nodes keep their LOD material in voxel_type.
+ *
+ * A brick holds (2^brick_layer)^3 voxel types, indexed by
+ * x + y*side + z*side*side relative to the brick's corner. Editing
+ * is done on the Octree; rebuild the bricked layout afterwards.
+ *
+ * This is only a conversion for upload: the Octree stays the one
+ * editable copy, and nothing else (files, streaming, instances,
+ * oriented models) knows about bricks. With BRICK_LAYER set (see
+ * world.hpp) the whole layout is rebuilt and uploaded whenever
+ * anything changed, so dirty-range uploads are lost.
+\* ---------------------------------------------------------------- */
+#ifndef BRICKED_OCTREE_HPP
+#define BRICKED_OCTREE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "octree.hpp"
+
+namespace Anthrax
+{
+
+class BrickedOctree
+{
+public:
+	BrickedOctree(Octree *octree, int brick_layer);
+
+	static constexpr IndirectionElement BRICK_FLAG = 0x80000000u;
+
+	int getLayer() { return layer_; }
+	int getBrickLayer() { return brick_layer_; }
+	uint32_t getBrickSide() { return 1u << brick_layer_; }
+	VoxelTypeElement getVoxel(uint32_t x, uint32_t y, uint32_t z);
+
+	const Octree::OctreeNode *getNodePool() { return node_pool_.data(); }
+	size_t getNodePoolSize() { return node_pool_.size(); }
+	const VoxelTypeElement *getBrickPool() { return brick_pool_.data(); }
+	size_t getBrickPoolSize() { return brick_pool_.size(); }
+	size_t getNumBricks() { return brick_pool_.size() >> (3*brick_layer_); }
+	size_t sizeInBytes()
+	{
+		return node_pool_.size()*sizeof(Octree::OctreeNode) + brick_pool_.size()*sizeof(VoxelTypeElement);
+	}
+
+private:
+	int layer_;
+	int brick_layer_;
+	std::vector<Octree::OctreeNode> node_pool_;
+	std::vector<VoxelTypeElement> brick_pool_;
+
+	void build(const Octree::OctreeNode *source_pool, size_t source_pool_size);
+	static size_t countSubtreeBlocks(const Octree::OctreeNode *source_pool,
+			const std::vector<uint32_t> &refcounts, IndirectionElement indirection);
+	void fillBrick(const Octree::OctreeNode *source_pool, Octree::OctreeNode node, int layer,
+			uint32_t x, uint32_t y, uint32_t z, VoxelTypeElement *brick);
+};
+
+} // namespace Anthrax
+
+#endif // BRICKED_OCTREE_HPP
@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------- *\
+ * chunk_streamer.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-06
+ *
+ * Pages a world in and out of an Octree in fixed-size chunks, so the
+ * world can be much larger than memory (or the GPU buffer). The world
+ * is a grid of chunks, each the node at <chunk_layers> of the octree,
+ * stored as one octree file per chunk in a directory. Chunks with no
+ * file are all air.
+ *
+ * The octree's top layers act as the directory: a resident chunk is
+ * grafted in at its node, and a chunk that isn't resident is a single
+ * air leaf. update() is given the camera position every frame and:
+ *   - grafts in chunks that finished loading
+ *   - requests the chunks within the view distance, nearest first,
+ *     stopping once they would fill the memory budget (going by
+ *     their file sizes until they're loaded)
+ *   - evicts the least recently wanted chunks while the resident
+ *     chunks are over the budget, saving them first if they were
+ *     edited (see markDirty())
+ * Files are read and written on a background thread, in the order
+ * they were requested, so a chunk is always saved before it can be
+ * read back.
+ *
+ * Anything written over the octree that isn't part of the chunks
+ * (such as World's dynamic models) has to be taken off a chunk before
+ * it's saved, evicted or grafted in, or it would be saved with the
+ * chunk or left over whatever replaced it. setBeforeChunkChange() is
+ * told about each chunk first, so that can be done.
+\* ---------------------------------------------------------------- */
+#ifndef CHUNK_STREAMER_HPP
+#define CHUNK_STREAMER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "octree.hpp"
+#include "thread_pool.hpp"
+
+// chunk loads waiting on the I/O thread at once, so a moving camera
+// doesn't leave the nearest chunks queued behind far away ones
+#ifndef CHUNK_STREAMER_MAX_PENDING_LOADS
+#define CHUNK_STREAMER_MAX_PENDING_LOADS 4
+#endif
+
+namespace Anthrax
+{
+
+class ChunkStreamer
+{
+public:
+	ChunkStreamer(Octree *octree, const std::string &directory, int chunk_layers, size_t memory_budget);
+	~ChunkStreamer();
+	ChunkStreamer(const ChunkStreamer &other) = delete;
+	ChunkStreamer &operator=(const ChunkStreamer &other) = delete;
+
+	void setViewDistance(uint32_t view_distance) { view_distance_ = view_distance; }
+	// called with a chunk's lowest voxel and side
+	typedef std::function<void(uint32_t x, uint32_t y, uint32_t z, uint32_t size)> ChunkCallback;
+	void setBeforeChunkChange(ChunkCallback callback) { before_chunk_change_ = callback; }
+	void update(uint32_t x, uint32_t y, uint32_t z);
+	void markDirty(uint32_t x, uint32_t y, uint32_t z) { return markDirty(x, y, z, x, y, z); }
+	void markDirty(uint32_t x_min, uint32_t y_min, uint32_t z_min, uint32_t x_max, uint32_t y_max, uint32_t z_max);
+	void waitForLoads();
+	void flush();
+
+	bool isResident(uint32_t x, uint32_t y, uint32_t z);
+	size_t getNumResidentChunks() { return num_resident_chunks_; }
+	size_t getResidentBytes() { return resident_bytes_; }
+	size_t getMemoryBudget() { return memory_budget_; }
+	struct Counters
+	{
+		size_t num_loads = 0; // chunks grafted in, including empty ones
+		size_t num_evictions = 0;
+		size_t num_saves = 0;
+		size_t num_compactions = 0;
+	};
+	Counters getCounters() { return counters_; }
+
+	// write a chunk's file, ex. when generating a world ahead of time
+	static void saveChunk(const std::string &directory, int chunk_layers,
+			uint32_t chunk_x, uint32_t chunk_y, uint32_t chunk_z, Octree *chunk);
+
+private:
+	typedef uint64_t ChunkKey;
+	struct Chunk
+	{
+		bool is_resident = false; // otherwise, loading
+		bool is_dirty = false;
+		size_t bytes = 0; // estimated from the file size until loaded
+		std::list<ChunkKey>::iterator lru_position; // front is the most recently wanted
+	};
+	struct CompletedLoad
+	{
+		ChunkKey key;
+		Octree *chunk; // null if the chunk has no file
+	};
+
+	Octree *octree_;
+	std::string directory_;
+	int chunk_layers_;
+	uint32_t chunks_per_axis_;
+	size_t memory_budget_;
+	uint32_t view_distance_;
+	std::unordered_map<ChunkKey, Chunk> chunks_;
+	std::list<ChunkKey> lru_;
+	std::unordered_map<ChunkKey, size_t> file_bytes_; // known sizes of chunk files, 0 if missing
+	size_t num_resident_chunks_ = 0;
+	size_t resident_bytes_ = 0;
+	size_t num_pending_loads_ = 0;
+	Counters counters_;
+	ChunkCallback before_chunk_change_;
+
+	ThreadPool io_thread_;
+	std::mutex completed_loads_mutex_;
+	std::vector<CompletedLoad> completed_loads_;
+	std::string io_error_; // first failure on the I/O thread, rethrown by update()
+
+	static ChunkKey makeKey(uint32_t chunk_x, uint32_t chunk_y, uint32_t chunk_z)
+	{
+		return static_cast<ChunkKey>(chunk_x) | (static_cast<ChunkKey>(chunk_y) << 21) | (static_cast<ChunkKey>(chunk_z) << 42);
+	}
+	static void splitKey(ChunkKey key, uint32_t *chunk_x, uint32_t *chunk_y, uint32_t *chunk_z)
+	{
+		*chunk_x = key & 0x1FFFFF;
+		*chunk_y = (key >> 21) & 0x1FFFFF;
+		*chunk_z = (key >> 42) & 0x1FFFFF;
+	}
+	static std::string chunkFilename(const std::string &directory,
+			uint32_t chunk_x, uint32_t chunk_y, uint32_t chunk_z);
+
+	size_t getFileBytes(ChunkKey key);
+	void integrateCompletedLoads();
+	void requestLoad(ChunkKey key);
+	void evict(ChunkKey key);
+	void save(ChunkKey key);
+	void notifyBeforeChange(ChunkKey key);
+};
+
+} // namespace Anthrax
+
+#endif // CHUNK_STREAMER_HPP
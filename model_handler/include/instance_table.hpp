@@ -0,0 +1,96 @@
+/* ---------------------------------------------------------------- *\
+ * instance_table.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-13
+ *
+ * Models shared by many placements in an Octree (trees, props,
+ * crowds) without copying their voxels. Each model's pool is stored
+ * once, and each placement (instance) is one record: the model, the
+ * voxel its box's corner sits on and one of the 24 axis-aligned
+ * orientations.
+ *
+ * In the octree, a leaf whose voxel type has INSTANCE_FLAG set shows
+ * the instance whose id is in the remaining bits, clipped to the
+ * leaf: each voxel of the leaf takes the instance's voxel at that
+ * position (air outside the model's box). Since that only depends on
+ * the position, instance leaves split and merge like any other leaf,
+ * so the octree needs no special handling. Node LOD materials may be
+ * instance voxel types too; use the instance's LOD material for them.
+ *
+ * Orientations are rotations about the model's center. Orientation
+ * <o> sends local axis getPermutation(o, axis) to world <axis>,
+ * mirrored if getFlip(o, axis).
+\* ---------------------------------------------------------------- */
+#ifndef INSTANCE_TABLE_HPP
+#define INSTANCE_TABLE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "octree.hpp"
+
+namespace Anthrax
+{
+
+class InstanceTable
+{
+public:
+	static constexpr VoxelTypeElement INSTANCE_FLAG = 0x80000000u;
+	static constexpr int NUM_ORIENTATIONS = 24;
+	typedef uint32_t ModelId;
+	typedef uint32_t InstanceId;
+
+	ModelId addModel(Octree *model);
+	int getModelLayer(ModelId model_id) { return models_.at(model_id).layer; }
+	InstanceId addInstance(ModelId model_id, uint32_t x_min, uint32_t y_min, uint32_t z_min, int orientation);
+	void removeInstance(InstanceId id);
+	void clearInstances();
+	size_t getNumInstances() { return num_instances_; }
+
+	static bool isInstance(VoxelTypeElement voxel_type) { return (voxel_type & INSTANCE_FLAG) != 0; }
+	static VoxelTypeElement getVoxelType(InstanceId id) { return INSTANCE_FLAG | id; }
+	static InstanceId getInstanceId(VoxelTypeElement voxel_type) { return voxel_type & ~INSTANCE_FLAG; }
+	// the voxel shown at (x, y, z) by a leaf of type <voxel_type>
+	VoxelTypeElement resolve(VoxelTypeElement voxel_type, uint32_t x, uint32_t y, uint32_t z);
+	VoxelTypeElement resolveLOD(VoxelTypeElement voxel_type);
+
+	static int getPermutation(int orientation, int axis);
+	static bool getFlip(int orientation, int axis);
+
+	// Laid out as in shaders/main.comp. Model roots and indirections
+	// are block indices into getModelPool().
+	struct Instance
+	{
+		uint32_t model_root = 0;
+		int32_t model_layer = -1; // -1 once removed
+		uint32_t orientation_bits = 0; // 2 bits of permutation per axis, then 1 flip bit per axis
+		VoxelTypeElement lod_voxel_type = 0;
+		uint32_t corner[4] = {0, 0, 0, 0}; // xyz of the model box's lowest voxel
+	};
+	const Octree::OctreeNode *getModelPool() { return model_pool_.data(); }
+	size_t getModelPoolSize() { return model_pool_.size(); }
+	const Instance *getInstances() { return instances_.data(); }
+	size_t getInstancesSize() { return instances_.size(); }
+	// bumped whenever the pool or records change, so they know to be re-uploaded
+	uint64_t getVersion() { return version_; }
+
+private:
+	struct Model
+	{
+		uint32_t root;
+		int layer;
+		VoxelTypeElement lod_voxel_type;
+	};
+	std::vector<Model> models_;
+	std::vector<Octree::OctreeNode> model_pool_;
+	std::vector<Instance> instances_;
+	std::vector<InstanceId> free_ids_;
+	size_t num_instances_ = 0;
+	uint64_t version_ = 0;
+
+	static uint32_t getOrientationBits(int orientation);
+};
+
+} // namespace Anthrax
+
+#endif // INSTANCE_TABLE_HPP
@@ -0,0 +1,316 @@
+/* ---------------------------------------------------------------- *\
+ * kary_octree.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-16
+ *
+ * Read-only sparse tree with 2^LOG2K children per axis (so 8 for
+ * LOG2K = 1, 64 for LOG2K = 2), built from a (binary) Octree. Each
+ * node has a mask with one bit per child, set if the child isn't
+ * air. Only those children are stored, contiguously from
+ * first_child in child index order, so child i lives at
+ *   first_child + popcount(child_mask & ((1 << i) - 1))
+ * A node with an empty mask is a leaf. Child index bit order is
+ * x | y << LOG2K | z << 2*LOG2K, matching LOG2K in the shaders.
+ *
+ * With LOG2K = 2 the tree is half as deep, so lookups and rays do
+ * half as many dependent reads from the top, at the cost of wider
+ * nodes. If the Octree's layer count isn't a multiple of LOG2K, the
+ * tree covers a larger cube and the Octree sits in its low corner.
+ *
+ * This is a CPU-side snapshot for measuring the layout only: it
+ * can't be edited (rebuild it from the Octree after changes), the
+ * Octree itself stays binary, and the shaders still walk the binary
+ * pool.
+\* ---------------------------------------------------------------- */
+#ifndef KARY_OCTREE_HPP
+#define KARY_OCTREE_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <type_traits>
+
+#include "octree.hpp"
+
+namespace Anthrax
+{
+
+template <int LOG2K>
+class KaryOctree
+{
+	static_assert(LOG2K == 1 || LOG2K == 2, "KaryOctree supports 2^3 or 4^3 children per node");
+public:
+	static constexpr uint32_t K = 1u << LOG2K; // children per axis
+	static constexpr uint32_t NUM_CHILDREN = K*K*K;
+	typedef typename std::conditional<LOG2K == 1, uint8_t, uint64_t>::type ChildMask;
+	struct Node
+	{
+		ChildMask child_mask;
+		uint32_t first_child;
+		VoxelTypeElement voxel_type; // for interior nodes, the LOD material
+	};
+
+	KaryOctree(Octree *octree);
+
+	int getDepth() { return depth_; }
+	size_t getNumNodes() { return nodes_.size(); }
+	size_t sizeInBytes() { return nodes_.size()*sizeof(Node); }
+	const Node *data() { return nodes_.data(); }
+
+	// <num_steps>, if given, is incremented once per node visited
+	VoxelTypeElement getVoxel(uint32_t x, uint32_t y, uint32_t z, size_t *num_steps = nullptr);
+	VoxelTypeElement castRay(const float origin[3], const float direction[3],
+			float *distance = nullptr, size_t *num_steps = nullptr);
+
+private:
+	int depth_; // number of levels of children below the root
+	std::vector<Node> nodes_;
+
+	static uint32_t childIndex(ChildMask child_mask, uint32_t child)
+	{
+		return __builtin_popcountll(static_cast<uint64_t>(child_mask) & ((1ull << child) - 1));
+	}
+	static Octree::OctreeNode descendant(const Octree::OctreeNode *source_pool, IndirectionElement block,
+			int levels, uint32_t x, uint32_t y, uint32_t z);
+	void buildNode(const Octree::OctreeNode *source_pool, size_t node_index,
+			IndirectionElement block, int levels, VoxelTypeElement voxel_type);
+	VoxelTypeElement castRayNode(size_t node_index, const float node_min[3], float node_size,
+			const float origin[3], const float direction[3], const float direction_reciprocal[3],
+			float t_enter, float *distance, size_t *num_steps);
+};
+
+
+template <int LOG2K>
+KaryOctree<LOG2K>::KaryOctree(Octree *octree)
+{
+	int num_layers = octree->getLayer();
+	depth_ = (num_layers + LOG2K - 1) / LOG2K;
+	// the root's children are this many binary layers below the Octree's root block
+	int root_levels = num_layers - LOG2K*(depth_-1);
+	nodes_.resize(1);
+	buildNode(octree->data(), 0, 0, root_levels, 0);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The node <levels> binary layers below the children of <block>
+ * covering cell (x, y, z) of the block, where each of x, y and z is
+ * less than 2^<levels>. If a leaf is reached on the way down, the
+ * leaf is returned.
+\* ---------------------------------------------------------------- */
+template <int LOG2K>
+Octree::OctreeNode KaryOctree<LOG2K>::descendant(const Octree::OctreeNode *source_pool, IndirectionElement block,
+		int levels, uint32_t x, uint32_t y, uint32_t z)
+{
+	Octree::OctreeNode node;
+	for (int level = levels-1; level >= 0; level--)
+	{
+		uint32_t child = ((x >> level) & 1u) | (((y >> level) & 1u) << 1) | (((z >> level) & 1u) << 2);
+		node = source_pool[(block << 3) | child];
+		if (node.indirection == 0)
+		{
+			break;
+		}
+		block = node.indirection;
+	}
+	return node;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Fill in node <node_index> from the binary subtree under <block>,
+ * whose children are <levels> binary layers above this node's
+ * children (LOG2K, except at the root). The non-air children are
+ * allocated together and then filled in depth-first.
+\* ---------------------------------------------------------------- */
+template <int LOG2K>
+void KaryOctree<LOG2K>::buildNode(const Octree::OctreeNode *source_pool, size_t node_index,
+		IndirectionElement block, int levels, VoxelTypeElement voxel_type)
+{
+	Octree::OctreeNode children[NUM_CHILDREN];
+	ChildMask child_mask = 0;
+	for (uint32_t child = 0; child < NUM_CHILDREN; child++)
+	{
+		uint32_t x = child & (K-1);
+		uint32_t y = (child >> LOG2K) & (K-1);
+		uint32_t z = child >> (2*LOG2K);
+		if ((x | y | z) >> levels)
+		{
+			// outside of the Octree (only happens at the root)
+			children[child] = {0, 0};
+			continue;
+		}
+		children[child] = descendant(source_pool, block, levels, x, y, z);
+		if (children[child].indirection != 0 || children[child].voxel_type != 0)
+		{
+			child_mask |= static_cast<ChildMask>(1ull << child);
+			if (voxel_type == 0)
+			{
+				voxel_type = children[child].voxel_type;
+			}
+		}
+	}
+	size_t first_child = nodes_.size();
+	nodes_.resize(first_child + __builtin_popcountll(static_cast<uint64_t>(child_mask)));
+	nodes_[node_index] = {child_mask, (child_mask == 0) ? 0u : static_cast<uint32_t>(first_child), voxel_type};
+
+	size_t child_node_index = first_child;
+	for (uint32_t child = 0; child < NUM_CHILDREN; child++)
+	{
+		if (!((static_cast<uint64_t>(child_mask) >> child) & 1ull))
+		{
+			continue;
+		}
+		if (children[child].indirection == 0)
+		{
+			nodes_[child_node_index] = {0, 0, children[child].voxel_type};
+		}
+		else
+		{
+			buildNode(source_pool, child_node_index, children[child].indirection, LOG2K, children[child].voxel_type);
+		}
+		child_node_index++;
+	}
+	return;
+}
+
+
+template <int LOG2K>
+VoxelTypeElement KaryOctree<LOG2K>::getVoxel(uint32_t x, uint32_t y, uint32_t z, size_t *num_steps)
+{
+	size_t node_index = 0;
+	for (int level = depth_-1; ; level--)
+	{
+		const Node &node = nodes_[node_index];
+		if (num_steps)
+		{
+			(*num_steps)++;
+		}
+		if (node.child_mask == 0)
+		{
+			return node.voxel_type;
+		}
+		int shift = LOG2K*level;
+		uint32_t child = ((x >> shift) & (K-1)) | (((y >> shift) & (K-1)) << LOG2K) | (((z >> shift) & (K-1)) << (2*LOG2K));
+		if (!((static_cast<uint64_t>(node.child_mask) >> child) & 1ull))
+		{
+			return 0;
+		}
+		node_index = node.first_child + childIndex(node.child_mask, child);
+	}
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Find the first non-air voxel along a ray, in voxel units from the
+ * tree's corner. Returns its type (0 if nothing is hit) and stores
+ * the distance along <direction> (which should be normalized) in
+ * <distance>.
+\* ---------------------------------------------------------------- */
+template <int LOG2K>
+VoxelTypeElement KaryOctree<LOG2K>::castRay(const float origin[3], const float direction[3],
+		float *distance, size_t *num_steps)
+{
+	float root_size = std::ldexp(1.0f, LOG2K*depth_);
+	float adjusted_direction[3];
+	float direction_reciprocal[3];
+	float t_enter = 0.0f;
+	float t_exit = INFINITY;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		// avoid 0*inf when the ray lies on a cell boundary
+		adjusted_direction[axis] = direction[axis];
+		if (std::fabs(adjusted_direction[axis]) < 1e-6f)
+			adjusted_direction[axis] = std::copysign(1e-6f, adjusted_direction[axis]);
+		direction_reciprocal[axis] = 1.0f / adjusted_direction[axis];
+		float t_min = (0.0f - origin[axis]) * direction_reciprocal[axis];
+		float t_max = (root_size - origin[axis]) * direction_reciprocal[axis];
+		t_enter = std::max(t_enter, std::min(t_min, t_max));
+		t_exit = std::min(t_exit, std::max(t_min, t_max));
+	}
+	if (t_enter > t_exit)
+	{
+		return 0;
+	}
+	const float root_min[3] = {0.0f, 0.0f, 0.0f};
+	float hit_distance = t_enter;
+	VoxelTypeElement voxel_type = castRayNode(0, root_min, root_size, origin, adjusted_direction,
+			direction_reciprocal, t_enter, &hit_distance, num_steps);
+	if (distance)
+	{
+		*distance = hit_distance;
+	}
+	return voxel_type;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Walk the ray through the K^3 grid of a node's children with a 3D
+ * DDA, descending into each non-air child it passes through
+\* ---------------------------------------------------------------- */
+template <int LOG2K>
+VoxelTypeElement KaryOctree<LOG2K>::castRayNode(size_t node_index, const float node_min[3], float node_size,
+		const float origin[3], const float direction[3], const float direction_reciprocal[3],
+		float t_enter, float *distance, size_t *num_steps)
+{
+	const Node &node = nodes_[node_index];
+	if (num_steps)
+	{
+		(*num_steps)++;
+	}
+	if (node.child_mask == 0)
+	{
+		*distance = t_enter;
+		return node.voxel_type;
+	}
+	float child_size = node_size / K;
+	int cell[3];
+	int cell_step[3];
+	float t_next[3];
+	float t_delta[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float position = origin[axis] + direction[axis]*t_enter - node_min[axis];
+		cell[axis] = std::min(std::max(static_cast<int>(std::floor(position / child_size)), 0), static_cast<int>(K)-1);
+		cell_step[axis] = (direction[axis] > 0.0f) ? 1 : -1;
+		float boundary = node_min[axis] + (cell[axis] + ((cell_step[axis] > 0) ? 1 : 0))*child_size;
+		t_next[axis] = (boundary - origin[axis]) * direction_reciprocal[axis];
+		t_delta[axis] = child_size * std::fabs(direction_reciprocal[axis]);
+	}
+	float t = t_enter;
+	while (true)
+	{
+		uint32_t child = cell[0] | (cell[1] << LOG2K) | (cell[2] << (2*LOG2K));
+		if ((static_cast<uint64_t>(node.child_mask) >> child) & 1ull)
+		{
+			float child_min[3] = {
+				node_min[0] + cell[0]*child_size,
+				node_min[1] + cell[1]*child_size,
+				node_min[2] + cell[2]*child_size};
+			VoxelTypeElement voxel_type = castRayNode(node.first_child + childIndex(node.child_mask, child),
+					child_min, child_size, origin, direction, direction_reciprocal, t, distance, num_steps);
+			if (voxel_type != 0)
+			{
+				return voxel_type;
+			}
+		}
+		else if (num_steps)
+		{
+			// skipping an air child still costs a step
+			(*num_steps)++;
+		}
+		int axis = (t_next[0] <= t_next[1] && t_next[0] <= t_next[2]) ? 0 : ((t_next[1] <= t_next[2]) ? 1 : 2);
+		t = t_next[axis];
+		cell[axis] += cell_step[axis];
+		t_next[axis] += t_delta[axis];
+		if (cell[axis] < 0 || cell[axis] >= static_cast<int>(K))
+		{
+			return 0;
+		}
+	}
+}
+
+} // namespace Anthrax
+
+#endif // KARY_OCTREE_HPP
@@ -12,6 +12,7 @@
 #include <mutex>
 
 #include "octree.hpp"
+#include "material.hpp"
 #include "quaternion.hpp"
 #include "device.hpp"
 #include "compute_shader_manager.hpp"
@@ -31,16 +32,32 @@ public:
 	void copy(const Model &other);
 	
 	void setVoxel(int32_t x, int32_t y, int32_t z, uint16_t material_type);
+	void buildFromVoxels(const std::vector<Octree::VoxelRecord> &voxels);
+	void deduplicate();
+	void save(const std::string &filename, const std::vector<Material> &materials);
+	void load(const std::string &filename, std::vector<Material> *materials);
 	void rotate(Quaternion quat);
 	void rotateOnLayer(Quaternion quat, int layer);
+	// turn the model for display only, without re-voxelizing it (see OrientedModelTable)
+	void setOrientation(Quaternion quat) { orientation_ = quat; }
+	Quaternion getOrientation() { return orientation_; }
+	glm::mat3 getOrientationMatrix();
 	//void addToWorld(World *world, unsigned int x, unsigned int y, unsigned int z);
 
 	Octree *getOctree() { return octree_; }
+	// bumped whenever the voxels in getOctree() change
+	uint64_t getVersion() { return version_; }
+	// the model before any rotate(), and a version bumped whenever it changes
+	Octree *getOriginalOctree() { return original_octree_; }
+	uint64_t getOriginalVersion() { return original_version_; }
 
 private:
-	Octree *original_octree_;
+	Octree *original_octree_ = nullptr;
 	size_t octree_width_;
-	Octree *octree_;
+	Octree *octree_ = nullptr;
+	uint64_t version_ = 0;
+	uint64_t original_version_ = 0;
+	Quaternion orientation_;
 
 	// rotation stuff
 	Quaternion current_rotation_;
@@ -11,9 +11,15 @@
 
 #include <stdlib.h>
 #include <cstdint>
+#include <functional>
 #include <list>
+#include <map>
+#include <vector>
 
 #include "freelist.hpp"
+#include "slab_vector.hpp"
+#include "thread_pool.hpp"
+#include "json/json.h"
 #include "quaternion.hpp"
 
 namespace Anthrax
@@ -25,13 +31,26 @@ typedef uint32_t VoxelTypeElement;
 class Octree
 {
 public:
-	Octree(int layer);
+	// <max_pool_bytes> is address space reserved for the pool, the most it can ever grow to
+	Octree(int layer, size_t max_pool_bytes = SLAB_VECTOR_RESERVE_BYTES);
 	Octree() : Octree(1) {};
 	~Octree();
 	Octree(const Octree &other) { copy(other); }
 	Octree& operator=(const Octree &other) { copy(other); return *this; }
 	void copy(const Octree &other);
 	void clear();
+	void compact();
+	void deduplicate();
+	void detach();
+	bool isShared() { return sharers_->size() > 1; }
+
+	enum class LayoutOrder
+	{
+		DEPTH_FIRST,
+		BREADTH_FIRST,
+		VAN_EMDE_BOAS
+	};
+	bool relayout(LayoutOrder order, long long time_budget_us = 0);
 	
 	int getLayer() { return layer_; }
 
@@ -40,7 +59,65 @@ public:
 			VoxelTypeElement material_type, int layer);
 	VoxelTypeElement getVoxel(uint32_t x, uint32_t y, uint32_t z);
 	VoxelTypeElement getVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z, int layer);
+	void getVoxels(const glm::uvec3 *positions, size_t num_positions, VoxelTypeElement *voxel_types, bool sort_by_morton_code = false);
+	void fillBox(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+			uint32_t x_max, uint32_t y_max, uint32_t z_max,
+			VoxelTypeElement voxel_type);
+	void clearBox(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+			uint32_t x_max, uint32_t y_max, uint32_t z_max)
+	{
+		return fillBox(x_min, y_min, z_min, x_max, y_max, z_max, 0);
+	}
 	void mergeOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z);
+	void extractSubtree(uint32_t x, uint32_t y, uint32_t z, int layer, Octree *destination);
+
+	enum class CsgOperation
+	{
+		UNION, // other's solid voxels are written over this octree
+		SUBTRACT, // other's solid voxels are cleared from this octree
+		INTERSECT, // everything outside of other's solid voxels is cleared
+		REPLACE // other's solid voxels are written only where this octree is solid
+	};
+	void applyCsg(CsgOperation operation, const Octree *other,
+			uint32_t x_min, uint32_t y_min, uint32_t z_min);
+
+	struct VoxelRecord
+	{
+		uint32_t x, y, z;
+		VoxelTypeElement voxel_type;
+	};
+	void build(const std::vector<VoxelRecord> &voxels);
+
+	// a leaf covering 2^layer voxels along each axis from its corner (x, y, z)
+	struct Leaf
+	{
+		uint32_t x, y, z;
+		int layer;
+		VoxelTypeElement voxel_type;
+	};
+	typedef std::function<void(const Leaf &leaf)> LeafVisitor;
+	typedef std::function<void(const Leaf &leaf, unsigned int worker)> ParallelLeafVisitor;
+	void visitLeaves(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+			uint32_t x_max, uint32_t y_max, uint32_t z_max,
+			const LeafVisitor &visitor, bool include_air = false);
+	void visitLeaves(const LeafVisitor &visitor, bool include_air = false)
+	{
+		uint32_t max_coordinate = (1u << layer_) - 1;
+		return visitLeaves(0, 0, 0, max_coordinate, max_coordinate, max_coordinate, visitor, include_air);
+	}
+	static constexpr int PARALLEL_VISIT_SPLIT_LEVELS = 3; // split into up to 8^3 subtrees
+	void parallelVisitLeaves(ThreadPool &thread_pool,
+			uint32_t x_min, uint32_t y_min, uint32_t z_min,
+			uint32_t x_max, uint32_t y_max, uint32_t z_max,
+			const ParallelLeafVisitor &visitor, bool include_air = false,
+			int split_levels = PARALLEL_VISIT_SPLIT_LEVELS);
+	void parallelVisitLeaves(ThreadPool &thread_pool, const ParallelLeafVisitor &visitor,
+			bool include_air = false, int split_levels = PARALLEL_VISIT_SPLIT_LEVELS)
+	{
+		uint32_t max_coordinate = (1u << layer_) - 1;
+		return parallelVisitLeaves(thread_pool, 0, 0, 0, max_coordinate, max_coordinate, max_coordinate,
+				visitor, include_air, split_levels);
+	}
 
 	enum class SplitMode
 	{
@@ -54,53 +131,173 @@ public:
 		alignas(sizeof(IndirectionElement)) IndirectionElement indirection;
 		alignas(sizeof(VoxelTypeElement)) VoxelTypeElement voxel_type;
 	};
-	OctreeNode *data() { return octree_pool_->data(); }
+	void loadPool(int num_layers, const OctreeNode *nodes, size_t num_nodes, bool may_share_blocks = false);
+	uint32_t appendPoolTo(std::vector<OctreeNode> &pool);
+	void extractSubtree(uint32_t x, uint32_t y, uint32_t z, int layer, std::vector<OctreeNode> &pool);
+	// exporting the pool detaches it, so it is contiguous and rooted at block 0
+	OctreeNode *data() { detach(); return octree_pool_->data(); }
 	size_t size() { return octree_pool_->size(); }
-	OctreeNode *getOctreePool() { return octree_pool_->data(); }
-	size_t getOctreePoolSize() { return octree_pool_->size(); }
+	size_t getMaxPoolBytes() { return max_pool_bytes_; }
+	OctreeNode *getOctreePool() { detach(); return octree_pool_->data(); }
+	size_t getOctreePoolSize() { detach(); return octree_pool_->size(); }
+	// parts of the exported pool written since the last call, so only those need re-uploading
+	struct DirtyRange
+	{
+		size_t first_node;
+		size_t num_nodes;
+	};
+	std::vector<DirtyRange> takeDirtyRanges();
+
+	// shape and memory use of the nodes reachable from the root; blocks
+	// shared by several parents (see deduplicate()) are counted once
+	struct Stats
+	{
+		int num_layers = 0;
+		std::vector<size_t> nodes_per_layer; // indexed by layer, so [0] is single voxels
+		std::vector<size_t> leaves_per_layer;
+		size_t num_leaves = 0;
+		size_t num_air_leaves = 0;
+		size_t num_interior_nodes = 0;
+		double average_leaf_depth = 0.0; // layers below the root, over non-air leaves
+		size_t num_reachable_blocks = 0;
+		size_t num_collapsible_blocks = 0; // 8 identical leaves that could be one
+		size_t num_shared_blocks = 0; // referenced more than once
+		size_t num_pool_blocks = 0;
+		size_t num_free_blocks = 0; // holes in the pool
+		size_t num_unreachable_blocks = 0; // taken, but only by other octrees sharing the pool
+		double fragmentation = 0.0; // fraction of the pool that is holes
+		size_t bytes_used = 0; // reachable blocks
+		size_t bytes_pool = 0; // what gets uploaded to the GPU
+		size_t bytes_committed = 0; // memory backing the pool
+		Json::Value toJson() const;
+	};
+	Stats stats();
 
 	static void convertToUnsignedLoc(int layer,
 			int32_t x, int32_t y, int32_t z,
 			uint32_t *ux, uint32_t *uy, uint32_t *uz);
 
 	friend class Model;
+	friend class InstanceTable;
+	friend class OrientedModelTable;
+	friend class TerrainGenerator;
 
+	/* ---------------------------------------------------------------- *\
+	 * A cursor over the octree. It sits on one node (normally the leaf
+	 * containing its position) and keeps the path down to it, so
+	 * moving only walks back up to the lowest common ancestor of the
+	 * old and new positions. Moving to a nearby voxel (see step()) or
+	 * to the next leaf (see nextLeaf()) costs amortized O(1) lookups.
+	 * Any edit to the octree makes the cursor start from the root on
+	 * its next move.
+	\* ---------------------------------------------------------------- */
 	class Accessor
 	{
 	public:
-		//Accessor() : {}
 		Accessor(Octree *owner) : owner_(owner) {};
 		~Accessor();
 		void destroy();
+
+		void moveTo(uint32_t x, uint32_t y, uint32_t z);
+		bool step(int axis, int direction);
+		bool nextLeaf();
 		void descend(int child);
 		void ascend();
+
+		VoxelTypeElement getVoxelType() { return node_stack_[layer_].voxel_type; }
+		bool isLeaf() { return layer_ < owner_->layer_ && node_stack_[layer_].indirection == 0; }
+		// the current node covers 2^layer voxels along each axis
+		int getLayer() { return layer_; }
+		// corner of the current node
+		uint32_t getX() { return x_ & ~((1u << layer_) - 1); }
+		uint32_t getY() { return y_ & ~((1u << layer_) - 1); }
+		uint32_t getZ() { return z_ & ~((1u << layer_) - 1); }
 		friend class Octree;
 	private:
 		Octree *owner_ = nullptr;
 		std::list<Accessor>::iterator self_iterator_;
-		std::vector<IndirectionElement> indirection_stack_;
-		std::vector<int> childnum_stack_;
-		int depth_ = 0;
+		// node_stack_[layer] is the node at <layer> on the path to the
+		// current node; node_stack_[num_layers] stands in for the root
+		std::vector<OctreeNode> node_stack_;
+		int layer_ = 0;
+		uint32_t x_ = 0, y_ = 0, z_ = 0;
+		uint64_t pool_version_ = 0;
 		bool is_being_destroyed_ = false;
+
+		void reset();
+		void descendToLayer(int layer);
 	};
 	friend class Accessor;
 	Accessor *createAccessor();
 private:
-	std::vector<OctreeNode> *octree_pool_;
-	Freelist *pool_freelist_;
+	// The pool, freelist and reference counts may be shared with copies
+	// of this octree (see copy()). Each octree has its own root block.
+	// The pool never moves as it grows, so pointers into it stay valid
+	// until it shrinks past them or is replaced (see installPool()).
+	SlabVector<OctreeNode> *octree_pool_ = nullptr;
+	Freelist *pool_freelist_ = nullptr;
+	std::vector<uint32_t> *block_refcounts_ = nullptr; // number of nodes/octrees pointing to each block
+	std::list<Octree*> *sharers_ = nullptr; // every octree using this pool, including this one
+	IndirectionElement root_ = 0;
 	int layer_;
+	size_t max_pool_bytes_;
 	SplitMode split_mode_;
+	uint64_t pool_version_ = 0; // bumped on every edit so an unfinished relayout knows to restart
+	struct RelayoutState;
+	RelayoutState *relayout_state_ = nullptr;
+	std::map<size_t, size_t> dirty_blocks_; // first block -> one past the last block of each written range
+	size_t recent_dirty_first_ = 0, recent_dirty_end_ = 0; // last range marked, known to still be covered
+	static constexpr size_t MAX_DIRTY_RANGES = 64; // past this, the closest ranges are coalesced
+
+	void createStorage();
+	void releaseStorage();
+	void installPool(SlabVector<OctreeNode> &new_pool);
+	void markDirty(size_t first_block, size_t num_blocks = 1);
+	void markAllDirty();
 
-	void simpleMerge();
-	void simpleUpdateLOD();
-	VoxelTypeElement calculateMaterialTypeFromChildren();
+	void simpleMerge(const std::vector<IndirectionElement> &path);
+	void simpleUpdateLOD(const std::vector<IndirectionElement> &path, size_t depth);
+	static VoxelTypeElement calculateMaterialTypeFromChildren(const OctreeNode *children);
+	static bool isUniformBlock(const OctreeNode *children);
+	IndirectionElement allocBlock();
+	IndirectionElement allocBlockRange(size_t num_blocks);
+	void freeBlock(IndirectionElement indirection);
+	void freeSubtree(IndirectionElement indirection);
+	IndirectionElement cloneBlock(IndirectionElement indirection);
+	void resetPoolMetadata();
+	void recountReferences();
 
+	bool descendForWrite(uint32_t x, uint32_t y, uint32_t z, int layer,
+			const VoxelTypeElement *new_voxel_type,
+			IndirectionElement *pool_index, std::vector<IndirectionElement> &path);
 	void mergeIntoOctreeRecursive(Octree *other, IndirectionElement indirection, int layer, uint32_t x, uint32_t y, uint32_t z);
 	void mergeIntoOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z);
-	void setVoxelTypeWithinBounds(VoxelTypeElement voxel_type,
-		uint32_t x_min, uint32_t y_min, uint32_t z_min,
-		uint32_t x_max, uint32_t y_max, uint32_t z_max);
-	uint32_t roundUpToInterval(uint32_t val, uint32_t interval);
+	void graftIntoOctree(Octree *other, uint32_t x_min, uint32_t y_min, uint32_t z_min, int graft_layer);
+	void graftNode(uint32_t x, uint32_t y, uint32_t z, int layer, OctreeNode node);
+
+	struct VisitEntry
+	{
+		OctreeNode node;
+		uint32_t x, y, z;
+		int layer;
+	};
+	template <class Visitor>
+	void visitSubtree(VisitEntry start, const uint32_t box_min[3], const uint32_t box_max[3],
+			bool include_air, int stop_layer, Visitor &&visitor);
+
+	struct CsgWindow;
+	static VoxelTypeElement applyCsgToVoxel(CsgOperation operation,
+			VoxelTypeElement voxel_type, VoxelTypeElement other_voxel_type);
+	void applyCsgToNode(CsgOperation operation, IndirectionElement pool_index, int layer,
+			uint32_t x, uint32_t y, uint32_t z, const CsgWindow &window);
+	OctreeNode copyCsgSubtree(CsgOperation operation, VoxelTypeElement voxel_type,
+			const Octree *other, IndirectionElement other_indirection);
+
+	static uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z);
+	static constexpr int BATCH_LANES = 32; // queries getVoxels() walks side by side
+	static constexpr int MORTON_SORT_BUCKET_LAYERS = 5; // getVoxels() only sorts down to 32^3 buckets
+	struct VoxelBatch;
+	void sortByMortonCode(const glm::uvec3 *positions, size_t num_positions, std::vector<uint32_t> &order);
 
 	std::list<Accessor> accessors_;
 };
@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------- *\
+ * octree_file.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-02
+ *
+ * Native on-disk format for baked octrees. Layout:
+ *   - header (see OctreeFile::Header)
+ *   - material table, stored as Material::PackedMaterial so it can
+ *     be copied straight into a GPU buffer
+ *   - raw OctreeNode pool, starting on a page boundary
+ * Loading checks the pool's structure (see Octree::loadPool()); a
+ * flag in the header says whether it may share blocks.
+ * Everything is stored in host byte order (little endian on every
+ * platform this currently runs on).
+ *
+ * Files are read by mapping them into memory, so the pool can be
+ * copied from the mapping into its destination (an Octree or a
+ * mapped staging buffer) without any parsing or intermediate copy.
+\* ---------------------------------------------------------------- */
+#ifndef OCTREE_FILE_HPP
+#define OCTREE_FILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "octree.hpp"
+#include "material.hpp"
+
+namespace Anthrax
+{
+
+class OctreeFile
+{
+public:
+	OctreeFile(const std::string &filename);
+	~OctreeFile();
+	OctreeFile(const OctreeFile &other) = delete;
+	OctreeFile &operator=(const OctreeFile &other) = delete;
+
+	static void save(const std::string &filename, Octree *octree,
+			const std::vector<Material> &materials);
+
+	int getNumLayers() { return header_->num_layers; }
+	const Octree::OctreeNode *getPool();
+	size_t getPoolSize() { return header_->num_nodes; }
+	const Material::PackedMaterial *getPackedMaterials();
+	size_t getNumMaterials() { return header_->num_materials; }
+	std::vector<Material> getMaterials();
+	void loadInto(Octree *octree);
+
+private:
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t num_layers;
+		uint64_t num_materials;
+		uint64_t materials_offset;
+		uint64_t num_nodes;
+		uint64_t pool_offset;
+		uint64_t flags; // since version 2
+	};
+	static constexpr char MAGIC[8] = { 'A', 'N', 'T', 'H', 'R', 'A', 'X', 'O' };
+	static constexpr uint32_t VERSION = 2;
+	// the pool has blocks with several parents (see Octree::deduplicate());
+	// version 1 files didn't say, so they're assumed to
+	static constexpr uint64_t SHARES_BLOCKS = 1ull << 0;
+
+	std::string filename_;
+	void *mapping_ = nullptr;
+	size_t mapping_size_ = 0;
+	const Header *header_ = nullptr;
+};
+
+} // namespace Anthrax
+
+#endif // OCTREE_FILE_HPP
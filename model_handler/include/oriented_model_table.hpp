@@ -0,0 +1,84 @@
+/* ---------------------------------------------------------------- *\
+ * oriented_model_table.hpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-20
+ *
+ * Models drawn at any rotation without re-voxelizing them. Each
+ * model's original (unrotated) octree stays resident in one shared
+ * pool, and each placement is a record of an oriented bounding box:
+ * the world position of the model's center and the rotation set with
+ * Model::setOrientation(). The renderer tests rays against these
+ * boxes and follows a hit into the model's own octree, with the ray
+ * turned into the model's frame, so turning a model only rewrites its
+ * record.
+ *
+ * Oriented models aren't part of the world's octree, so they're only
+ * seen by rays, not by World::getVoxel() or edits.
+\* ---------------------------------------------------------------- */
+#ifndef ORIENTED_MODEL_TABLE_HPP
+#define ORIENTED_MODEL_TABLE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "octree.hpp"
+#include "model.hpp"
+
+namespace Anthrax
+{
+
+class OrientedModelTable
+{
+public:
+	typedef uint32_t OrientedModelId;
+
+	OrientedModelId add(Model *model, uint32_t x, uint32_t y, uint32_t z);
+	void move(OrientedModelId id, uint32_t x, uint32_t y, uint32_t z);
+	void remove(OrientedModelId id);
+	void clear();
+	bool update();
+	Model *getModel(OrientedModelId id) { return id < oriented_models_.size() ? oriented_models_[id].model : nullptr; }
+
+	// Laid out as in shaders/main.comp. Model roots and indirections
+	// are block indices into getModelPool().
+	struct Record
+	{
+		float rotation[3][4]; // rows of the matrix taking world offsets to model offsets
+		float center[4]; // world position of the model's center, then half its side
+		uint32_t model_root;
+		int32_t model_layer;
+		VoxelTypeElement lod_voxel_type;
+		uint32_t padding;
+	};
+	const Octree::OctreeNode *getModelPool() { return model_pool_.data(); }
+	size_t getModelPoolSize() { return model_pool_.size(); }
+	// the shader's buffer starts with the number of records, padded to a record's alignment
+	static constexpr size_t RECORDS_OFFSET = 16;
+	const Record *getRecords() { return records_.data(); }
+	size_t getNumRecords() { return records_.size(); }
+	// bumped whenever update() changes the pool or the records, and the pool alone
+	uint64_t getVersion() { return version_; }
+	uint64_t getModelPoolVersion() { return model_pool_version_; }
+
+private:
+	struct OrientedModel
+	{
+		Model *model = nullptr; // null once removed
+		uint32_t x, y, z; // center, as an unsigned octree location
+		uint64_t pooled_version = 0;
+		uint32_t root = 0;
+		VoxelTypeElement lod_voxel_type = 0;
+	};
+	std::vector<OrientedModel> oriented_models_;
+	std::vector<Octree::OctreeNode> model_pool_;
+	std::vector<Record> records_;
+	bool is_pool_stale_ = false;
+	uint64_t version_ = 0;
+	uint64_t model_pool_version_ = 0;
+
+	void rebuildModelPool();
+};
+
+} // namespace Anthrax
+
+#endif // ORIENTED_MODEL_TABLE_HPP
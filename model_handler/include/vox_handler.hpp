@@ -173,6 +173,7 @@ private:
 
 	Material materials_[256];
 	World *world_;
+	std::vector<Octree::VoxelRecord> voxels_;
 
 	bool encountered_rgba_chunk_ = false;
 
@@ -0,0 +1,205 @@
+/* ---------------------------------------------------------------- *\
+ * bricked_octree.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-09
+\* ---------------------------------------------------------------- */
+
+#include "bricked_octree.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace Anthrax
+{
+
+BrickedOctree::BrickedOctree(Octree *octree, int brick_layer)
+{
+	layer_ = octree->getLayer();
+	brick_layer_ = brick_layer;
+	if (brick_layer_ < 1 || brick_layer_ >= layer_)
+	{
+		throw std::runtime_error("Brick layer must be between 1 and num_layers-1 of the octree!");
+	}
+	build(octree->data(), octree->size());
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Copy every block reachable from the root, top-down. When a node
+ * at the brick layer has children, its whole subtree is flattened
+ * into a brick if that takes no more memory than the blocks it
+ * replaces. Shared blocks and subtrees (see Octree::deduplicate())
+ * are only copied or bricked once.
+\* ---------------------------------------------------------------- */
+void BrickedOctree::build(const Octree::OctreeNode *source_pool, size_t source_pool_size)
+{
+	size_t brick_size = size_t(1) << (3*brick_layer_);
+	size_t brick_bytes = brick_size*sizeof(VoxelTypeElement);
+
+	// blocks with more than one parent stay around no matter what, so
+	// bricking over them doesn't save their memory
+	std::vector<uint32_t> refcounts(source_pool_size >> 3, 0);
+	std::vector<IndirectionElement> reachable(1, 0);
+	while (!reachable.empty())
+	{
+		IndirectionElement current = reachable.back();
+		reachable.pop_back();
+		for (int child = 0; child < 8; child++)
+		{
+			IndirectionElement child_indirection = source_pool[(current << 3)+child].indirection;
+			if (child_indirection != 0 && refcounts[child_indirection]++ == 0)
+			{
+				reachable.push_back(child_indirection);
+			}
+		}
+	}
+	std::unordered_map<IndirectionElement, IndirectionElement> block_remap; // source block -> copied block
+	std::unordered_map<IndirectionElement, IndirectionElement> brick_remap; // source block -> brick
+
+	struct PendingBlock
+	{
+		IndirectionElement source;
+		IndirectionElement destination;
+		int layer; // of the nodes in the block
+	};
+	std::vector<PendingBlock> stack;
+	node_pool_.assign(8, {0, 0});
+	block_remap[0] = 0;
+	stack.push_back({0, 0, layer_-1});
+	while (!stack.empty())
+	{
+		PendingBlock pending = stack.back();
+		stack.pop_back();
+		for (int child = 0; child < 8; child++)
+		{
+			Octree::OctreeNode node = source_pool[(pending.source << 3)+child];
+			if (node.indirection != 0)
+			{
+				if (pending.layer == brick_layer_ &&
+				    countSubtreeBlocks(source_pool, refcounts, node.indirection)*8*sizeof(Octree::OctreeNode) >= brick_bytes)
+				{
+					std::unordered_map<IndirectionElement, IndirectionElement>::iterator found = brick_remap.find(node.indirection);
+					IndirectionElement brick;
+					if (found != brick_remap.end())
+					{
+						brick = found->second;
+					}
+					else
+					{
+						brick = getNumBricks();
+						brick_remap[node.indirection] = brick;
+						brick_pool_.resize(brick_pool_.size()+brick_size);
+						fillBrick(source_pool, node, brick_layer_, 0, 0, 0, &brick_pool_[brick*brick_size]);
+					}
+					node.indirection = BRICK_FLAG | brick;
+				}
+				else
+				{
+					std::unordered_map<IndirectionElement, IndirectionElement>::iterator found = block_remap.find(node.indirection);
+					IndirectionElement block;
+					if (found != block_remap.end())
+					{
+						block = found->second;
+					}
+					else
+					{
+						block = node_pool_.size() >> 3;
+						block_remap[node.indirection] = block;
+						node_pool_.resize(node_pool_.size()+8);
+						stack.push_back({node.indirection, block, pending.layer-1});
+					}
+					node.indirection = block;
+				}
+			}
+			node_pool_[(pending.destination << 3)+child] = node;
+		}
+		if ((node_pool_.size() >> 3) > BRICK_FLAG || getNumBricks() > BRICK_FLAG)
+		{
+			// the top bit of an indirection is taken by the brick flag
+			throw std::runtime_error("Bricked octree is too large to be indexed!");
+		}
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Count the blocks that would no longer be needed if the subtree
+ * under <indirection> was replaced: the block itself, and every
+ * block underneath it with no other parent.
+\* ---------------------------------------------------------------- */
+size_t BrickedOctree::countSubtreeBlocks(const Octree::OctreeNode *source_pool,
+		const std::vector<uint32_t> &refcounts, IndirectionElement indirection)
+{
+	size_t num_blocks = 1;
+	for (int child = 0; child < 8; child++)
+	{
+		IndirectionElement child_indirection = source_pool[(indirection << 3)+child].indirection;
+		if (child_indirection != 0 && refcounts[child_indirection] == 1)
+		{
+			num_blocks += countSubtreeBlocks(source_pool, refcounts, child_indirection);
+		}
+	}
+	return num_blocks;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Write the voxels of <node> (at <layer>, with its corner at
+ * (x, y, z) within the brick) into <brick>
+\* ---------------------------------------------------------------- */
+void BrickedOctree::fillBrick(const Octree::OctreeNode *source_pool, Octree::OctreeNode node, int layer,
+		uint32_t x, uint32_t y, uint32_t z, VoxelTypeElement *brick)
+{
+	if (node.indirection == 0)
+	{
+		uint32_t size = 1u << layer;
+		for (uint32_t brick_z = z; brick_z < z+size; brick_z++)
+		{
+			for (uint32_t brick_y = y; brick_y < y+size; brick_y++)
+			{
+				for (uint32_t brick_x = x; brick_x < x+size; brick_x++)
+				{
+					brick[brick_x | (brick_y << brick_layer_) | (brick_z << (2*brick_layer_))] = node.voxel_type;
+				}
+			}
+		}
+		return;
+	}
+	uint32_t half_size = 1u << (layer-1);
+	for (int child = 0; child < 8; child++)
+	{
+		fillBrick(source_pool, source_pool[(node.indirection << 3)+child], layer-1,
+				x + ((child & 1) ? half_size : 0),
+				y + ((child & 2) ? half_size : 0),
+				z + ((child & 4) ? half_size : 0),
+				brick);
+	}
+	return;
+}
+
+
+VoxelTypeElement BrickedOctree::getVoxel(uint32_t x, uint32_t y, uint32_t z)
+{
+	IndirectionElement indirection = 0;
+	for (int layer = layer_-1; layer >= 0; layer--)
+	{
+		IndirectionElement child = ((x >> layer) & 1u) | (((y >> layer) & 1u) << 1) | (((z >> layer) & 1u) << 2);
+		Octree::OctreeNode node = node_pool_[(indirection << 3) | child];
+		if (node.indirection == 0)
+		{
+			return node.voxel_type;
+		}
+		if (node.indirection & BRICK_FLAG)
+		{
+			uint32_t mask = getBrickSide()-1;
+			size_t brick_base = static_cast<size_t>(node.indirection & ~BRICK_FLAG) << (3*brick_layer_);
+			return brick_pool_[brick_base | (x & mask) | ((y & mask) << brick_layer_) | ((z & mask) << (2*brick_layer_))];
+		}
+		indirection = node.indirection;
+	}
+	return 0;
+}
+
+} // namespace Anthrax
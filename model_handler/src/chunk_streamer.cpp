@@ -0,0 +1,410 @@
+/* ---------------------------------------------------------------- *\
+ * chunk_streamer.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-06
+\* ---------------------------------------------------------------- */
+
+#include "chunk_streamer.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#include "octree_file.hpp"
+
+namespace Anthrax
+{
+
+ChunkStreamer::ChunkStreamer(Octree *octree, const std::string &directory, int chunk_layers, size_t memory_budget)
+	: io_thread_(1)
+{
+	if (chunk_layers < 1 || chunk_layers >= octree->getLayer())
+	{
+		throw std::runtime_error("ChunkStreamer: chunks must be smaller than the octree!");
+	}
+	octree_ = octree;
+	directory_ = directory;
+	chunk_layers_ = chunk_layers;
+	chunks_per_axis_ = 1u << (octree->getLayer() - chunk_layers);
+	memory_budget_ = memory_budget;
+	view_distance_ = 4u << chunk_layers;
+	std::filesystem::create_directories(directory_);
+	return;
+}
+
+
+ChunkStreamer::~ChunkStreamer()
+{
+	flush();
+	for (CompletedLoad &completed_load : completed_loads_)
+	{
+		delete completed_load.chunk;
+	}
+	return;
+}
+
+
+std::string ChunkStreamer::chunkFilename(const std::string &directory,
+		uint32_t chunk_x, uint32_t chunk_y, uint32_t chunk_z)
+{
+	return directory + "/chunk_" + std::to_string(chunk_x) + "_" + std::to_string(chunk_y) + "_"
+			+ std::to_string(chunk_z) + ".octree";
+}
+
+
+void ChunkStreamer::saveChunk(const std::string &directory, int chunk_layers,
+		uint32_t chunk_x, uint32_t chunk_y, uint32_t chunk_z, Octree *chunk)
+{
+	if (chunk->getLayer() != chunk_layers)
+	{
+		throw std::runtime_error("saveChunk(): chunk has the wrong number of layers!");
+	}
+	return OctreeFile::save(chunkFilename(directory, chunk_x, chunk_y, chunk_z), chunk, {});
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Stream chunks around the camera at (x, y, z), in voxels from the
+ * octree's corner. Call once per frame.
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::update(uint32_t x, uint32_t y, uint32_t z)
+{
+	integrateCompletedLoads();
+
+	// chunks whose closest point is within the view distance, nearest first
+	struct WantedChunk
+	{
+		uint64_t distance_squared;
+		ChunkKey key;
+	};
+	std::vector<WantedChunk> wanted_chunks;
+	const uint32_t camera[3] = {x, y, z};
+	int64_t chunk_size = int64_t(1) << chunk_layers_;
+	int64_t chunk_radius = (view_distance_ >> chunk_layers_) + 1;
+	int64_t first_chunk[3], last_chunk[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int64_t camera_chunk = camera[axis] >> chunk_layers_;
+		first_chunk[axis] = std::max(camera_chunk - chunk_radius, int64_t(0));
+		last_chunk[axis] = std::min(camera_chunk + chunk_radius, static_cast<int64_t>(chunks_per_axis_)-1);
+	}
+	uint64_t view_distance_squared = static_cast<uint64_t>(view_distance_)*view_distance_;
+	for (int64_t chunk_z = first_chunk[2]; chunk_z <= last_chunk[2]; chunk_z++)
+	{
+		for (int64_t chunk_y = first_chunk[1]; chunk_y <= last_chunk[1]; chunk_y++)
+		{
+			for (int64_t chunk_x = first_chunk[0]; chunk_x <= last_chunk[0]; chunk_x++)
+			{
+				const int64_t chunk[3] = {chunk_x, chunk_y, chunk_z};
+				uint64_t distance_squared = 0;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					int64_t chunk_min = chunk[axis]*chunk_size;
+					int64_t closest = std::min(std::max(static_cast<int64_t>(camera[axis]), chunk_min), chunk_min + chunk_size - 1);
+					int64_t difference = closest - camera[axis];
+					distance_squared += difference*difference;
+				}
+				if (distance_squared <= view_distance_squared)
+				{
+					wanted_chunks.push_back({distance_squared, makeKey(chunk_x, chunk_y, chunk_z)});
+				}
+			}
+		}
+	}
+	std::sort(wanted_chunks.begin(), wanted_chunks.end(),
+		[](const WantedChunk &a, const WantedChunk &b) { return a.distance_squared < b.distance_squared; });
+
+	// past the budget, chunks would only get evicted again
+	size_t wanted_bytes = 0;
+	size_t num_kept_chunks = 0;
+	for (; num_kept_chunks < wanted_chunks.size() && wanted_bytes < memory_budget_; num_kept_chunks++)
+	{
+		ChunkKey key = wanted_chunks[num_kept_chunks].key;
+		auto chunk_iterator = chunks_.find(key);
+		if (chunk_iterator != chunks_.end())
+		{
+			wanted_bytes += chunk_iterator->second.bytes;
+			continue;
+		}
+		wanted_bytes += getFileBytes(key);
+		if (num_pending_loads_ < CHUNK_STREAMER_MAX_PENDING_LOADS)
+		{
+			requestLoad(key);
+		}
+	}
+	// the farthest wanted chunks end up evicted first
+	for (size_t wanted_index = num_kept_chunks; wanted_index-- > 0; )
+	{
+		auto chunk_iterator = chunks_.find(wanted_chunks[wanted_index].key);
+		if (chunk_iterator == chunks_.end() || !chunk_iterator->second.is_resident)
+		{
+			continue;
+		}
+		lru_.splice(lru_.begin(), lru_, chunk_iterator->second.lru_position);
+	}
+
+	while (resident_bytes_ > memory_budget_ && !lru_.empty())
+	{
+		evict(lru_.back());
+	}
+	// evicted chunks leave holes in the pool that grafts can't always reuse
+	if (octree_->size()*sizeof(Octree::OctreeNode) > 2*memory_budget_)
+	{
+		octree_->compact();
+		counters_.num_compactions++;
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Note that the chunks overlapping the box from (x_min, y_min, z_min)
+ * to (x_max, y_max, z_max), inclusive, were edited, so they get
+ * saved before being evicted. Only resident chunks can be edited,
+ * since loading a chunk overwrites its whole node; if any of them
+ * isn't, nothing is marked.
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::markDirty(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+		uint32_t x_max, uint32_t y_max, uint32_t z_max)
+{
+	std::vector<Chunk*> edited_chunks;
+	for (uint32_t chunk_z = z_min >> chunk_layers_; chunk_z <= (z_max >> chunk_layers_); chunk_z++)
+	{
+		for (uint32_t chunk_y = y_min >> chunk_layers_; chunk_y <= (y_max >> chunk_layers_); chunk_y++)
+		{
+			for (uint32_t chunk_x = x_min >> chunk_layers_; chunk_x <= (x_max >> chunk_layers_); chunk_x++)
+			{
+				auto chunk_iterator = chunks_.find(makeKey(chunk_x, chunk_y, chunk_z));
+				if (chunk_iterator == chunks_.end() || !chunk_iterator->second.is_resident)
+				{
+					throw std::runtime_error("ChunkStreamer: can't edit a chunk that isn't resident!");
+				}
+				edited_chunks.push_back(&chunk_iterator->second);
+			}
+		}
+	}
+	for (Chunk *chunk : edited_chunks)
+	{
+		chunk->is_dirty = true;
+	}
+	return;
+}
+
+
+bool ChunkStreamer::isResident(uint32_t x, uint32_t y, uint32_t z)
+{
+	auto chunk_iterator = chunks_.find(makeKey(x >> chunk_layers_, y >> chunk_layers_, z >> chunk_layers_));
+	return chunk_iterator != chunks_.end() && chunk_iterator->second.is_resident;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Block until every requested chunk is loaded, and graft them in
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::waitForLoads()
+{
+	io_thread_.wait();
+	integrateCompletedLoads();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Save every edited chunk and wait for all I/O to finish
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::flush()
+{
+	for (auto &chunk_entry : chunks_)
+	{
+		if (chunk_entry.second.is_resident && chunk_entry.second.is_dirty)
+		{
+			save(chunk_entry.first);
+		}
+	}
+	io_thread_.wait();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Size of a chunk's file, which is about the size of its pool once
+ * loaded. Sizes are cached, since this is asked every frame.
+\* ---------------------------------------------------------------- */
+size_t ChunkStreamer::getFileBytes(ChunkKey key)
+{
+	auto file_iterator = file_bytes_.find(key);
+	if (file_iterator != file_bytes_.end())
+	{
+		return file_iterator->second;
+	}
+	uint32_t chunk_x, chunk_y, chunk_z;
+	splitKey(key, &chunk_x, &chunk_y, &chunk_z);
+	std::error_code error;
+	uintmax_t file_bytes = std::filesystem::file_size(chunkFilename(directory_, chunk_x, chunk_y, chunk_z), error);
+	size_t bytes = error ? 0 : static_cast<size_t>(file_bytes);
+	file_bytes_[key] = bytes;
+	return bytes;
+}
+
+
+void ChunkStreamer::integrateCompletedLoads()
+{
+	std::vector<CompletedLoad> completed_loads;
+	{
+		std::lock_guard<std::mutex> lock(completed_loads_mutex_);
+		if (!io_error_.empty())
+		{
+			throw std::runtime_error(io_error_);
+		}
+		completed_loads.swap(completed_loads_);
+	}
+	uint32_t half_chunk_size = 1u << (chunk_layers_-1);
+	for (CompletedLoad completed_load : completed_loads)
+	{
+		Chunk &chunk = chunks_[completed_load.key];
+		num_pending_loads_--;
+		chunk.bytes = 0;
+		if (completed_load.chunk)
+		{
+			uint32_t chunk_x, chunk_y, chunk_z;
+			splitKey(completed_load.key, &chunk_x, &chunk_y, &chunk_z);
+			notifyBeforeChange(completed_load.key);
+			// aligned to the chunk size, so the chunk's blocks are grafted in as-is
+			octree_->mergeOctree(completed_load.chunk,
+					(chunk_x << chunk_layers_) + half_chunk_size,
+					(chunk_y << chunk_layers_) + half_chunk_size,
+					(chunk_z << chunk_layers_) + half_chunk_size);
+			chunk.bytes = completed_load.chunk->size()*sizeof(Octree::OctreeNode);
+			delete completed_load.chunk;
+		}
+		chunk.is_resident = true;
+		lru_.push_front(completed_load.key);
+		chunk.lru_position = lru_.begin();
+		num_resident_chunks_++;
+		resident_bytes_ += chunk.bytes;
+		counters_.num_loads++;
+	}
+	return;
+}
+
+
+void ChunkStreamer::requestLoad(ChunkKey key)
+{
+	Chunk &chunk = chunks_[key];
+	chunk = Chunk();
+	chunk.bytes = getFileBytes(key);
+	num_pending_loads_++;
+	uint32_t chunk_x, chunk_y, chunk_z;
+	splitKey(key, &chunk_x, &chunk_y, &chunk_z);
+	std::string filename = chunkFilename(directory_, chunk_x, chunk_y, chunk_z);
+	int chunk_layers = chunk_layers_;
+	io_thread_.submit([this, key, filename, chunk_layers](unsigned int)
+	{
+		Octree *chunk = nullptr;
+		std::string error;
+		try
+		{
+			if (std::filesystem::exists(filename))
+			{
+				OctreeFile file(filename);
+				if (file.getNumLayers() != chunk_layers)
+				{
+					throw std::runtime_error("Chunk file " + filename + " has the wrong number of layers!");
+				}
+				chunk = new Octree(chunk_layers, file.getPoolSize()*sizeof(Octree::OctreeNode));
+				file.loadInto(chunk);
+			}
+		}
+		catch (const std::exception &exception)
+		{
+			delete chunk;
+			chunk = nullptr;
+			error = exception.what();
+		}
+		std::lock_guard<std::mutex> lock(completed_loads_mutex_);
+		if (!error.empty() && io_error_.empty())
+		{
+			io_error_ = error;
+		}
+		completed_loads_.push_back({key, chunk});
+	});
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace a resident chunk with air, saving it first if needed
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::evict(ChunkKey key)
+{
+	Chunk &chunk = chunks_[key];
+	if (chunk.is_dirty)
+	{
+		save(key);
+	}
+	else
+	{
+		notifyBeforeChange(key);
+	}
+	uint32_t chunk_x, chunk_y, chunk_z;
+	splitKey(key, &chunk_x, &chunk_y, &chunk_z);
+	octree_->setVoxelAtLayer(chunk_x, chunk_y, chunk_z, 0, chunk_layers_);
+	lru_.erase(chunk.lru_position);
+	num_resident_chunks_--;
+	resident_bytes_ -= chunk.bytes;
+	chunks_.erase(key);
+	counters_.num_evictions++;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Copy a resident chunk out of the octree and write it on the I/O
+ * thread
+\* ---------------------------------------------------------------- */
+void ChunkStreamer::save(ChunkKey key)
+{
+	notifyBeforeChange(key);
+	uint32_t chunk_x, chunk_y, chunk_z;
+	splitKey(key, &chunk_x, &chunk_y, &chunk_z);
+	// a chunk is part of the octree, so its pool is never bigger
+	Octree *chunk = new Octree(chunk_layers_, octree_->size()*sizeof(Octree::OctreeNode));
+	octree_->extractSubtree(chunk_x << chunk_layers_, chunk_y << chunk_layers_, chunk_z << chunk_layers_,
+			chunk_layers_, chunk);
+	std::string filename = chunkFilename(directory_, chunk_x, chunk_y, chunk_z);
+	file_bytes_[key] = chunk->size()*sizeof(Octree::OctreeNode);
+	io_thread_.submit([this, chunk, filename](unsigned int)
+	{
+		try
+		{
+			OctreeFile::save(filename, chunk, {});
+		}
+		catch (const std::exception &exception)
+		{
+			std::lock_guard<std::mutex> lock(completed_loads_mutex_);
+			if (io_error_.empty())
+			{
+				io_error_ = exception.what();
+			}
+		}
+		delete chunk;
+	});
+	chunks_[key].is_dirty = false;
+	counters_.num_saves++;
+	return;
+}
+
+
+void ChunkStreamer::notifyBeforeChange(ChunkKey key)
+{
+	if (!before_chunk_change_)
+	{
+		return;
+	}
+	uint32_t chunk_x, chunk_y, chunk_z;
+	splitKey(key, &chunk_x, &chunk_y, &chunk_z);
+	return before_chunk_change_(chunk_x << chunk_layers_, chunk_y << chunk_layers_, chunk_z << chunk_layers_,
+			1u << chunk_layers_);
+}
+
+} // namespace Anthrax
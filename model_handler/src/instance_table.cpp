@@ -0,0 +1,194 @@
+/* ---------------------------------------------------------------- *\
+ * instance_table.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-13
+\* ---------------------------------------------------------------- */
+
+#include "instance_table.hpp"
+
+#include <stdexcept>
+
+namespace Anthrax
+{
+
+/* ---------------------------------------------------------------- *\
+ * Store a copy of a model's voxels for instances to share. Later
+ * edits to <model> aren't seen by its instances.
+\* ---------------------------------------------------------------- */
+InstanceTable::ModelId InstanceTable::addModel(Octree *model)
+{
+	uint32_t root = model->appendPoolTo(model_pool_);
+	models_.push_back({root, model->getLayer(), Octree::calculateMaterialTypeFromChildren(&model_pool_[root << 3])});
+	version_++;
+	return models_.size()-1;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Add a record for a placement of a model, with the lowest voxel of
+ * its box at (x_min, y_min, z_min). Nothing shows it until leaves of
+ * getVoxelType(id) are written into the octree.
+\* ---------------------------------------------------------------- */
+InstanceTable::InstanceId InstanceTable::addInstance(ModelId model_id,
+		uint32_t x_min, uint32_t y_min, uint32_t z_min, int orientation)
+{
+	if (model_id >= models_.size())
+	{
+		throw std::runtime_error("addInstance(): no such model!");
+	}
+	if (orientation < 0 || orientation >= NUM_ORIENTATIONS)
+	{
+		throw std::runtime_error("addInstance(): orientation must be between 0 and 23!");
+	}
+	Instance instance;
+	instance.model_root = models_[model_id].root;
+	instance.model_layer = models_[model_id].layer;
+	instance.orientation_bits = getOrientationBits(orientation);
+	instance.lod_voxel_type = models_[model_id].lod_voxel_type;
+	instance.corner[0] = x_min;
+	instance.corner[1] = y_min;
+	instance.corner[2] = z_min;
+	InstanceId id;
+	if (!free_ids_.empty())
+	{
+		id = free_ids_.back();
+		free_ids_.pop_back();
+		instances_[id] = instance;
+	}
+	else
+	{
+		id = instances_.size();
+		if (isInstance(id))
+		{
+			throw std::runtime_error("addInstance(): out of instance ids!");
+		}
+		instances_.push_back(instance);
+	}
+	num_instances_++;
+	version_++;
+	return id;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Free an instance's id. Leaves of its voxel type must be gone from
+ * the octree first, since the id gets reused.
+\* ---------------------------------------------------------------- */
+void InstanceTable::removeInstance(InstanceId id)
+{
+	if (id >= instances_.size() || instances_[id].model_layer < 0)
+	{
+		throw std::runtime_error("removeInstance(): no such instance!");
+	}
+	instances_[id] = Instance();
+	free_ids_.push_back(id);
+	num_instances_--;
+	version_++;
+	return;
+}
+
+
+// when the octree no longer has any instance leaves
+void InstanceTable::clearInstances()
+{
+	instances_.clear();
+	free_ids_.clear();
+	num_instances_ = 0;
+	version_++;
+	return;
+}
+
+
+VoxelTypeElement InstanceTable::resolve(VoxelTypeElement voxel_type, uint32_t x, uint32_t y, uint32_t z)
+{
+	if (!isInstance(voxel_type))
+	{
+		return voxel_type;
+	}
+	const Instance &instance = instances_[getInstanceId(voxel_type)];
+	uint32_t size = 1u << instance.model_layer;
+	const uint32_t position[3] = {x, y, z};
+	uint32_t local[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		uint32_t relative = position[axis] - instance.corner[axis];
+		if (relative >= size)
+		{
+			return 0;
+		}
+		uint32_t permutation = (instance.orientation_bits >> (2*axis)) & 3u;
+		bool flip = (instance.orientation_bits >> (6+axis)) & 1u;
+		local[permutation] = flip ? (size - 1 - relative) : relative;
+	}
+	uint32_t block = instance.model_root;
+	for (int layer = instance.model_layer-1; layer >= 0; layer--)
+	{
+		uint32_t child = ((local[0] >> layer) & 1u) | (((local[1] >> layer) & 1u) << 1) | (((local[2] >> layer) & 1u) << 2);
+		const Octree::OctreeNode &node = model_pool_[(block << 3) | child];
+		if (node.indirection == 0)
+		{
+			return node.voxel_type;
+		}
+		block = node.indirection;
+	}
+	throw std::runtime_error("resolve(): model octree is deeper than its layers!");
+}
+
+
+VoxelTypeElement InstanceTable::resolveLOD(VoxelTypeElement voxel_type)
+{
+	if (!isInstance(voxel_type))
+	{
+		return voxel_type;
+	}
+	return instances_[getInstanceId(voxel_type)].lod_voxel_type;
+}
+
+
+int InstanceTable::getPermutation(int orientation, int axis)
+{
+	return (getOrientationBits(orientation) >> (2*axis)) & 3u;
+}
+
+
+bool InstanceTable::getFlip(int orientation, int axis)
+{
+	return (getOrientationBits(orientation) >> (6+axis)) & 1u;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The 24 rotations are the axis permutations and mirrorings that
+ * don't turn the model inside out (determinant +1). Orientation 0 is
+ * the identity.
+\* ---------------------------------------------------------------- */
+uint32_t InstanceTable::getOrientationBits(int orientation)
+{
+	static const std::vector<uint32_t> orientations = []()
+	{
+		const int permutations[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+		const bool is_odd_permutation[6] = {false, true, true, false, false, true};
+		std::vector<uint32_t> bits;
+		for (int permutation = 0; permutation < 6; permutation++)
+		{
+			for (uint32_t flips = 0; flips < 8; flips++)
+			{
+				bool is_odd_flip = __builtin_popcount(flips) & 1;
+				if (is_odd_flip != is_odd_permutation[permutation])
+				{
+					continue;
+				}
+				bits.push_back(permutations[permutation][0] | (permutations[permutation][1] << 2)
+						| (permutations[permutation][2] << 4) | (flips << 6));
+			}
+		}
+		return bits;
+	}();
+	if (orientation < 0 || orientation >= NUM_ORIENTATIONS)
+	{
+		throw std::runtime_error("Orientation must be between 0 and 23!");
+	}
+	return orientations[orientation];
+}
+
+} // namespace Anthrax
@@ -6,6 +6,7 @@
 //TODO: destroy rotation shader stuff on exit
 
 #include "model.hpp"
+#include "octree_file.hpp"
 
 #include <iostream>
 #include <vector>
@@ -66,9 +67,27 @@ Model::~Model()
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * The octrees are copied with Octree::copy(), so this is cheap and
+ * blocks are only duplicated once either model is edited.
+\* ---------------------------------------------------------------- */
 void Model::copy(const Model& other)
 {
-	// TODO: this
+	if (this == &other)
+	{
+		return;
+	}
+	delete original_octree_;
+	delete octree_;
+	original_octree_ = other.original_octree_ ? new Octree(*other.original_octree_) : nullptr;
+	octree_ = other.octree_ ? new Octree(*other.octree_) : nullptr;
+	octree_width_ = other.octree_width_;
+	current_rotation_ = other.current_rotation_;
+	lowest_rotated_layer_ = other.lowest_rotated_layer_;
+	old_rotation_ = other.old_rotation_;
+	version_ = other.version_;
+	original_version_ = other.original_version_;
+	orientation_ = other.orientation_;
 	return;
 }
 
@@ -96,13 +115,103 @@ void Model::setVoxel(int32_t x, int32_t y, int32_t z, uint16_t material_type)
 	{
 		throw std::runtime_error("setVoxel(): octree member not yet initialized!");
 	}
+	version_++;
+	original_version_++;
+
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the model's contents with a batch of voxels. Coordinates
+ * are unsigned octree locations (see Octree::convertToUnsignedLoc).
+\* ---------------------------------------------------------------- */
+void Model::buildFromVoxels(const std::vector<Octree::VoxelRecord> &voxels)
+{
+	if (!original_octree_)
+	{
+		throw std::runtime_error("buildFromVoxels(): original_octree member not yet initialized!");
+	}
+	if (!octree_)
+	{
+		throw std::runtime_error("buildFromVoxels(): octree member not yet initialized!");
+	}
+	original_octree_->build(voxels);
+	octree_->build(voxels);
+	version_++;
+	original_version_++;
+	return;
+}
+
 
+/* ---------------------------------------------------------------- *\
+ * Share identical subtrees in the model's octrees (see
+ * Octree::deduplicate()). Both octrees stay valid inputs to
+ * rotate(), since rotation only reads through indirections.
+\* ---------------------------------------------------------------- */
+void Model::deduplicate()
+{
+	original_octree_->deduplicate();
+	octree_->deduplicate();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Bake the unrotated model and its materials to a native octree
+ * file (see OctreeFile).
+\* ---------------------------------------------------------------- */
+void Model::save(const std::string &filename, const std::vector<Material> &materials)
+{
+	if (!original_octree_)
+	{
+		throw std::runtime_error("save(): original_octree member not yet initialized!");
+	}
+	return OctreeFile::save(filename, original_octree_, materials);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the model with one baked by save(). If <materials> isn't
+ * null, it is filled with the file's material table.
+\* ---------------------------------------------------------------- */
+void Model::load(const std::string &filename, std::vector<Material> *materials)
+{
+	if (!original_octree_)
+	{
+		throw std::runtime_error("load(): original_octree member not yet initialized!");
+	}
+	if (!octree_)
+	{
+		throw std::runtime_error("load(): octree member not yet initialized!");
+	}
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	OctreeFile file(filename);
+	file.loadInto(original_octree_);
+	file.loadInto(octree_);
+	octree_width_ = 1u << file.getNumLayers();
+	version_++;
+	original_version_++;
+	if (materials)
+	{
+		*materials = file.getMaterials();
+	}
+	std::cout << "Time to load model " << filename << " (" << (file.getPoolSize()*sizeof(Octree::OctreeNode) >> 10)
+			<< "KB): " << timer.stop() << "ms" << std::endl;
 	return;
 }
 
 
 void Model::rotate(Quaternion quat)
 {
+	if (quat[0] == old_rotation_[0] && quat[1] == old_rotation_[1] &&
+	    quat[2] == old_rotation_[2] && quat[3] == old_rotation_[3])
+	{
+		// already rotated this way, so the voxels wouldn't change
+		return;
+	}
+	version_++;
 	rotateGPU(quat); return;
 	current_rotation_ = quat;
 	octree_->clear();
@@ -122,6 +231,32 @@ void Model::rotate(Quaternion quat)
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * The rotation set by setOrientation(), as a matrix taking offsets
+ * from the model's center to world offsets. It turns the model the
+ * same way rotate() would (yaw, then pitch, then roll, each turning
+ * the axis after its own toward the one after that; see
+ * rotateVoxelSingleAxis()), just without rounding to voxels.
+\* ---------------------------------------------------------------- */
+glm::mat3 Model::getOrientationMatrix()
+{
+	std::vector<float> angles = orientation_.eulerAngles();
+	auto single_axis = [](int axis, float angle)
+	{
+		int secondary_axis = (axis + 1) % 3;
+		int tertiary_axis = (axis + 2) % 3;
+		// glm matrices are indexed [column][row]
+		glm::mat3 rotation(1.0f);
+		rotation[secondary_axis][secondary_axis] = cos(angle);
+		rotation[tertiary_axis][secondary_axis] = -sin(angle);
+		rotation[secondary_axis][tertiary_axis] = sin(angle);
+		rotation[tertiary_axis][tertiary_axis] = cos(angle);
+		return rotation;
+	};
+	return single_axis(2, angles[2]) * single_axis(0, angles[1]) * single_axis(1, angles[0]);
+}
+
+
 void Model::rotateOnLayer(Quaternion quat, int layer)
 {
 	// TODO: update cpu rotation to use unsigned octree
@@ -548,7 +683,8 @@ void Model::rotateGPU(Quaternion quat)
 	//TODO: fix name for new_size and first_pool_index_ssbo
 	//memcpy(octree_->octree_pool_->data(), octree_data, new_size*sizeof(Octree::OctreeNode));
 	memcpy(octree_->octree_pool_->data(), octree_data+new_pool_start, (num_elements)*sizeof(Octree::OctreeNode));
-	//octree_->pool_freelist_->setRange(0, new_size, true); // TODO implement this!!!!
+	// the defragmented pool is contiguous, so every block up to the end is taken
+	octree_->resetPoolMetadata();
 	rotation_stuff_.cpu_ssbo.unmap();
 	std::cout << "Expanded size: " << (rotation_stuff_.max_octree_elements*sizeof(Octree::OctreeNode) >> 10) << "KB" << std::endl;
 	std::cout << "Defragmented size: " << (num_elements*sizeof(Octree::OctreeNode) >> 10) << "KB" << std::endl;
@@ -10,64 +10,131 @@
 \* ---------------------------------------------------------------- */
 
 #include "octree.hpp"
+#include "timer.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 namespace Anthrax
 {
 
-Octree::Octree(int num_layers)
+struct Octree::RelayoutState
+{
+	struct Item
+	{
+		IndirectionElement block;
+		int height; // only used for van Emde Boas: number of block levels to place from <block>
+	};
+	LayoutOrder order;
+	uint64_t pool_version;
+	std::deque<Item> pending;
+	std::vector<bool> placed;
+	std::vector<IndirectionElement> sequence; // old block indices in their new order
+	std::vector<IndirectionElement> remap;
+	SlabVector<OctreeNode> new_pool;
+	size_t num_copied = 0;
+
+	RelayoutState(size_t max_pool_bytes) : new_pool(max_pool_bytes) {}
+};
+
+
+Octree::Octree(int num_layers, size_t max_pool_bytes)
 {
-	pool_freelist_ = new Freelist();
-	octree_pool_ = new std::vector<OctreeNode>();
 	layer_ = num_layers;
+	max_pool_bytes_ = max_pool_bytes;
 	split_mode_ = SplitMode::NORMAL;
-
-	if (pool_freelist_->alloc() != 0)
-	{
-		throw std::runtime_error("Octree freelist generated incorrectly!");
-	}
-	octree_pool_->resize(8);
-	for (unsigned int i = 0; i < 8; i++)
-	{
-		(*octree_pool_)[i].indirection = 0;
-		(*octree_pool_)[i].voxel_type = 0;
-	}
-
+	createStorage();
 	return;
 }
 
 
 Octree::~Octree()
 {
-	for (std::list<Accessor>::iterator accessor_iter = accessors_.begin();
-	     accessor_iter != accessors_.end();
-	     accessor_iter++)
+	// destroying an accessor erases it from the list
+	while (!accessors_.empty())
 	{
-		accessor_iter->destroy();
+		accessors_.front().destroy();
 	}
-	delete pool_freelist_;
-	delete octree_pool_;
+	releaseStorage();
+	delete relayout_state_;
 	return;
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Make this octree a copy of <other> in O(1): the pool is shared
+ * and the root block gains a reference. Blocks are copied lazily as
+ * either octree writes to them (see setVoxelAtLayer()), so a write
+ * only duplicates the blocks from the root to the edited node.
+ *
+ * Octrees sharing a pool must all be used from the same thread,
+ * since a write to one updates the freelist and reference counts of
+ * the others.
+ * Call detach() on a copy before handing it to another thread.
+\* ---------------------------------------------------------------- */
 void Octree::copy(const Octree& other)
 {
-	// TODO
-	// NOTE: shallow copy
+	if (this == &other)
+	{
+		return;
+	}
+	if (sharers_)
+	{
+		releaseStorage();
+	}
+	delete relayout_state_;
+	relayout_state_ = nullptr;
 	layer_ = other.layer_;
+	max_pool_bytes_ = other.max_pool_bytes_;
 	split_mode_ = other.split_mode_;
 
 	pool_freelist_ = other.pool_freelist_;
 	octree_pool_ = other.octree_pool_;
+	block_refcounts_ = other.block_refcounts_;
+	sharers_ = other.sharers_;
+	sharers_->push_back(this);
+	root_ = other.root_;
+	(*block_refcounts_)[root_]++;
+	pool_version_++;
+	markAllDirty();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Give this octree a private pool holding only its own blocks, with
+ * the root at block 0. Does nothing if that is already the case.
+\* ---------------------------------------------------------------- */
+void Octree::detach()
+{
+	if (!isShared() && root_ == 0)
+	{
+		return;
+	}
+	relayout(LayoutOrder::DEPTH_FIRST);
 	return;
 }
 
 
 void Octree::clear()
 {
+	pool_version_++;
+	if (isShared())
+	{
+		// leave the other octrees' blocks alone
+		releaseStorage();
+		createStorage();
+		return;
+	}
+	root_ = 0;
 	octree_pool_->resize(8);
+	block_refcounts_->assign(1, 1);
 	pool_freelist_->clear();
 	if (pool_freelist_->alloc() != 0)
 	{
@@ -78,11 +145,182 @@ void Octree::clear()
 		(*octree_pool_)[i].indirection = 0;
 		(*octree_pool_)[i].voxel_type = 0;
 	}
-	
+	// everything else is unreachable now, so only the root needs re-uploading
+	markDirty(0);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Set up a new, private pool containing only an empty root block
+\* ---------------------------------------------------------------- */
+void Octree::createStorage()
+{
+	pool_freelist_ = new Freelist();
+	octree_pool_ = new SlabVector<OctreeNode>(max_pool_bytes_);
+	block_refcounts_ = new std::vector<uint32_t>(1, 1);
+	sharers_ = new std::list<Octree*>(1, this);
+	root_ = 0;
+
+	if (pool_freelist_->alloc() != 0)
+	{
+		throw std::runtime_error("Octree freelist generated incorrectly!");
+	}
+	octree_pool_->resize(8);
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		(*octree_pool_)[i].indirection = 0;
+		(*octree_pool_)[i].voxel_type = 0;
+	}
+	markDirty(0);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Stop using the current pool. If other octrees still share it,
+ * only the blocks no longer referenced by anyone are freed.
+\* ---------------------------------------------------------------- */
+void Octree::releaseStorage()
+{
+	sharers_->remove(this);
+	if (sharers_->empty())
+	{
+		delete pool_freelist_;
+		delete octree_pool_;
+		delete block_refcounts_;
+		delete sharers_;
+	}
+	else
+	{
+		freeSubtree(root_);
+	}
+	pool_freelist_ = nullptr;
+	octree_pool_ = nullptr;
+	block_refcounts_ = nullptr;
+	sharers_ = nullptr;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the pool with <new_pool> (rooted at block 0 and holding
+ * only reachable blocks). <new_pool> is left with the old contents
+ * if the old pool was private.
+\* ---------------------------------------------------------------- */
+void Octree::installPool(SlabVector<OctreeNode> &new_pool)
+{
+	if (isShared())
+	{
+		releaseStorage();
+		createStorage();
+	}
+	octree_pool_->swap(new_pool);
+	root_ = 0;
+	pool_version_++;
+	recountReferences();
+	markAllDirty();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Record that blocks <first_block> through
+ * <first_block>+<num_blocks>-1 were written to. Overlapping and
+ * adjacent ranges are coalesced, and once there are more than
+ * MAX_DIRTY_RANGES the two closest ranges are joined (re-uploading
+ * the clean blocks between them), so the set stays small no matter
+ * how scattered the edits are.
+\* ---------------------------------------------------------------- */
+void Octree::markDirty(size_t first_block, size_t num_blocks)
+{
+	size_t end_block = first_block + num_blocks;
+	if (first_block >= recent_dirty_first_ && end_block <= recent_dirty_end_)
+	{
+		// ranges only grow until they're taken, so this is still covered
+		return;
+	}
+	std::map<size_t, size_t>::iterator range = dirty_blocks_.upper_bound(first_block);
+	if (range != dirty_blocks_.begin() && std::prev(range)->second >= first_block)
+	{
+		// overlaps or directly follows the range before it (the common
+		// case, since new blocks are mostly appended), so grow that one
+		range = std::prev(range);
+		range->second = std::max(range->second, end_block);
+	}
+	else
+	{
+		range = dirty_blocks_.emplace_hint(range, first_block, end_block);
+	}
+	// swallow any ranges the grown range now reaches
+	std::map<size_t, size_t>::iterator next = std::next(range);
+	while (next != dirty_blocks_.end() && next->first <= range->second)
+	{
+		range->second = std::max(range->second, next->second);
+		next = dirty_blocks_.erase(next);
+	}
+	recent_dirty_first_ = range->first;
+	recent_dirty_end_ = range->second;
+
+	if (dirty_blocks_.size() > MAX_DIRTY_RANGES)
+	{
+		std::map<size_t, size_t>::iterator closest = dirty_blocks_.begin();
+		size_t closest_gap = SIZE_MAX;
+		for (std::map<size_t, size_t>::iterator current = dirty_blocks_.begin();
+		     std::next(current) != dirty_blocks_.end();
+		     current++)
+		{
+			size_t gap = std::next(current)->first - current->second;
+			if (gap < closest_gap)
+			{
+				closest = current;
+				closest_gap = gap;
+			}
+		}
+		closest->second = std::next(closest)->second;
+		dirty_blocks_.erase(std::next(closest));
+	}
+	return;
+}
+
+
+void Octree::markAllDirty()
+{
+	dirty_blocks_.clear();
+	recent_dirty_end_ = 0;
+	markDirty(0, octree_pool_->size() >> 3);
 	return;
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Return the node ranges of the exported pool (see data()) that
+ * were written since the last call, in ascending order, and start
+ * tracking afresh. Blocks that were freed in the meantime may be
+ * included; nothing reachable from the root is left out.
+\* ---------------------------------------------------------------- */
+std::vector<Octree::DirtyRange> Octree::takeDirtyRanges()
+{
+	detach();
+	std::vector<DirtyRange> ranges;
+	ranges.reserve(dirty_blocks_.size());
+	size_t num_blocks = octree_pool_->size() >> 3;
+	for (std::pair<const size_t, size_t> &range : dirty_blocks_)
+	{
+		if (range.first >= num_blocks)
+		{
+			// the pool has shrunk since
+			break;
+		}
+		size_t end_block = std::min(range.second, num_blocks);
+		ranges.push_back({range.first << 3, (end_block - range.first) << 3});
+	}
+	dirty_blocks_.clear();
+	recent_dirty_end_ = 0;
+	return ranges;
+}
+
+
 void Octree::setVoxel(uint32_t x, uint32_t y, uint32_t z, VoxelTypeElement voxel_type)
 {
 	return setVoxelAtLayer(x, y, z, voxel_type, 0);
@@ -94,17 +332,62 @@ void Octree::setVoxel(uint32_t x, uint32_t y, uint32_t z, VoxelTypeElement voxel
  * as if <layer> was layer 0, and coordinates are adjusted
  * accordingly. Beware that this will remove any octree data at
  * lower layers.
+ *
+ * Blocks that are shared (see deduplicate() and copy()) are copied
+ * before they are written to, so every block on the edited path
+ * ends up owned by exactly one parent.
 \* ---------------------------------------------------------------- */
 void Octree::setVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z,
 		VoxelTypeElement voxel_type, int layer)
+{
+	pool_version_++;
+	IndirectionElement pool_index;
+	// pool indices of every node that was descended through, used for merging
+	std::vector<IndirectionElement> path;
+	if (!descendForWrite(x, y, z, layer, &voxel_type, &pool_index, path))
+	{
+		// Nothing to be done here
+		return;
+	}
+	(*octree_pool_)[pool_index].voxel_type = voxel_type;
+	// now clear out data at layers underneath this, if needed
+	if ((*octree_pool_)[pool_index].indirection != 0)
+	{
+		freeSubtree((*octree_pool_)[pool_index].indirection);
+		(*octree_pool_)[pool_index].indirection = 0;
+	}
+	// merge if possible
+	simpleMerge(path);
+
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Walk down to the node at <layer> containing (x, y, z), splitting
+ * leaves and copying shared blocks on the way so that the node can
+ * be written to. The node's pool index is stored in <pool_index>
+ * and the pool indices of its ancestors are appended to <path>.
+ *
+ * If <new_voxel_type> isn't null and the walk reaches a leaf that
+ * already has that type, nothing is split and false is returned.
+\* ---------------------------------------------------------------- */
+bool Octree::descendForWrite(uint32_t x, uint32_t y, uint32_t z, int layer,
+		const VoxelTypeElement *new_voxel_type,
+		IndirectionElement *pool_index, std::vector<IndirectionElement> &path)
 {
 	layer = layer_ - layer - 1;
 	if (layer > layer_)
 	{
 		throw std::runtime_error("Layer must be at most num_layers of octree!");
 	}
-	IndirectionElement indirection = 0;
-	IndirectionElement pool_index;
+	if ((*block_refcounts_)[root_] > 1)
+	{
+		// root is shared with a copy of this octree
+		root_ = cloneBlock(root_);
+	}
+	IndirectionElement indirection = root_;
+	path.reserve(layer+1);
 	for (; layer >= 0; layer--)
 	{
 		uint32_t tmp_x = x >> layer;
@@ -112,25 +395,22 @@ void Octree::setVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z,
 		uint32_t tmp_z = z >> layer;
 		//IndirectionElement child = (x & 1u) | ((y & 1u) << 1) | ((z & 1u) << 2);
 		IndirectionElement child = (tmp_x & 1u) | ((tmp_y & 1u) << 1) | ((tmp_z & 1u) << 2);
-		pool_index = (indirection << 3) | child;
+		*pool_index = (indirection << 3) | child;
+		// the caller (and merging/LOD updates afterwards) may write any node on the path
+		markDirty(indirection);
 		if (layer == 0)
 			break;
 
-		IndirectionElement next_indirection = (*octree_pool_)[pool_index].indirection;
+		IndirectionElement next_indirection = (*octree_pool_)[*pool_index].indirection;
 		if (next_indirection == 0)
 		{
-			VoxelTypeElement old_voxel_type = (*octree_pool_)[pool_index].voxel_type;
-			if (old_voxel_type == voxel_type)
-			{
-				// Nothing to be done here
-				return;
-			}
-			next_indirection = pool_freelist_->alloc();
-			if (octree_pool_->size() < (next_indirection<<3)+8)
+			VoxelTypeElement old_voxel_type = (*octree_pool_)[*pool_index].voxel_type;
+			if (new_voxel_type && old_voxel_type == *new_voxel_type)
 			{
-				octree_pool_->resize((next_indirection<<3)+8);
+				return false;
 			}
-			(*octree_pool_)[pool_index].indirection = next_indirection;
+			next_indirection = allocBlock();
+			(*octree_pool_)[*pool_index].indirection = next_indirection;
 			// inherit the child voxel types from the split parent
 			for (IndirectionElement child_pool_index = (next_indirection << 3);
 			     child_pool_index < (next_indirection << 3)+8;
@@ -140,17 +420,149 @@ void Octree::setVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z,
 				(*octree_pool_)[child_pool_index].voxel_type = old_voxel_type;
 			}
 		}
+		else if ((*block_refcounts_)[next_indirection] > 1)
+		{
+			next_indirection = cloneBlock(next_indirection);
+			(*octree_pool_)[*pool_index].indirection = next_indirection;
+		}
+		path.push_back(*pool_index);
 		indirection = next_indirection;
 	}
-	(*octree_pool_)[pool_index].voxel_type = voxel_type;
-	// now clear out data at layers underneath this, if needed
-	if ((*octree_pool_)[pool_index].indirection != 0)
+	return true;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the contents of the octree with the given voxels. Any
+ * location not listed is air. If a location is listed more than
+ * once, the last record wins (same as calling setVoxel() in order).
+ *
+ * The records are sorted by morton code so that siblings are
+ * adjacent, then the pool is emitted bottom-up in a single pass.
+ * Each layer keeps one pending block of 8 nodes; when a record
+ * falls outside of that block the block is finished, and it is
+ * either collapsed into a uniform leaf or written out to the pool.
+ * Children are always written before their parents, and the root
+ * block is written last into index 0.
+\* ---------------------------------------------------------------- */
+void Octree::build(const std::vector<VoxelRecord> &voxels)
+{
+	if (3*layer_ > 64)
 	{
-		// TODO
-		(*octree_pool_)[pool_index].indirection = 0;
+		throw std::runtime_error("build(): octree has too many layers for 64-bit morton codes!");
 	}
-	// merge if possible
-	// TODO
+	struct MortonVoxel
+	{
+		uint64_t code;
+		VoxelTypeElement voxel_type;
+	};
+	std::vector<MortonVoxel> sorted_voxels(voxels.size());
+	uint32_t axis_size = 1u << layer_;
+	for (size_t i = 0; i < voxels.size(); i++)
+	{
+		if (voxels[i].x >= axis_size || voxels[i].y >= axis_size || voxels[i].z >= axis_size)
+		{
+			throw std::runtime_error("build(): voxel lies outside of the octree!");
+		}
+		sorted_voxels[i].code = mortonEncode(voxels[i].x, voxels[i].y, voxels[i].z);
+		sorted_voxels[i].voxel_type = voxels[i].voxel_type;
+	}
+	std::stable_sort(sorted_voxels.begin(), sorted_voxels.end(),
+			[](const MortonVoxel &a, const MortonVoxel &b) { return a.code < b.code; });
+
+	clear();
+
+	// pending_blocks[layer] holds the 8 children of the node currently being
+	// built at that layer. Layer 0 holds the leaves, layer layer_-1 is the root.
+	std::vector<OctreeNode> pending_blocks(layer_*8);
+	std::vector<uint64_t> pending_prefixes(layer_, 0);
+	std::vector<bool> pending_active(layer_, false);
+	IndirectionElement next_indirection = 1;
+
+	auto activate = [&](int layer, uint64_t prefix)
+	{
+		pending_active[layer] = true;
+		pending_prefixes[layer] = prefix;
+		for (int child = 0; child < 8; child++)
+		{
+			pending_blocks[layer*8+child].indirection = 0;
+			pending_blocks[layer*8+child].voxel_type = 0;
+		}
+	};
+
+	// finish the pending block at <layer> and hand the result to its parent
+	auto finish = [&](auto &self, int layer) -> void
+	{
+		pending_active[layer] = false;
+		OctreeNode *block = &pending_blocks[layer*8];
+		OctreeNode parent_node;
+		parent_node.indirection = 0;
+		parent_node.voxel_type = block[0].voxel_type;
+		if (!isUniformBlock(block))
+		{
+			parent_node.indirection = next_indirection++;
+			parent_node.voxel_type = calculateMaterialTypeFromChildren(block);
+			octree_pool_->append(block, 8);
+		}
+		if (parent_node.indirection == 0 && parent_node.voxel_type == 0)
+		{
+			// air is the default, so there is no need to pass it up
+			return;
+		}
+		uint64_t code = pending_prefixes[layer];
+		if (pending_active[layer+1] && pending_prefixes[layer+1] != (code >> 3))
+		{
+			self(self, layer+1);
+		}
+		if (!pending_active[layer+1])
+		{
+			activate(layer+1, code >> 3);
+		}
+		pending_blocks[(layer+1)*8+(code & 7u)] = parent_node;
+	};
+
+	for (size_t i = 0; i < sorted_voxels.size(); i++)
+	{
+		// only the last of any duplicate records is kept
+		if (i+1 < sorted_voxels.size() && sorted_voxels[i+1].code == sorted_voxels[i].code)
+		{
+			continue;
+		}
+		if (sorted_voxels[i].voxel_type == 0)
+		{
+			continue;
+		}
+		uint64_t code = sorted_voxels[i].code;
+		if (pending_active[0] && pending_prefixes[0] != (code >> 3))
+		{
+			finish(finish, 0);
+		}
+		if (!pending_active[0])
+		{
+			activate(0, code >> 3);
+		}
+		pending_blocks[code & 7u].indirection = 0;
+		pending_blocks[code & 7u].voxel_type = sorted_voxels[i].voxel_type;
+	}
+
+	// flush whatever is still pending, bottom-up
+	for (int layer = 0; layer < layer_-1; layer++)
+	{
+		if (pending_active[layer])
+		{
+			finish(finish, layer);
+		}
+	}
+	if (pending_active[layer_-1])
+	{
+		for (int child = 0; child < 8; child++)
+		{
+			(*octree_pool_)[child] = pending_blocks[(layer_-1)*8+child];
+		}
+	}
+	pool_freelist_->setRange(1, next_indirection-1, true);
+	block_refcounts_->assign(next_indirection, 1);
+	markAllDirty();
 
 	return;
 }
@@ -175,7 +587,7 @@ VoxelTypeElement Octree::getVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z, int
 	{
 		throw std::runtime_error("Layer must be at most num_layers of octree!");
 	}
-	IndirectionElement indirection = 0;
+	IndirectionElement indirection = root_;
 	IndirectionElement pool_index;
 	for (; layer >= 0; layer--)
 	{
@@ -199,355 +611,1973 @@ VoxelTypeElement Octree::getVoxelAtLayer(uint32_t x, uint32_t y, uint32_t z, int
 
 
 /* ---------------------------------------------------------------- *\
- * This is a less CPU-intensive merge function. While the normal
- * merge() checks all possible merges in all descendents, this
- * function will only check if each of the children are uniform.
- * If they are not, the children are not descended into and the
- * merge terminates.
+ * Lane state for getVoxels(), one array entry per lane
 \* ---------------------------------------------------------------- */
-void Octree::simpleMerge()
+struct Octree::VoxelBatch
 {
-	// TODO
-	return;
-	/*
-	if (isRoot())
+	const glm::uvec3 *positions;
+	VoxelTypeElement *voxel_types;
+	int num_layers;
+	int num_active_lanes;
+	alignas(32) uint32_t x[BATCH_LANES];
+	alignas(32) uint32_t y[BATCH_LANES];
+	alignas(32) uint32_t z[BATCH_LANES];
+	alignas(32) IndirectionElement block[BATCH_LANES];
+	alignas(32) int layer[BATCH_LANES]; // -1 once the lane runs out of queries
+	size_t query[BATCH_LANES];
+	size_t end_query[BATCH_LANES];
+	int leaf_layer[BATCH_LANES]; // where the lane's last query ended, -1 before the first
+	VoxelTypeElement leaf_voxel_type[BATCH_LANES];
+	IndirectionElement path[BATCH_LANES][32]; // path[lane][layer] is the block whose children are picked by bit <layer>
+
+	void startNextQuery(int lane, size_t next_query);
+	void finishQuery(int lane, int layer, VoxelTypeElement voxel_type)
 	{
-		// the root node can never be uniform due to the way the
-		// indirection pool is laid out
-		return;
+		voxel_types[query[lane]] = voxel_type;
+		leaf_layer[lane] = layer;
+		leaf_voxel_type[lane] = voxel_type;
+		return startNextQuery(lane, query[lane]+1);
 	}
-	if (isUniform())
+	void descend(int lane, IndirectionElement indirection, const OctreeNode *pool)
 	{
+		block[lane] = indirection;
+		layer[lane]--;
+		path[lane][layer[lane]] = indirection;
+		__builtin_prefetch(&pool[indirection << 3]);
 		return;
 	}
-	// check if children can be merged
-	VoxelTypeElement material_type = children_[0].getMaterialType();
-	bool can_merge_children = true;
-	for (unsigned int i = 0; i < 8; i++)
-	{
-		if (!children_[i].isUniform()
-				|| children_[i].getMaterialType() != material_type)
-		{
-			can_merge_children = false;
-			break;
-		}
-	}
-	if (can_merge_children)
+	void step(const OctreeNode *pool);
+#ifdef __x86_64__
+	__attribute__((target("avx2"))) void stepAVX2(const OctreeNode *pool);
+#endif
+};
+
+
+/* ---------------------------------------------------------------- *\
+ * Move <lane> on to its next query that needs any lookups. The
+ * descent starts from the layer where the path to the new position
+ * splits from the path to the lane's last one.
+\* ---------------------------------------------------------------- */
+void Octree::VoxelBatch::startNextQuery(int lane, size_t next_query)
+{
+	uint32_t layer_mask = (num_layers == 32) ? UINT32_MAX : ((1u << num_layers) - 1);
+	for (; next_query < end_query[lane]; next_query++)
 	{
-		clear();
-		setMaterialType(material_type);
-		//std::cout << "Merged! Material type: " << material_type << " | Layer: " << layer_ << std::endl;
-		if (parent_)
+		glm::uvec3 position = positions[next_query];
+		int start_layer = num_layers-1;
+		if (leaf_layer[lane] >= 0)
 		{
-			parent_->simpleMerge();
+			uint32_t difference = ((position.x ^ x[lane]) | (position.y ^ y[lane]) | (position.z ^ z[lane])) & layer_mask;
+			int first_different_layer = (difference == 0) ? -1 : (31 - __builtin_clz(difference));
+			if (first_different_layer < leaf_layer[lane])
+			{
+				// same leaf as the last query
+				voxel_types[next_query] = leaf_voxel_type[lane];
+				continue;
+			}
+			start_layer = first_different_layer;
 		}
+		query[lane] = next_query;
+		x[lane] = position.x;
+		y[lane] = position.y;
+		z[lane] = position.z;
+		layer[lane] = start_layer;
+		block[lane] = path[lane][start_layer];
+		return;
 	}
+	layer[lane] = -1;
+	num_active_lanes--;
 	return;
-	*/
 }
 
 
 /* ---------------------------------------------------------------- *\
- * Update the approximated material type based on the immediate
- * children
+ * Move every active lane down one layer, or on to its next query
 \* ---------------------------------------------------------------- */
-void Octree::simpleUpdateLOD()
+void Octree::VoxelBatch::step(const OctreeNode *pool)
 {
-	// TODO
-	return;
-	/*
-	if (isUniform())
-	{
-		return;
-	}
-	VoxelTypeElement new_material_type = calculateMaterialTypeFromChildren();
-	bool material_type_changed = (new_material_type != getMaterialType());
-	setMaterialType(new_material_type);
-	if (material_type_changed && parent_)
+	for (int lane = 0; lane < BATCH_LANES; lane++)
 	{
-		parent_->simpleUpdateLOD();
+		int lane_layer = layer[lane];
+		if (lane_layer < 0)
+		{
+			continue;
+		}
+		IndirectionElement child = ((x[lane] >> lane_layer) & 1u) |
+				(((y[lane] >> lane_layer) & 1u) << 1) |
+				(((z[lane] >> lane_layer) & 1u) << 2);
+		OctreeNode node = pool[(block[lane] << 3) | child];
+		if (node.indirection != 0 && lane_layer != 0)
+		{
+			descend(lane, node.indirection, pool);
+			continue;
+		}
+		finishQuery(lane, lane_layer, node.voxel_type);
 	}
 	return;
-	*/
 }
 
 
-VoxelTypeElement Octree::calculateMaterialTypeFromChildren()
+#ifdef __x86_64__
+/* ---------------------------------------------------------------- *\
+ * step(), 8 lanes at a time: the child index of each lane is worked
+ * out in one go and both halves of the 8 nodes are gathered. Only
+ * the lanes that finish or move down take the scalar path, to record
+ * their result or path. Needs every node index below 2^31.
+\* ---------------------------------------------------------------- */
+void Octree::VoxelBatch::stepAVX2(const OctreeNode *pool)
 {
-	// TODO
-	return 0;
-	/*
-	if (isUniform())
+	const int *indirections = reinterpret_cast<const int*>(pool);
+	const int *voxel_types = indirections + 1;
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i zero = _mm256_setzero_si256();
+	for (int first_lane = 0; first_lane < BATCH_LANES; first_lane += 8)
 	{
-		return getMaterialType();
+		__m256i lane_layer = _mm256_load_si256(reinterpret_cast<const __m256i*>(&layer[first_lane]));
+		__m256i active = _mm256_cmpgt_epi32(lane_layer, _mm256_set1_epi32(-1));
+		if (_mm256_testz_si256(active, active))
+		{
+			continue;
+		}
+		__m256i child = _mm256_and_si256(_mm256_srlv_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&x[first_lane])), lane_layer), one);
+		child = _mm256_or_si256(child, _mm256_slli_epi32(_mm256_and_si256(_mm256_srlv_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&y[first_lane])), lane_layer), one), 1));
+		child = _mm256_or_si256(child, _mm256_slli_epi32(_mm256_and_si256(_mm256_srlv_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&z[first_lane])), lane_layer), one), 2));
+		__m256i node_index = _mm256_or_si256(_mm256_slli_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&block[first_lane])), 3), child);
+		__m256i indirection = _mm256_mask_i32gather_epi32(zero, indirections, node_index, active, sizeof(OctreeNode));
+		__m256i voxel_type = _mm256_mask_i32gather_epi32(zero, voxel_types, node_index, active, sizeof(OctreeNode));
+		__m256i stops = _mm256_or_si256(_mm256_cmpeq_epi32(indirection, zero), _mm256_cmpeq_epi32(lane_layer, zero));
+		uint32_t finished = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(active, stops)));
+		uint32_t descending = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(stops, active)));
+		alignas(32) uint32_t lane_indirection[8];
+		alignas(32) VoxelTypeElement lane_voxel_type[8];
+		alignas(32) int old_layer[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lane_indirection), indirection);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lane_voxel_type), voxel_type);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(old_layer), lane_layer);
+		for (; descending != 0; descending &= descending-1)
+		{
+			int lane = __builtin_ctz(descending);
+			descend(first_lane+lane, lane_indirection[lane], pool);
+		}
+		for (; finished != 0; finished &= finished-1)
+		{
+			int lane = __builtin_ctz(finished);
+			finishQuery(first_lane+lane, old_layer[lane], lane_voxel_type[lane]);
+		}
 	}
-	// return the material type of the 0th child
-	return children_[0].getMaterialType();
-	*/
+	return;
 }
+#endif
 
 
-void Octree::mergeOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z)
+/* ---------------------------------------------------------------- *\
+ * Put the indices of <positions> in <order>, sorted by the morton
+ * code of the position's top MORTON_SORT_BUCKET_LAYERS bits per
+ * axis. A single counting sort pass: queries within the same bucket
+ * keep their order, which is all the locality the lanes need.
+\* ---------------------------------------------------------------- */
+void Octree::sortByMortonCode(const glm::uvec3 *positions, size_t num_positions, std::vector<uint32_t> &order)
 {
-	other->mergeIntoOctree(this, x, y, z);
+	int bucket_layers = std::min(layer_, MORTON_SORT_BUCKET_LAYERS);
+	int shift = layer_ - bucket_layers;
+	std::vector<uint32_t> buckets(num_positions);
+	std::vector<size_t> offsets((size_t(1) << 3*bucket_layers) + 1);
+	for (size_t i = 0; i < num_positions; i++)
+	{
+		buckets[i] = static_cast<uint32_t>(mortonEncode(positions[i].x >> shift, positions[i].y >> shift, positions[i].z >> shift));
+		offsets[buckets[i] + 1]++;
+	}
+	for (size_t i = 1; i < offsets.size(); i++)
+	{
+		offsets[i] += offsets[i - 1];
+	}
+	order.resize(num_positions);
+	for (size_t i = 0; i < num_positions; i++)
+	{
+		order[offsets[buckets[i]]++] = static_cast<uint32_t>(i);
+	}
 	return;
 }
 
 
-void Octree::mergeIntoOctreeRecursive(Octree *other, IndirectionElement indirection, int layer, uint32_t x, uint32_t y, uint32_t z)
+/* ---------------------------------------------------------------- *\
+ * Look up <num_positions> voxels at once, writing the type of
+ * <positions>[i] to <voxel_types>[i]. BATCH_LANES queries descend
+ * side by side, a layer at a time, so their cache misses overlap
+ * instead of being waited out one after another. Each lane works
+ * through its own contiguous share of the queries and starts each
+ * one from where its path splits from the lane's last (answering it
+ * outright if it's in the same leaf), so coherent queries only walk
+ * the bottom of the tree. With <sort_by_morton_code>, the queries
+ * are first sorted into morton order buckets (see sortByMortonCode())
+ * so scattered queries get some of that coherence too; the sort and
+ * the copies it takes usually cost more than they save, so it's off
+ * by default. The lanes are stepped with AVX2 where the CPU has it.
+\* ---------------------------------------------------------------- */
+void Octree::getVoxels(const glm::uvec3 *positions, size_t num_positions, VoxelTypeElement *voxel_types, bool sort_by_morton_code)
 {
-	uint32_t quarter_axis_size;
-	uint32_t adder;
-	uint32_t subtracter;
+	std::vector<uint32_t> order;
+	std::vector<glm::uvec3> sorted_positions;
+	std::vector<VoxelTypeElement> sorted_voxel_types;
+	if (sort_by_morton_code && num_positions <= UINT32_MAX)
+	{
+		sortByMortonCode(positions, num_positions, order);
+		sorted_positions.resize(num_positions);
+		sorted_voxel_types.resize(num_positions);
+		for (size_t i = 0; i < num_positions; i++)
+		{
+			sorted_positions[i] = positions[order[i]];
+		}
+		getVoxels(sorted_positions.data(), num_positions, sorted_voxel_types.data());
+		for (size_t i = 0; i < num_positions; i++)
+		{
+			voxel_types[order[i]] = sorted_voxel_types[i];
+		}
+		return;
+	}
+
+	VoxelBatch batch;
+	batch.positions = positions;
+	batch.voxel_types = voxel_types;
+	batch.num_layers = layer_;
+	batch.num_active_lanes = BATCH_LANES;
+	for (int lane = 0; lane < BATCH_LANES; lane++)
+	{
+		batch.end_query[lane] = num_positions*(lane+1)/BATCH_LANES;
+		batch.leaf_layer[lane] = -1;
+		batch.path[lane][layer_-1] = root_;
+		batch.startNextQuery(lane, num_positions*lane/BATCH_LANES);
+	}
+	const OctreeNode *pool = octree_pool_->data();
+#ifdef __x86_64__
+	if (__builtin_cpu_supports("avx2") && octree_pool_->size() <= INT32_MAX)
+	{
+		while (batch.num_active_lanes > 0)
+		{
+			batch.stepAVX2(pool);
+		}
+		return;
+	}
+#endif
+	while (batch.num_active_lanes > 0)
+	{
+		batch.step(pool);
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * This is a less CPU-intensive merge function. While the normal
+ * merge() checks all possible merges in all descendents, this
+ * function will only check if each of the children are uniform.
+ * If they are not, the children are not descended into and the
+ * merge terminates.
+ *
+ * <path> holds the pool indices of the nodes that were descended
+ * through to reach the last edit, starting at the root block. The
+ * block pointed to by the last node in the path is checked first,
+ * then its parent, and so on. Merged blocks are returned to the
+ * freelist. Once a block can't be merged, the remaining ancestors
+ * only get their LOD material updated.
+\* ---------------------------------------------------------------- */
+void Octree::simpleMerge(const std::vector<IndirectionElement> &path)
+{
+	size_t depth = path.size();
+	while (depth > 0)
+	{
+		IndirectionElement parent_pool_index = path[depth-1];
+		IndirectionElement indirection = (*octree_pool_)[parent_pool_index].indirection;
+		OctreeNode *children = &(*octree_pool_)[indirection << 3];
+		if (!isUniformBlock(children))
+		{
+			break;
+		}
+		(*octree_pool_)[parent_pool_index].voxel_type = children[0].voxel_type;
+		(*octree_pool_)[parent_pool_index].indirection = 0;
+		freeSubtree(indirection);
+		depth--;
+	}
+	simpleUpdateLOD(path, depth);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Update the approximated material type based on the immediate
+ * children, for the first <depth> nodes of <path>. Stops early once
+ * a node's material doesn't change.
+\* ---------------------------------------------------------------- */
+void Octree::simpleUpdateLOD(const std::vector<IndirectionElement> &path, size_t depth)
+{
+	while (depth > 0)
+	{
+		IndirectionElement parent_pool_index = path[depth-1];
+		IndirectionElement indirection = (*octree_pool_)[parent_pool_index].indirection;
+		VoxelTypeElement new_material_type =
+				calculateMaterialTypeFromChildren(&(*octree_pool_)[indirection << 3]);
+		if (new_material_type == (*octree_pool_)[parent_pool_index].voxel_type)
+		{
+			break;
+		}
+		(*octree_pool_)[parent_pool_index].voxel_type = new_material_type;
+		depth--;
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Pick the material an interior node is drawn with when the renderer
+ * stops above the leaves: the most common non-air material among the
+ * children (ties go to the lowest child). Air only wins if every
+ * child is air, so thin geometry doesn't vanish at a distance.
+\* ---------------------------------------------------------------- */
+VoxelTypeElement Octree::calculateMaterialTypeFromChildren(const OctreeNode *children)
+{
+	VoxelTypeElement dominant_type = 0;
+	int dominant_count = 0;
+	for (int child = 0; child < 8; child++)
+	{
+		VoxelTypeElement voxel_type = children[child].voxel_type;
+		if (voxel_type == 0 || voxel_type == dominant_type)
+		{
+			continue;
+		}
+		int count = 1;
+		for (int other = child+1; other < 8; other++)
+		{
+			if (children[other].voxel_type == voxel_type)
+			{
+				count++;
+			}
+		}
+		if (count > dominant_count)
+		{
+			dominant_type = voxel_type;
+			dominant_count = count;
+		}
+	}
+	return dominant_type;
+}
+
+
+bool Octree::isUniformBlock(const OctreeNode *children)
+{
+	for (int child = 0; child < 8; child++)
+	{
+		if (children[child].indirection != 0 || children[child].voxel_type != children[0].voxel_type)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+IndirectionElement Octree::allocBlock()
+{
+	IndirectionElement indirection = pool_freelist_->alloc();
+	if (octree_pool_->size() < (indirection<<3)+8)
+	{
+		octree_pool_->resize((indirection<<3)+8);
+		block_refcounts_->resize(indirection+1, 0);
+	}
+	(*block_refcounts_)[indirection] = 1;
+	markDirty(indirection);
+	return indirection;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Allocate <num_blocks> contiguous blocks and return the first. The
+ * caller is responsible for filling them in and for their reference
+ * counts.
+\* ---------------------------------------------------------------- */
+IndirectionElement Octree::allocBlockRange(size_t num_blocks)
+{
+	IndirectionElement indirection = pool_freelist_->allocRange(num_blocks);
+	if (octree_pool_->size() < ((indirection+num_blocks) << 3))
+	{
+		octree_pool_->resize((indirection+num_blocks) << 3);
+		block_refcounts_->resize(indirection+num_blocks, 0);
+	}
+	markDirty(indirection, num_blocks);
+	return indirection;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Return a single block to the freelist. If it sits at the end of
+ * the pool, the pool is shrunk past it and any other free blocks
+ * directly before it.
+\* ---------------------------------------------------------------- */
+void Octree::freeBlock(IndirectionElement indirection)
+{
+	(*block_refcounts_)[indirection] = 0;
+	pool_freelist_->free(indirection);
+	size_t num_blocks = octree_pool_->size() >> 3;
+	if (indirection != num_blocks-1)
+	{
+		return;
+	}
+	while (num_blocks > 1 && !pool_freelist_->isTaken(num_blocks-1))
+	{
+		num_blocks--;
+	}
+	octree_pool_->resize(num_blocks << 3);
+	block_refcounts_->resize(num_blocks);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Make a private copy of a shared block, dropping one reference to
+ * the original. The children of the copy gain a reference each. The
+ * caller is responsible for pointing the old reference at the copy.
+\* ---------------------------------------------------------------- */
+IndirectionElement Octree::cloneBlock(IndirectionElement shared_indirection)
+{
+	IndirectionElement new_indirection = allocBlock();
+	for (int child = 0; child < 8; child++)
+	{
+		OctreeNode node = (*octree_pool_)[(shared_indirection << 3)+child];
+		(*octree_pool_)[(new_indirection << 3)+child] = node;
+		if (node.indirection != 0)
+		{
+			(*block_refcounts_)[node.indirection]++;
+		}
+	}
+	(*block_refcounts_)[shared_indirection]--;
+	return new_indirection;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Drop a reference to a block. Once a block has no references left
+ * it is returned to the freelist, along with every block underneath
+ * it that also runs out of references. Uses an explicit stack so
+ * deep trees can't overflow the call stack. The caller is
+ * responsible for clearing the indirection that pointed to
+ * <indirection>.
+\* ---------------------------------------------------------------- */
+void Octree::freeSubtree(IndirectionElement indirection)
+{
+	std::vector<IndirectionElement> stack;
+	stack.push_back(indirection);
+	while (!stack.empty())
+	{
+		IndirectionElement current = stack.back();
+		stack.pop_back();
+		if (--(*block_refcounts_)[current] > 0)
+		{
+			// still shared with another parent
+			continue;
+		}
+		for (IndirectionElement pool_index = (current << 3);
+		     pool_index < (current << 3)+8;
+		     pool_index++)
+		{
+			if ((*octree_pool_)[pool_index].indirection != 0)
+			{
+				stack.push_back((*octree_pool_)[pool_index].indirection);
+			}
+		}
+		freeBlock(current);
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Move live blocks from the end of the pool into the holes left by
+ * freed blocks, then shrink the pool so it holds only live blocks.
+ * Blocks that can't be reached from the root are treated as free.
+ * All indirections into moved blocks are rewritten, so any pool
+ * indices held outside of the octree are invalidated.
+\* ---------------------------------------------------------------- */
+void Octree::compact()
+{
+	if (isShared() || root_ != 0)
+	{
+		// copying out only this octree's blocks compacts them too
+		detach();
+		return;
+	}
+	size_t num_blocks = octree_pool_->size() >> 3;
+	std::vector<bool> live(num_blocks, false);
+	size_t num_live = 1;
+	live[0] = true;
+	pool_version_++;
+	std::vector<IndirectionElement> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		IndirectionElement current = stack.back();
+		stack.pop_back();
+		for (IndirectionElement pool_index = (current << 3);
+		     pool_index < (current << 3)+8;
+		     pool_index++)
+		{
+			IndirectionElement child = (*octree_pool_)[pool_index].indirection;
+			if (child != 0 && !live[child])
+			{
+				live[child] = true;
+				num_live++;
+				stack.push_back(child);
+			}
+		}
+	}
+
+	// live blocks below num_live stay put, the rest fill the holes in order
+	std::vector<IndirectionElement> remap(num_blocks);
+	size_t hole = 1;
+	for (size_t block = 0; block < num_blocks; block++)
+	{
+		remap[block] = block;
+		if (block < num_live || !live[block])
+		{
+			continue;
+		}
+		while (live[hole])
+			hole++;
+		remap[block] = hole;
+		for (int child = 0; child < 8; child++)
+		{
+			(*octree_pool_)[(hole << 3)+child] = (*octree_pool_)[(block << 3)+child];
+		}
+		(*block_refcounts_)[hole] = (*block_refcounts_)[block];
+		hole++;
+	}
+	octree_pool_->resize(num_live << 3);
+	block_refcounts_->resize(num_live);
+	for (size_t pool_index = 0; pool_index < octree_pool_->size(); pool_index++)
+	{
+		(*octree_pool_)[pool_index].indirection = remap[(*octree_pool_)[pool_index].indirection];
+	}
+	pool_freelist_->clear();
+	pool_freelist_->setRange(0, num_live, true);
+	markAllDirty();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Turn the octree into a directed acyclic graph by storing every
+ * distinct block only once. Blocks are visited bottom-up so that by
+ * the time a block is hashed, its children already point at their
+ * deduplicated copies. Two blocks are identical if all 8 nodes
+ * (indirection and voxel type) match, so identical subtrees collapse
+ * into one no matter where they are in the octree.
+ *
+ * Traversal is unchanged (a child indirection is still just a pool
+ * index), so the result can be uploaded to the GPU as-is. Shared
+ * blocks are copied on write by setVoxelAtLayer(), so the octree
+ * can still be edited afterwards.
+\* ---------------------------------------------------------------- */
+void Octree::deduplicate()
+{
+	struct BlockKey
+	{
+		OctreeNode nodes[8];
+		bool operator==(const BlockKey &other) const
+		{
+			for (int child = 0; child < 8; child++)
+			{
+				if (nodes[child].indirection != other.nodes[child].indirection ||
+				    nodes[child].voxel_type != other.nodes[child].voxel_type)
+					return false;
+			}
+			return true;
+		}
+	};
+	struct BlockKeyHash
+	{
+		size_t operator()(const BlockKey &key) const
+		{
+			uint64_t hash = 0xCBF29CE484222325ull;
+			for (int child = 0; child < 8; child++)
+			{
+				hash = (hash ^ key.nodes[child].indirection) * 0x100000001B3ull;
+				hash = (hash ^ key.nodes[child].voxel_type) * 0x100000001B3ull;
+			}
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+	};
+	struct Frame
+	{
+		IndirectionElement block;
+		int next_child;
+	};
+
+	size_t num_blocks = octree_pool_->size() >> 3;
+	// remap[block] is the block's index in the new pool, 0 if not yet visited
+	// (the root is never a child, and always ends up at block 0)
+	std::vector<IndirectionElement> remap(num_blocks, 0);
+	SlabVector<OctreeNode> new_pool(max_pool_bytes_);
+	new_pool.resize(8);
+	std::unordered_map<BlockKey, IndirectionElement, BlockKeyHash> unique_blocks;
+
+	std::vector<Frame> stack;
+	stack.push_back({root_, 0});
+	while (!stack.empty())
+	{
+		Frame &frame = stack.back();
+		if (frame.next_child < 8)
+		{
+			IndirectionElement child = (*octree_pool_)[(frame.block << 3)+frame.next_child].indirection;
+			frame.next_child++;
+			if (child != 0 && remap[child] == 0)
+			{
+				stack.push_back({child, 0});
+			}
+			continue;
+		}
+		// all children have been deduplicated
+		IndirectionElement block = frame.block;
+		stack.pop_back();
+		BlockKey key;
+		for (int child = 0; child < 8; child++)
+		{
+			key.nodes[child] = (*octree_pool_)[(block << 3)+child];
+			key.nodes[child].indirection = remap[key.nodes[child].indirection];
+		}
+		if (block == root_)
+		{
+			memcpy(new_pool.data(), key.nodes, 8*sizeof(OctreeNode));
+			continue;
+		}
+		auto found = unique_blocks.find(key);
+		if (found != unique_blocks.end())
+		{
+			remap[block] = found->second;
+			continue;
+		}
+		IndirectionElement new_indirection = new_pool.size() >> 3;
+		new_pool.append(key.nodes, 8);
+		unique_blocks.emplace(key, new_indirection);
+		remap[block] = new_indirection;
+	}
+
+	installPool(new_pool);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Rewrite the pool so blocks that are traversed together sit near
+ * each other in memory:
+ *   - DEPTH_FIRST: each block is followed by its first subtree
+ *   - BREADTH_FIRST: all blocks of a layer are stored together
+ *   - VAN_EMDE_BOAS: the tree is split at half its height, the top
+ *     half is laid out, then each bottom subtree, recursively. Any
+ *     root-to-leaf walk touches few cache lines/pages regardless of
+ *     their size.
+ * Unreachable blocks are dropped, as in compact(), and the octree
+ * stops sharing its pool with any copies.
+ *
+ * The work is split in two resumable phases (ordering the blocks,
+ * then copying them into a new pool), so with a nonzero
+ * <time_budget_us> this returns false once the budget is used up and
+ * picks up where it left off on the next call. The pool is only
+ * replaced at the very end, and any edit in between restarts the
+ * pass. Returns true once the pool has been replaced.
+\* ---------------------------------------------------------------- */
+bool Octree::relayout(LayoutOrder order, long long time_budget_us)
+{
+	if (relayout_state_ && (relayout_state_->order != order ||
+	                        relayout_state_->pool_version != pool_version_))
+	{
+		delete relayout_state_;
+		relayout_state_ = nullptr;
+	}
+	if (!relayout_state_)
+	{
+		relayout_state_ = new RelayoutState(max_pool_bytes_);
+		relayout_state_->order = order;
+		relayout_state_->pool_version = pool_version_;
+		relayout_state_->placed.assign(octree_pool_->size() >> 3, false);
+		relayout_state_->pending.push_back({root_, layer_});
+	}
+	RelayoutState &state = *relayout_state_;
+
+	Timer timer(Timer::MICROSECONDS);
+	timer.start();
+	size_t steps = 0;
+	auto outOfTime = [&]() {
+		return time_budget_us > 0 && (++steps & 0xFF) == 0 && timer.query() >= time_budget_us;
+	};
+
+	// phase 1: decide the order of the blocks
+	std::vector<IndirectionElement> level, next_level;
+	while (!state.pending.empty())
+	{
+		if (outOfTime())
+		{
+			return false;
+		}
+		RelayoutState::Item item;
+		if (order == LayoutOrder::BREADTH_FIRST)
+		{
+			item = state.pending.front();
+			state.pending.pop_front();
+		}
+		else
+		{
+			item = state.pending.back();
+			state.pending.pop_back();
+		}
+		if (state.placed[item.block])
+		{
+			// shared subtree that has already been laid out
+			continue;
+		}
+		if (order == LayoutOrder::VAN_EMDE_BOAS && item.height > 1)
+		{
+			// place the top half first, then every subtree hanging off of it
+			int top_height = item.height / 2;
+			level.assign(1, item.block);
+			for (int depth = 0; depth < top_height; depth++)
+			{
+				next_level.clear();
+				for (IndirectionElement block : level)
+				{
+					for (int child = 0; child < 8; child++)
+					{
+						IndirectionElement indirection = (*octree_pool_)[(block << 3)+child].indirection;
+						if (indirection != 0)
+							next_level.push_back(indirection);
+					}
+				}
+				level.swap(next_level);
+			}
+			for (auto block = level.rbegin(); block != level.rend(); block++)
+			{
+				state.pending.push_back({*block, item.height - top_height});
+			}
+			state.pending.push_back({item.block, top_height});
+			continue;
+		}
+		state.placed[item.block] = true;
+		state.sequence.push_back(item.block);
+		if (order == LayoutOrder::VAN_EMDE_BOAS)
+		{
+			// children are handled by the enclosing split
+			continue;
+		}
+		for (int i = 0; i < 8; i++)
+		{
+			// depth-first pops from the back, so push in reverse to visit child 0 first
+			int child = (order == LayoutOrder::DEPTH_FIRST) ? 7-i : i;
+			IndirectionElement indirection = (*octree_pool_)[(item.block << 3)+child].indirection;
+			if (indirection != 0)
+				state.pending.push_back({indirection, 0});
+		}
+	}
+
+	// phase 2: copy the blocks into their new positions
+	if (state.remap.empty())
+	{
+		state.remap.resize(octree_pool_->size() >> 3);
+		for (size_t new_block = 0; new_block < state.sequence.size(); new_block++)
+		{
+			state.remap[state.sequence[new_block]] = new_block;
+		}
+		state.new_pool.resize(state.sequence.size() << 3);
+	}
+	while (state.num_copied < state.sequence.size())
+	{
+		if (outOfTime())
+		{
+			return false;
+		}
+		IndirectionElement old_block = state.sequence[state.num_copied];
+		for (int child = 0; child < 8; child++)
+		{
+			OctreeNode node = (*octree_pool_)[(old_block << 3)+child];
+			node.indirection = state.remap[node.indirection];
+			state.new_pool[(state.num_copied << 3)+child] = node;
+		}
+		state.num_copied++;
+	}
+
+	installPool(state.new_pool);
+	delete relayout_state_;
+	relayout_state_ = nullptr;
+	return true;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Rebuild the reference counts and freelist from scratch for a pool
+ * that holds only reachable blocks.
+\* ---------------------------------------------------------------- */
+void Octree::recountReferences()
+{
+	size_t num_blocks = octree_pool_->size() >> 3;
+	block_refcounts_->assign(num_blocks, 0);
+	(*block_refcounts_)[0] = 1;
+	for (size_t pool_index = 0; pool_index < octree_pool_->size(); pool_index++)
+	{
+		if ((*octree_pool_)[pool_index].indirection != 0)
+		{
+			(*block_refcounts_)[(*octree_pool_)[pool_index].indirection]++;
+		}
+	}
+	pool_freelist_->clear();
+	pool_freelist_->setRange(0, num_blocks, true);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the octree with a raw pool of <num_nodes> nodes, such as
+ * one saved by OctreeFile. The pool must hold only reachable blocks.
+ * Unless <may_share_blocks> (see deduplicate()), each block must be
+ * reached exactly once from the root; either way a block that leads
+ * back to itself is rejected, so a corrupt pool can't send the
+ * traversals into a loop.
+\* ---------------------------------------------------------------- */
+void Octree::loadPool(int num_layers, const OctreeNode *nodes, size_t num_nodes, bool may_share_blocks)
+{
+	if (num_nodes < 8 || (num_nodes & 7) != 0)
+	{
+		throw std::runtime_error("loadPool(): pool size must be a nonzero multiple of 8!");
+	}
+	if (num_nodes > max_pool_bytes_/sizeof(OctreeNode))
+	{
+		throw std::runtime_error("loadPool(): pool is bigger than the space reserved for it!");
+	}
+	size_t num_blocks = num_nodes >> 3;
+	for (size_t pool_index = 0; pool_index < num_nodes; pool_index++)
+	{
+		if (nodes[pool_index].indirection >= num_blocks)
+		{
+			throw std::runtime_error("loadPool(): pool contains an out of range indirection!");
+		}
+	}
+
+	// depth-first from the root, keeping the blocks on the current path
+	// apart from those whose subtrees are finished
+	enum BlockState : uint8_t { UNVISITED, ON_PATH, FINISHED };
+	std::vector<BlockState> block_states(num_blocks, UNVISITED);
+	std::vector<std::pair<IndirectionElement, int>> path(1, {0, 0});
+	block_states[0] = ON_PATH;
+	while (!path.empty())
+	{
+		IndirectionElement block = path.back().first;
+		int child = path.back().second++;
+		if (child == 8)
+		{
+			block_states[block] = FINISHED;
+			path.pop_back();
+			continue;
+		}
+		IndirectionElement indirection = nodes[(block << 3) | child].indirection;
+		if (indirection == 0)
+		{
+			continue;
+		}
+		if (block_states[indirection] == ON_PATH)
+		{
+			throw std::runtime_error("loadPool(): pool contains a cycle!");
+		}
+		if (block_states[indirection] == FINISHED)
+		{
+			if (!may_share_blocks)
+			{
+				throw std::runtime_error("loadPool(): pool reaches a block more than once!");
+			}
+			continue;
+		}
+		block_states[indirection] = ON_PATH;
+		path.push_back({indirection, 0});
+	}
+
+	clear();
+	layer_ = num_layers;
+	octree_pool_->resize(num_nodes);
+	memcpy(octree_pool_->data(), nodes, num_nodes*sizeof(OctreeNode));
+	recountReferences();
+	markAllDirty();
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Append this octree's blocks to <pool>, contiguous and with their
+ * indirections rebased to where they land, for tables that keep
+ * several models in one buffer. Returns the block index of the root.
+\* ---------------------------------------------------------------- */
+uint32_t Octree::appendPoolTo(std::vector<OctreeNode> &pool)
+{
+	// a copy shares the pool, so exporting it lays out just this
+	// octree's blocks, contiguous and rooted at block 0
+	Octree copy(*this);
+	const OctreeNode *nodes = copy.data();
+	size_t num_nodes = copy.size();
+	uint32_t base = pool.size() >> 3;
+	pool.reserve(pool.size() + num_nodes);
+	for (size_t pool_index = 0; pool_index < num_nodes; pool_index++)
+	{
+		OctreeNode node = nodes[pool_index];
+		if (node.indirection != 0)
+			node.indirection += base;
+		pool.push_back(node);
+	}
+	return base;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Bring the freelist and reference counts in line after the pool
+ * has been filled in directly (ex. read back from the GPU). The
+ * pool is assumed to be a plain tree with no unused blocks.
+\* ---------------------------------------------------------------- */
+void Octree::resetPoolMetadata()
+{
+	pool_version_++;
+	size_t num_blocks = octree_pool_->size() >> 3;
+	block_refcounts_->assign(num_blocks, 1);
+	pool_freelist_->clear();
+	pool_freelist_->setRange(0, num_blocks, true);
+	markAllDirty();
+	return;
+}
+
+
+void Octree::mergeOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z)
+{
+	other->mergeIntoOctree(this, x, y, z);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Copy the node at <layer> containing voxel (x, y, z) into
+ * <destination>, which becomes a standalone octree with <layer>
+ * layers (the node's subtree, rooted at block 0). Blocks shared
+ * within the subtree stay shared in the copy.
+\* ---------------------------------------------------------------- */
+void Octree::extractSubtree(uint32_t x, uint32_t y, uint32_t z, int layer, Octree *destination)
+{
+	if (destination == this)
+	{
+		throw std::runtime_error("extractSubtree(): can't extract into the same octree!");
+	}
+	std::vector<OctreeNode> pool;
+	extractSubtree(x, y, z, layer, pool);
+	return destination->loadPool(layer, pool.data(), pool.size(), true);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * As above, but into a raw pool (see loadPool()), for copies that
+ * are kept around without being used as octrees
+\* ---------------------------------------------------------------- */
+void Octree::extractSubtree(uint32_t x, uint32_t y, uint32_t z, int layer, std::vector<OctreeNode> &pool)
+{
+	if (layer < 1 || layer > layer_)
+	{
+		throw std::runtime_error("extractSubtree(): layer must be between 1 and the octree's number of layers!");
+	}
+	OctreeNode node = {root_, 0};
+	for (int child_layer = layer_-1; child_layer >= layer; child_layer--)
+	{
+		IndirectionElement child = ((x >> child_layer) & 1u) | (((y >> child_layer) & 1u) << 1) | (((z >> child_layer) & 1u) << 2);
+		node = (*octree_pool_)[(node.indirection << 3) | child];
+		if (node.indirection == 0)
+		{
+			break;
+		}
+	}
+
+	bool is_root = (layer == layer_);
+	if (!is_root && node.indirection == 0)
+	{
+		pool.assign(8, {0, node.voxel_type});
+		return;
+	}
+	pool.clear();
+	std::unordered_map<IndirectionElement, IndirectionElement> new_indirections;
+	std::vector<IndirectionElement> stack; // blocks copied, but whose children aren't yet
+	pool.insert(pool.end(), octree_pool_->data() + (node.indirection << 3), octree_pool_->data() + (node.indirection << 3) + 8);
+	new_indirections[node.indirection] = 0;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		IndirectionElement new_block = stack.back();
+		stack.pop_back();
+		for (int child = 0; child < 8; child++)
+		{
+			IndirectionElement old_indirection = pool[(new_block << 3) | child].indirection;
+			if (old_indirection == 0)
+			{
+				continue;
+			}
+			auto inserted = new_indirections.emplace(old_indirection, pool.size() >> 3);
+			if (inserted.second)
+			{
+				pool.insert(pool.end(), octree_pool_->data() + (old_indirection << 3), octree_pool_->data() + (old_indirection << 3) + 8);
+				stack.push_back(inserted.first->second);
+			}
+			pool[(new_block << 3) | child].indirection = inserted.first->second;
+		}
+	}
+	return;
+}
+
+
+void Octree::mergeIntoOctreeRecursive(Octree *other, IndirectionElement indirection, int layer, uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t quarter_axis_size;
+	uint32_t adder;
+	uint32_t subtracter;
 	uint32_t upper_end_adder;
 	uint32_t lower_end_subtracter;
 	if (layer == 1)
 	{
-		quarter_axis_size = 0;
-		adder = 0;
-		subtracter = 1;
-		upper_end_adder = 0;
-		lower_end_subtracter = 1;
+		quarter_axis_size = 0;
+		adder = 0;
+		subtracter = 1;
+		upper_end_adder = 0;
+		lower_end_subtracter = 1;
+	}
+	else
+	{
+		quarter_axis_size = (1u << (layer-2));
+		adder = quarter_axis_size;
+		subtracter = quarter_axis_size;
+		upper_end_adder = (1u << (layer-1))-1;
+		lower_end_subtracter = (1u << (layer-1));
+	}
+
+	IndirectionElement pool_base_index = indirection << 3;
+	for (int child = 0; child < 8; child++)
+	{
+		if ((*octree_pool_)[pool_base_index+child].indirection == 0)
+		{
+			uint32_t x_min = (child & 1u) ? (x) : (x - lower_end_subtracter);
+			uint32_t x_max = (child & 1u) ? (x + upper_end_adder) : (x);
+			uint32_t y_min = (child & 2u) ? (y) : (y - lower_end_subtracter);
+			uint32_t y_max = (child & 2u) ? (y + upper_end_adder) : (y);
+			uint32_t z_min = (child & 4u) ? (z) : (z - lower_end_subtracter);
+			uint32_t z_max = (child & 4u) ? (z + upper_end_adder) : (z);
+			other->fillBox(x_min, y_min, z_min,
+					x_max, y_max, z_max,
+					(*octree_pool_)[pool_base_index+child].voxel_type);
+		}
+		else
+		{
+			uint32_t child_x, child_y, child_z;
+			if (child & 1u)
+				child_x = x + adder;
+			else
+				child_x = x - subtracter;
+			if (child & 2u)
+				child_y = y + adder;
+			else
+				child_y = y - subtracter;
+			if (child & 4u)
+				child_z = z + adder;
+			else
+				child_z = z - subtracter;
+			mergeIntoOctreeRecursive(other, (*octree_pool_)[pool_base_index+child].indirection, layer-1, child_x, child_y, child_z);
+		}
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Write this octree into <other>, centered on (x, y, z). Every voxel
+ * in the covered region is overwritten, air included.
+ *
+ * If the region fits inside <other>, the subtrees at the largest
+ * node size the region's corner is aligned to are grafted into
+ * <other> as-is (see graftIntoOctree()). Otherwise every leaf is
+ * written individually as a box. Grafting wins even at single voxel
+ * alignment, since only the subtrees are walked and not the boxes.
+\* ---------------------------------------------------------------- */
+void Octree::mergeIntoOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t half_size = 1u << (layer_-1);
+	if (layer_ < other->layer_ && x >= half_size && y >= half_size && z >= half_size)
+	{
+		uint32_t x_min = x - half_size;
+		uint32_t y_min = y - half_size;
+		uint32_t z_min = z - half_size;
+		uint32_t max_coordinate = (1u << other->layer_) - (1u << layer_);
+		uint32_t corner_bits = x_min | y_min | z_min;
+		int graft_layer = (corner_bits == 0) ? layer_ : std::min(__builtin_ctz(corner_bits), layer_);
+		if (x_min <= max_coordinate && y_min <= max_coordinate && z_min <= max_coordinate)
+		{
+			return graftIntoOctree(other, x_min, y_min, z_min, graft_layer);
+		}
+	}
+	return mergeIntoOctreeRecursive(other, root_, layer_, x, y, z);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Copy this octree's blocks into <other> with their corner at
+ * (x_min, y_min, z_min), which must be aligned to the size of nodes
+ * at <graft_layer>.
+ *
+ * The whole pool is copied into a contiguous range of <other>'s pool
+ * in one pass, adding the range's start to every indirection. Each
+ * node at <graft_layer> then has the copy of its subtree hooked into
+ * the matching node of <other>. The copies of the blocks above
+ * <graft_layer> are freed again.
+\* ---------------------------------------------------------------- */
+void Octree::graftIntoOctree(Octree *other, uint32_t x_min, uint32_t y_min, uint32_t z_min, int graft_layer)
+{
+	other->pool_version_++;
+	// make sure this pool holds only this octree's blocks, rooted at block 0
+	const OctreeNode *source_pool = data();
+	size_t num_blocks = octree_pool_->size() >> 3;
+	IndirectionElement base = other->allocBlockRange(num_blocks);
+	OctreeNode *destination_pool = &(*other->octree_pool_)[base << 3];
+	for (size_t pool_index = 0; pool_index < (num_blocks << 3); pool_index++)
+	{
+		OctreeNode node = source_pool[pool_index];
+		if (node.indirection != 0)
+			node.indirection += base;
+		destination_pool[pool_index] = node;
+	}
+	memcpy(&(*other->block_refcounts_)[base], block_refcounts_->data(), num_blocks*sizeof(uint32_t));
+	for (size_t block = 1; block < num_blocks; block++)
+	{
+		if (!pool_freelist_->isTaken(block))
+		{
+			other->freeBlock(base+block);
+		}
+	}
+
+	struct PendingNode
+	{
+		OctreeNode node;
+		int layer;
+		uint32_t x, y, z; // corner of the node
+	};
+	std::vector<PendingNode> stack;
+	stack.push_back({{base, calculateMaterialTypeFromChildren(source_pool)}, layer_, x_min, y_min, z_min});
+	while (!stack.empty())
+	{
+		PendingNode pending = stack.back();
+		stack.pop_back();
+		if (pending.layer == graft_layer)
+		{
+			other->graftNode(pending.x >> graft_layer, pending.y >> graft_layer,
+					pending.z >> graft_layer, graft_layer, pending.node);
+			continue;
+		}
+		uint32_t size = 1u << pending.layer;
+		if (pending.node.indirection == 0)
+		{
+			// leaf above the graft layer, not aligned to its own size
+			other->fillBox(pending.x, pending.y, pending.z,
+					pending.x + size - 1, pending.y + size - 1, pending.z + size - 1,
+					pending.node.voxel_type);
+			continue;
+		}
+		uint32_t half_size = size >> 1;
+		for (int child = 0; child < 8; child++)
+		{
+			stack.push_back({
+					(*other->octree_pool_)[(pending.node.indirection << 3)+child],
+					pending.layer-1,
+					pending.x + ((child & 1) ? half_size : 0),
+					pending.y + ((child & 2) ? half_size : 0),
+					pending.z + ((child & 4) ? half_size : 0)});
+		}
+	}
+	// grafted subtrees hold their own references, so this only frees the blocks above them
+	other->freeSubtree(base);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Replace the node at <layer> containing (x, y, z) with <node>. If
+ * <node> has children, they must already be in this pool; they gain
+ * a reference.
+\* ---------------------------------------------------------------- */
+void Octree::graftNode(uint32_t x, uint32_t y, uint32_t z, int layer, OctreeNode node)
+{
+	if (node.indirection == 0)
+	{
+		return setVoxelAtLayer(x, y, z, node.voxel_type, layer);
+	}
+	(*block_refcounts_)[node.indirection]++;
+	IndirectionElement pool_index;
+	std::vector<IndirectionElement> path;
+	descendForWrite(x, y, z, layer, nullptr, &pool_index, path);
+	if ((*octree_pool_)[pool_index].indirection != 0)
+	{
+		freeSubtree((*octree_pool_)[pool_index].indirection);
+	}
+	(*octree_pool_)[pool_index] = node;
+	simpleMerge(path);
+	return;
+}
+
+
+void Octree::convertToUnsignedLoc(int layer, int32_t x, int32_t y, int32_t z, uint32_t *ux, uint32_t *uy, uint32_t *uz)
+{
+	uint32_t half_max = 0x1u << (layer-1);
+	*ux = (x <= 0) ? (half_max - abs(x)) : (half_max + x);
+	*uy = (y <= 0) ? (half_max - abs(y)) : (half_max + y);
+	*uz = (z <= 0) ? (half_max - abs(z)) : (half_max + z);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Set every voxel in a box (bounds inclusive) to <voxel_type>. The
+ * octree is walked top-down once: nodes entirely inside the box
+ * become leaves, nodes entirely outside are skipped, and only nodes
+ * on the box's surface are split and descended into. On the way back
+ * up, split nodes are merged if they turned out uniform, or get
+ * their LOD material updated otherwise.
+\* ---------------------------------------------------------------- */
+void Octree::fillBox(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+		uint32_t x_max, uint32_t y_max, uint32_t z_max,
+		VoxelTypeElement voxel_type)
+{
+	if (x_min > x_max || y_min > y_max || z_min > z_max)
+	{
+		throw std::runtime_error("fillBox(): bounding box min must be less than or equal to bounding box max!");
+	}
+	uint32_t max_coordinate = (layer_ >= 32) ? 0xFFFFFFFFu : ((1u << layer_) - 1);
+	if (x_max > max_coordinate || y_max > max_coordinate || z_max > max_coordinate)
+	{
+		throw std::runtime_error("fillBox(): bounding box must be within the octree!");
+	}
+	pool_version_++;
+	if ((*block_refcounts_)[root_] > 1)
+	{
+		root_ = cloneBlock(root_);
+	}
+
+	struct Frame
+	{
+		IndirectionElement pool_index;
+		int layer;
+		uint32_t x, y, z; // corner of the node
+		bool children_done;
+	};
+	std::vector<Frame> stack;
+	for (int child = 7; child >= 0; child--)
+	{
+		uint32_t half_size = 1u << (layer_-1);
+		stack.push_back({(root_ << 3) | child, layer_-1,
+				(child & 1) ? half_size : 0,
+				(child & 2) ? half_size : 0,
+				(child & 4) ? half_size : 0,
+				false});
+	}
+	while (!stack.empty())
+	{
+		Frame frame = stack.back();
+		stack.pop_back();
+		OctreeNode &node = (*octree_pool_)[frame.pool_index];
+		if (frame.children_done)
+		{
+			OctreeNode *children = &(*octree_pool_)[node.indirection << 3];
+			if (isUniformBlock(children))
+			{
+				IndirectionElement indirection = node.indirection;
+				node.voxel_type = children[0].voxel_type;
+				node.indirection = 0;
+				freeSubtree(indirection);
+			}
+			else
+			{
+				node.voxel_type = calculateMaterialTypeFromChildren(children);
+			}
+			continue;
+		}
+
+		uint32_t node_max = (1u << frame.layer) - 1;
+		if (frame.x > x_max || frame.x + node_max < x_min ||
+		    frame.y > y_max || frame.y + node_max < y_min ||
+		    frame.z > z_max || frame.z + node_max < z_min)
+		{
+			// outside of the box
+			continue;
+		}
+		markDirty(frame.pool_index >> 3);
+		if (frame.x >= x_min && frame.x + node_max <= x_max &&
+		    frame.y >= y_min && frame.y + node_max <= y_max &&
+		    frame.z >= z_min && frame.z + node_max <= z_max)
+		{
+			// entirely inside of the box
+			if (node.indirection != 0)
+			{
+				freeSubtree(node.indirection);
+				node.indirection = 0;
+			}
+			node.voxel_type = voxel_type;
+			continue;
+		}
+
+		// on the surface of the box (never layer 0, since a voxel is either in or out)
+		IndirectionElement indirection = node.indirection;
+		if (indirection == 0)
+		{
+			VoxelTypeElement old_voxel_type = node.voxel_type;
+			if (old_voxel_type == voxel_type)
+			{
+				continue;
+			}
+			indirection = allocBlock();
+			for (int child = 0; child < 8; child++)
+			{
+				(*octree_pool_)[(indirection << 3)+child].indirection = 0;
+				(*octree_pool_)[(indirection << 3)+child].voxel_type = old_voxel_type;
+			}
+			node.indirection = indirection;
+		}
+		else if ((*block_refcounts_)[indirection] > 1)
+		{
+			indirection = cloneBlock(indirection);
+			(*octree_pool_)[frame.pool_index].indirection = indirection;
+		}
+		frame.children_done = true;
+		stack.push_back(frame);
+		uint32_t half_size = 1u << (frame.layer-1);
+		for (int child = 7; child >= 0; child--)
+		{
+			stack.push_back({(indirection << 3) | child, frame.layer-1,
+					frame.x + ((child & 1) ? half_size : 0),
+					frame.y + ((child & 2) ? half_size : 0),
+					frame.z + ((child & 4) ? half_size : 0),
+					false});
+		}
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The nodes of another octree overlapping one node of this octree,
+ * for applyCsg(). The other octree's nodes at <layer> form a grid
+ * starting at its corner (<offset>), so an unaligned node of this
+ * octree overlaps up to 2x2x2 of them. cells[dx | dy << 1 | dz << 2]
+ * is grid cell first_cell + (dx, dy, dz). Along an axis where the two
+ * grids line up, the node overlaps only one cell, which fills both
+ * slots.
+ *
+ * Above the other octree's root layer, the cell at (0, 0, 0) holds
+ * the whole other octree (in its low corner) and every other cell is
+ * outside of it, which counts as air.
+\* ---------------------------------------------------------------- */
+struct Octree::CsgWindow
+{
+	enum CellKind : uint8_t
+	{
+		OUTSIDE,
+		LEAF,
+		BRANCH, // has children in the other octree
+		ABOVE_ROOT
+	};
+	struct Cell
+	{
+		OctreeNode node;
+		CellKind kind;
+	};
+
+	const Octree *other;
+	int64_t offset[3];
+	int layer;
+	int64_t first_cell[3];
+	bool is_aligned; // to the other octree's nodes, so all cells are the same one
+	Cell cells[8];
+
+	CsgWindow(const Octree *other_octree, uint32_t x_min, uint32_t y_min, uint32_t z_min, int root_layer)
+	{
+		other = other_octree;
+		offset[0] = x_min;
+		offset[1] = y_min;
+		offset[2] = z_min;
+		layer = root_layer;
+		int64_t cell_index[8][3];
+		locateCells(0, 0, 0, cell_index);
+		for (int slot = 0; slot < 8; slot++)
+		{
+			bool is_first_cell = (cell_index[slot][0] == 0 && cell_index[slot][1] == 0 && cell_index[slot][2] == 0);
+			cells[slot] = is_first_cell ? cellAboveRoot() : Cell{{0, 0}, OUTSIDE};
+		}
+		return;
+	}
+
+	// the cell at (0, 0, 0), at or above the other octree's root layer
+	Cell cellAboveRoot()
+	{
+		if (layer == other->layer_)
+		{
+			return {{other->root_, 0}, BRANCH};
+		}
+		return {{0, 0}, ABOVE_ROOT};
 	}
-	else
+
+	// find the cells overlapping the node at layer <layer> with corner (x, y, z)
+	void locateCells(uint32_t x, uint32_t y, uint32_t z, int64_t cell_index[8][3])
 	{
-		quarter_axis_size = (1u << (layer-2));
-		adder = quarter_axis_size;
-		subtracter = quarter_axis_size;
-		upper_end_adder = (1u << (layer-1))-1;
-		lower_end_subtracter = (1u << (layer-1));
+		const uint32_t corner[3] = {x, y, z};
+		bool is_axis_aligned[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int64_t relative = static_cast<int64_t>(corner[axis]) - offset[axis];
+			first_cell[axis] = relative >> layer; // rounds down, also when negative
+			is_axis_aligned[axis] = (relative & ((int64_t(1) << layer) - 1)) == 0;
+		}
+		is_aligned = is_axis_aligned[0] && is_axis_aligned[1] && is_axis_aligned[2];
+		for (int slot = 0; slot < 8; slot++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int step = (slot >> axis) & 1;
+				cell_index[slot][axis] = first_cell[axis] + (is_axis_aligned[axis] ? 0 : step);
+			}
+		}
+		return;
 	}
 
-	IndirectionElement pool_base_index = indirection << 3;
-	for (int child = 0; child < 8; child++)
+	// the window for child <child> of the node this window is for
+	CsgWindow child(uint32_t child_x, uint32_t child_y, uint32_t child_z) const
 	{
-		if ((*octree_pool_)[pool_base_index+child].indirection == 0)
+		CsgWindow child_window = *this;
+		child_window.layer = layer-1;
+		int64_t cell_index[8][3];
+		child_window.locateCells(child_x, child_y, child_z, cell_index);
+		for (int slot = 0; slot < 8; slot++)
 		{
-			uint32_t x_min = (child & 1u) ? (x) : (x - lower_end_subtracter);
-			uint32_t x_max = (child & 1u) ? (x + upper_end_adder) : (x);
-			uint32_t y_min = (child & 2u) ? (y) : (y - lower_end_subtracter);
-			uint32_t y_max = (child & 2u) ? (y + upper_end_adder) : (y);
-			uint32_t z_min = (child & 4u) ? (z) : (z - lower_end_subtracter);
-			uint32_t z_max = (child & 4u) ? (z + upper_end_adder) : (z);
-			other->setVoxelTypeWithinBounds((*octree_pool_)[pool_base_index+child].voxel_type,
-					x_min, y_min, z_min,
-					x_max, y_max, z_max
-					);
+			int parent_slot = 0;
+			int child_in_parent = 0;
+			bool is_first_cell = true;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				parent_slot |= static_cast<int>((cell_index[slot][axis] >> 1) - first_cell[axis]) << axis;
+				child_in_parent |= static_cast<int>(cell_index[slot][axis] & 1) << axis;
+				is_first_cell = is_first_cell && (cell_index[slot][axis] == 0);
+			}
+			const Cell &parent = cells[parent_slot];
+			Cell &cell = child_window.cells[slot];
+			switch (parent.kind)
+			{
+				case OUTSIDE:
+				case LEAF:
+					cell = parent;
+					break;
+				case ABOVE_ROOT:
+					cell = is_first_cell ? child_window.cellAboveRoot() : Cell{{0, 0}, OUTSIDE};
+					break;
+				case BRANCH:
+					cell.node = (*other->octree_pool_)[(parent.node.indirection << 3) | child_in_parent];
+					cell.kind = (cell.node.indirection != 0) ? BRANCH : LEAF;
+					break;
+			}
 		}
-		else
+		return child_window;
+	}
+
+	// whether every overlapping voxel of the other octree has the same type
+	bool isUniform(VoxelTypeElement *voxel_type) const
+	{
+		VoxelTypeElement first_voxel_type = 0;
+		for (int slot = 0; slot < 8; slot++)
 		{
-			uint32_t child_x, child_y, child_z;
-			if (child & 1u)
-				child_x = x + adder;
-			else
-				child_x = x - subtracter;
-			if (child & 2u)
-				child_y = y + adder;
-			else
-				child_y = y - subtracter;
-			if (child & 4u)
-				child_z = z + adder;
-			else
-				child_z = z - subtracter;
-			mergeIntoOctreeRecursive(other, (*octree_pool_)[pool_base_index+child].indirection, layer-1, child_x, child_y, child_z);
+			if (cells[slot].kind == BRANCH || cells[slot].kind == ABOVE_ROOT)
+			{
+				return false;
+			}
+			VoxelTypeElement cell_voxel_type = (cells[slot].kind == LEAF) ? cells[slot].node.voxel_type : 0;
+			if (slot == 0)
+			{
+				first_voxel_type = cell_voxel_type;
+			}
+			else if (cell_voxel_type != first_voxel_type)
+			{
+				return false;
+			}
 		}
+		*voxel_type = first_voxel_type;
+		return true;
 	}
-	return;
-}
+
+	// whether the other octree has a node with children exactly covering this one
+	bool isAlignedBranch(OctreeNode *node) const
+	{
+		if (!is_aligned || cells[0].kind != BRANCH)
+		{
+			return false;
+		}
+		*node = cells[0].node;
+		return true;
+	}
+};
 
 
-void Octree::mergeIntoOctree(Octree *other, uint32_t x, uint32_t y, uint32_t z)
+VoxelTypeElement Octree::applyCsgToVoxel(CsgOperation operation,
+		VoxelTypeElement voxel_type, VoxelTypeElement other_voxel_type)
 {
-	/*
-	other->copy(this);
-	return;
-	other->octree_pool_->resize(octree_pool_->size());
-	memcpy(other->octree_pool_->data(), octree_pool_->data(), octree_pool_->size()*sizeof(OctreeNode));
-	return;
-	*/
-	return mergeIntoOctreeRecursive(other, 0, layer_, x, y, z);
+	switch (operation)
+	{
+		case CsgOperation::UNION:
+			return (other_voxel_type != 0) ? other_voxel_type : voxel_type;
+		case CsgOperation::SUBTRACT:
+			return (other_voxel_type != 0) ? 0 : voxel_type;
+		case CsgOperation::INTERSECT:
+			return (other_voxel_type != 0) ? voxel_type : 0;
+		case CsgOperation::REPLACE:
+			return (other_voxel_type != 0 && voxel_type != 0) ? other_voxel_type : voxel_type;
+	}
+	return voxel_type;
 }
 
 
-void Octree::convertToUnsignedLoc(int layer, int32_t x, int32_t y, int32_t z, uint32_t *ux, uint32_t *uy, uint32_t *uz)
+/* ---------------------------------------------------------------- *\
+ * Combine another octree into this one, voxel by voxel, with the
+ * other octree's corner at (x_min, y_min, z_min). The corner doesn't
+ * need to be aligned to anything.
+ *
+ * Both octrees are walked together, and a node is only descended
+ * into where the other octree isn't uniform over it (or, for this
+ * octree's leaves, where the result could differ across the leaf).
+ * So the cost follows the other octree's surface and this octree's
+ * detail inside of it, not the volume covered. INTERSECT clears
+ * everything outside of the other octree, which is cheap since that
+ * region is uniform air.
+\* ---------------------------------------------------------------- */
+void Octree::applyCsg(CsgOperation operation, const Octree *other,
+		uint32_t x_min, uint32_t y_min, uint32_t z_min)
 {
-	uint32_t half_max = 0x1u << (layer-1);
-	*ux = (x <= 0) ? (half_max - abs(x)) : (half_max + x);
-	*uy = (y <= 0) ? (half_max - abs(y)) : (half_max + y);
-	*uz = (z <= 0) ? (half_max - abs(z)) : (half_max + z);
+	if (other == this)
+	{
+		throw std::runtime_error("applyCsg(): an octree can't be combined with itself!");
+	}
+	uint64_t size = uint64_t(1) << layer_;
+	uint64_t other_size = uint64_t(1) << other->layer_;
+	if (x_min + other_size > size || y_min + other_size > size || z_min + other_size > size)
+	{
+		throw std::runtime_error("applyCsg(): other octree must be within the octree!");
+	}
+	pool_version_++;
+	if ((*block_refcounts_)[root_] > 1)
+	{
+		root_ = cloneBlock(root_);
+	}
+	markDirty(root_);
+	CsgWindow window(other, x_min, y_min, z_min, layer_);
+	uint32_t half_size = 1u << (layer_-1);
+	for (int child = 0; child < 8; child++)
+	{
+		uint32_t x = (child & 1) ? half_size : 0;
+		uint32_t y = (child & 2) ? half_size : 0;
+		uint32_t z = (child & 4) ? half_size : 0;
+		applyCsgToNode(operation, (root_ << 3) | child, layer_-1, x, y, z, window.child(x, y, z));
+	}
 	return;
 }
 
 
-/* ---------------------------------------------------------------- *\
- * inclusive
-\* ---------------------------------------------------------------- */
-void Octree::setVoxelTypeWithinBounds(VoxelTypeElement voxel_type,
-		uint32_t x_min,
-		uint32_t y_min,
-		uint32_t z_min,
-		uint32_t x_max,
-		uint32_t y_max,
-		uint32_t z_max
-		)
+void Octree::applyCsgToNode(CsgOperation operation, IndirectionElement pool_index, int layer,
+		uint32_t x, uint32_t y, uint32_t z, const CsgWindow &window)
 {
-	/*
-	for (int curr_x = x_min; curr_x <= x_max; curr_x++)
+	OctreeNode node = (*octree_pool_)[pool_index];
+	VoxelTypeElement other_voxel_type;
+	bool is_other_uniform = window.isUniform(&other_voxel_type);
+	if (is_other_uniform)
 	{
-		for (int curr_y = y_min; curr_y <= y_max; curr_y++)
+		VoxelTypeElement voxel_type = applyCsgToVoxel(operation, node.voxel_type, other_voxel_type);
+		if (node.indirection == 0)
 		{
-			for (int curr_z = z_min; curr_z <= z_max; curr_z++)
+			if (voxel_type != node.voxel_type)
 			{
-				//std::cout << curr_x << "|" << curr_y << "|" << curr_z << std::endl;
-				setVoxel(curr_x, curr_y, curr_z, voxel_type);
+				(*octree_pool_)[pool_index].voxel_type = voxel_type;
+				markDirty(pool_index >> 3);
 			}
+			return;
+		}
+		bool is_unchanged = (operation == CsgOperation::INTERSECT) ? (other_voxel_type != 0) : (other_voxel_type == 0);
+		if (is_unchanged)
+		{
+			return;
+		}
+		if (operation != CsgOperation::REPLACE)
+		{
+			// the whole node ends up as one type
+			(*octree_pool_)[pool_index] = {0, voxel_type};
+			freeSubtree(node.indirection);
+			markDirty(pool_index >> 3);
+			return;
 		}
+		// only the solid voxels underneath get replaced, so keep going
 	}
-	return;
-	*/
-	if (x_min > x_max || y_min > y_max || z_min > z_max)
+	else if (node.indirection == 0 && node.voxel_type == 0 && operation != CsgOperation::UNION)
 	{
-		throw std::runtime_error("setVoxelTypeWithinBounds(): bounding box min \
-				must be less than or equal to bounding box max!");
-	}
-
-	// find the bounding box for the largest possible nearby octree node
-	uint32_t x_size = x_max - x_min + 1;
-	uint32_t y_size = y_max - y_min + 1;
-	uint32_t z_size = z_max - z_min + 1;
-	uint32_t octree_node_size = min(x_size, min(y_size, z_size));
-	int highest_layer = Anthrax::log2(octree_node_size);
-	octree_node_size = 0x1u << highest_layer;
-	uint32_t new_x_min = roundUpToInterval(x_min, octree_node_size);
-	uint32_t new_y_min = roundUpToInterval(y_min, octree_node_size);
-	uint32_t new_z_min = roundUpToInterval(z_min, octree_node_size);
-	uint32_t new_x_max = new_x_min + octree_node_size - 1;
-	uint32_t new_y_max = new_y_min + octree_node_size - 1;
-	uint32_t new_z_max = new_z_min + octree_node_size - 1;
-
-	// check if this box matches the largest possible nearby octree node
-	if (new_x_min == x_min && new_x_max == x_max &&
-			new_y_min == y_min && new_y_max == y_max &&
-			new_z_min == z_min && new_z_max == z_max)
-	{
-		/*
-		// bit shifts may be implementation specific for negative numbers?
-		//setVoxelAtLayer(new_x_min >> highest_layer, new_y_min >> highest_layer,
-		//		new_z_min >> highest_layer, voxel_type, highest_layer);
-		uint32_t factor = 1;
-		for (int i = 0; i < highest_layer; i++) factor *= 2;
-		setVoxelAtLayer(new_x_min/factor, new_y_min/factor, new_z_min/factor,
-				voxel_type, highest_layer);
-		*/
-		setVoxelAtLayer(new_x_min >> highest_layer, new_y_min >> highest_layer, new_z_min >> highest_layer, voxel_type, highest_layer);
+		// air stays air
 		return;
 	}
 
-	// go down another layer if we have to (if the boundaries of the currently
-	// selected node exceed those of the specified box)
-	if (new_x_max > x_max ||
-			new_y_max > y_max ||
-			new_z_max > z_max)
+	OctreeNode other_node;
+	if (node.indirection == 0 && window.isAlignedBranch(&other_node))
 	{
-		highest_layer--;
-		octree_node_size = 0x1u << highest_layer;
-		new_x_min = roundUpToInterval(x_min, octree_node_size);
-		new_y_min = roundUpToInterval(y_min, octree_node_size);
-		new_z_min = roundUpToInterval(z_min, octree_node_size);
-		new_x_max = new_x_min + octree_node_size - 1;
-		new_y_max = new_y_min + octree_node_size - 1;
-		new_z_max = new_z_min + octree_node_size - 1;
+		// every voxel of the result depends only on the other octree's
+		// voxel there, so its subtree can be copied over as it is
+		(*octree_pool_)[pool_index] = copyCsgSubtree(operation, node.voxel_type, window.other, other_node.indirection);
+		markDirty(pool_index >> 3);
+		return;
 	}
 
-	// calculate x separators
-	std::vector<uint32_t> x_min_separators, x_max_separators;
-	if (x_min != new_x_min)
+	IndirectionElement indirection = node.indirection;
+	if (indirection == 0)
 	{
-		x_min_separators.push_back(x_min);
-		x_max_separators.push_back(new_x_min-1);
+		indirection = allocBlock();
+		for (int child = 0; child < 8; child++)
+		{
+			(*octree_pool_)[(indirection << 3)+child] = {0, node.voxel_type};
+		}
+		(*octree_pool_)[pool_index].indirection = indirection;
 	}
-	for (uint32_t i = 1; i*octree_node_size <= x_max - new_x_min + 1; i++)
+	else if ((*block_refcounts_)[indirection] > 1)
 	{
-		if (x_min_separators.size() == 0)
-			x_min_separators.push_back(x_min);
-		else
-			x_min_separators.push_back(x_max_separators.back()+1);
-		x_max_separators.push_back(x_min_separators.back() + octree_node_size - 1);
+		indirection = cloneBlock(indirection);
+		(*octree_pool_)[pool_index].indirection = indirection;
 	}
-	if (x_max_separators.back() != x_max)
+	uint32_t half_size = 1u << (layer-1);
+	for (int child = 0; child < 8; child++)
 	{
-		x_min_separators.push_back(x_max_separators.back()+1);
-		x_max_separators.push_back(x_max);
+		uint32_t child_x = x + ((child & 1) ? half_size : 0);
+		uint32_t child_y = y + ((child & 2) ? half_size : 0);
+		uint32_t child_z = z + ((child & 4) ? half_size : 0);
+		applyCsgToNode(operation, (indirection << 3) | child, layer-1,
+				child_x, child_y, child_z, window.child(child_x, child_y, child_z));
 	}
-	// calculate y separators
-	std::vector<uint32_t> y_min_separators, y_max_separators;
-	if (y_min != new_y_min)
+
+	OctreeNode *children = &(*octree_pool_)[indirection << 3];
+	if (isUniformBlock(children))
 	{
-		y_min_separators.push_back(y_min);
-		y_max_separators.push_back(new_y_min-1);
+		(*octree_pool_)[pool_index] = {0, children[0].voxel_type};
+		freeSubtree(indirection);
 	}
-	for (uint32_t i = 1; i*octree_node_size <= y_max - new_y_min + 1; i++)
+	else
 	{
-		if (y_min_separators.size() == 0)
-			y_min_separators.push_back(y_min);
-		else
-			y_min_separators.push_back(y_max_separators.back()+1);
-		y_max_separators.push_back(y_min_separators.back() + octree_node_size - 1);
+		(*octree_pool_)[pool_index].voxel_type = calculateMaterialTypeFromChildren(children);
 	}
-	if (y_max_separators.back() != y_max)
+	markDirty(pool_index >> 3);
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * A copy of the other octree's subtree under <other_indirection>,
+ * with each voxel combined with <voxel_type> (a leaf of this octree
+ * covering all of it)
+\* ---------------------------------------------------------------- */
+Octree::OctreeNode Octree::copyCsgSubtree(CsgOperation operation, VoxelTypeElement voxel_type,
+		const Octree *other, IndirectionElement other_indirection)
+{
+	IndirectionElement indirection = allocBlock();
+	for (int child = 0; child < 8; child++)
 	{
-		y_min_separators.push_back(y_max_separators.back()+1);
-		y_max_separators.push_back(y_max);
+		OctreeNode other_child = (*other->octree_pool_)[(other_indirection << 3) | child];
+		(*octree_pool_)[(indirection << 3) | child] = (other_child.indirection == 0)
+			? OctreeNode{0, applyCsgToVoxel(operation, voxel_type, other_child.voxel_type)}
+			: copyCsgSubtree(operation, voxel_type, other, other_child.indirection);
 	}
-	// calculate z separators
-	std::vector<uint32_t> z_min_separators, z_max_separators;
-	if (z_min != new_z_min)
+	OctreeNode *children = &(*octree_pool_)[indirection << 3];
+	if (isUniformBlock(children))
 	{
-		z_min_separators.push_back(z_min);
-		z_max_separators.push_back(new_z_min-1);
+		OctreeNode leaf = {0, children[0].voxel_type};
+		freeBlock(indirection);
+		return leaf;
 	}
-	for (uint32_t i = 1; i*octree_node_size <= z_max - new_z_min + 1; i++)
+	return {indirection, calculateMaterialTypeFromChildren(children)};
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Walk the subtree at <start> depth-first in child order, skipping
+ * nodes outside of the box. <visitor> gets each leaf that overlaps
+ * the box (air leaves only if <include_air>), and each node at
+ * <stop_layer> that has children, which isn't descended into. The
+ * root always has children, even when <root_> is block 0.
+\* ---------------------------------------------------------------- */
+template <class Visitor>
+void Octree::visitSubtree(VisitEntry start, const uint32_t box_min[3], const uint32_t box_max[3],
+		bool include_air, int stop_layer, Visitor &&visitor)
+{
+	const OctreeNode *pool = octree_pool_->data();
+	std::vector<VisitEntry> stack;
+	stack.reserve(7*(start.layer+1));
+	stack.push_back(start);
+	while (!stack.empty())
 	{
-		if (z_min_separators.size() == 0)
-			z_min_separators.push_back(z_min);
-		else
-			z_min_separators.push_back(z_max_separators.back()+1);
-		z_max_separators.push_back(z_min_separators.back() + octree_node_size - 1);
+		VisitEntry entry = stack.back();
+		stack.pop_back();
+		bool has_children = (entry.node.indirection != 0 || entry.layer == layer_);
+		if (!has_children)
+		{
+			if (include_air || entry.node.voxel_type != 0)
+			{
+				visitor(entry);
+			}
+			continue;
+		}
+		if (entry.layer == stop_layer)
+		{
+			visitor(entry);
+			continue;
+		}
+		const OctreeNode *children = &pool[entry.node.indirection << 3];
+		int child_layer = entry.layer-1;
+		uint32_t half_size = 1u << child_layer;
+		uint32_t child_max = half_size - 1;
+		for (int child = 7; child >= 0; child--)
+		{
+			OctreeNode child_node = children[child];
+			if (child_node.indirection == 0 && child_node.voxel_type == 0 && !include_air)
+			{
+				continue;
+			}
+			uint32_t x = entry.x + ((child & 1) ? half_size : 0);
+			uint32_t y = entry.y + ((child & 2) ? half_size : 0);
+			uint32_t z = entry.z + ((child & 4) ? half_size : 0);
+			if (x > box_max[0] || x + child_max < box_min[0] ||
+			    y > box_max[1] || y + child_max < box_min[1] ||
+			    z > box_max[2] || z + child_max < box_min[2])
+			{
+				continue;
+			}
+			stack.push_back({child_node, x, y, z, child_layer});
+		}
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Call <visitor> on every leaf overlapping a box (bounds inclusive),
+ * in morton order. Leaves on the box's surface are reported whole,
+ * so they can extend past it. Air leaves are skipped unless
+ * <include_air> is set. The octree must not be edited from
+ * <visitor>.
+\* ---------------------------------------------------------------- */
+void Octree::visitLeaves(uint32_t x_min, uint32_t y_min, uint32_t z_min,
+		uint32_t x_max, uint32_t y_max, uint32_t z_max,
+		const LeafVisitor &visitor, bool include_air)
+{
+	if (x_min > x_max || y_min > y_max || z_min > z_max)
+	{
+		throw std::runtime_error("visitLeaves(): bounding box min must be less than or equal to bounding box max!");
 	}
-	if (z_max_separators.back() != z_max)
+	const uint32_t box_min[3] = {x_min, y_min, z_min};
+	const uint32_t box_max[3] = {x_max, y_max, z_max};
+	VisitEntry root = {{root_, 0}, 0, 0, 0, layer_};
+	visitSubtree(root, box_min, box_max, include_air, -1,
+		[&visitor](const VisitEntry &entry)
+		{
+			visitor({entry.x, entry.y, entry.z, entry.layer, entry.node.voxel_type});
+		});
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Same as visitLeaves(), but the subtrees <split_levels> layers below
+ * the root are visited as separate jobs on <thread_pool>, so
+ * <visitor> is called concurrently from its workers (and gets the
+ * worker's index) in no particular order. Leaves above that layer
+ * are visited in one more job. Returns once every leaf has been
+ * visited.
+\* ---------------------------------------------------------------- */
+void Octree::parallelVisitLeaves(ThreadPool &thread_pool,
+		uint32_t x_min, uint32_t y_min, uint32_t z_min,
+		uint32_t x_max, uint32_t y_max, uint32_t z_max,
+		const ParallelLeafVisitor &visitor, bool include_air, int split_levels)
+{
+	if (x_min > x_max || y_min > y_max || z_min > z_max)
 	{
-		z_min_separators.push_back(z_max_separators.back()+1);
-		z_max_separators.push_back(z_max);
+		throw std::runtime_error("parallelVisitLeaves(): bounding box min must be less than or equal to bounding box max!");
 	}
+	const uint32_t box_min[3] = {x_min, y_min, z_min};
+	const uint32_t box_max[3] = {x_max, y_max, z_max};
+	int split_layer = std::max(layer_ - split_levels, 0);
+	std::vector<VisitEntry> subtrees;
+	std::vector<Leaf> upper_leaves;
+	VisitEntry root = {{root_, 0}, 0, 0, 0, layer_};
+	visitSubtree(root, box_min, box_max, include_air, split_layer,
+		[&](const VisitEntry &entry)
+		{
+			if (entry.layer == split_layer && (entry.node.indirection != 0 || entry.layer == layer_))
+			{
+				subtrees.push_back(entry);
+			}
+			else
+			{
+				upper_leaves.push_back({entry.x, entry.y, entry.z, entry.layer, entry.node.voxel_type});
+			}
+		});
 
-	// split up the bounding box into smaller boxes
-	for (unsigned int z = 0; z < z_min_separators.size(); z++)
+	for (const VisitEntry &subtree : subtrees)
+	{
+		thread_pool.submit([this, subtree, &box_min, &box_max, include_air, &visitor](unsigned int worker)
+		{
+			visitSubtree(subtree, box_min, box_max, include_air, -1,
+				[&visitor, worker](const VisitEntry &entry)
+				{
+					visitor({entry.x, entry.y, entry.z, entry.layer, entry.node.voxel_type}, worker);
+				});
+		});
+	}
+	if (!upper_leaves.empty())
 	{
-		for (unsigned int y = 0; y < y_min_separators.size(); y++)
+		thread_pool.submit([&upper_leaves, &visitor](unsigned int worker)
 		{
-			for (unsigned int x = 0; x < x_min_separators.size(); x++)
+			for (const Leaf &leaf : upper_leaves)
 			{
-				setVoxelTypeWithinBounds(voxel_type,
-						x_min_separators[x],
-						y_min_separators[y],
-						z_min_separators[z],
-						x_max_separators[x],
-						y_max_separators[y],
-						z_max_separators[z]);
+				visitor(leaf, worker);
 			}
-		}
+		});
 	}
+	thread_pool.wait();
 	return;
 }
 
 
-uint32_t Octree::roundUpToInterval(uint32_t val, uint32_t interval)
+/* ---------------------------------------------------------------- *\
+ * Walk every block reachable from the root once, counting nodes and
+ * leaves per layer, then compare that against the pool's bookkeeping
+\* ---------------------------------------------------------------- */
+Octree::Stats Octree::stats()
+{
+	Stats stats;
+	stats.num_layers = layer_;
+	stats.nodes_per_layer.assign(layer_, 0);
+	stats.leaves_per_layer.assign(layer_, 0);
+	size_t num_blocks = octree_pool_->size() >> 3;
+	std::vector<bool> is_visited(num_blocks, false);
+	double total_leaf_depth = 0.0;
+	size_t num_solid_leaves = 0;
+
+	struct PendingBlock
+	{
+		IndirectionElement indirection;
+		int layer; // of the block's nodes
+	};
+	std::vector<PendingBlock> stack;
+	stack.push_back({root_, layer_-1});
+	is_visited[root_] = true;
+	while (!stack.empty())
+	{
+		PendingBlock block = stack.back();
+		stack.pop_back();
+		stats.num_reachable_blocks++;
+		if ((*block_refcounts_)[block.indirection] > 1)
+		{
+			stats.num_shared_blocks++;
+		}
+		const OctreeNode *children = &(*octree_pool_)[block.indirection << 3];
+		if (block.indirection != root_ && isUniformBlock(children))
+		{
+			stats.num_collapsible_blocks++;
+		}
+		stats.nodes_per_layer[block.layer] += 8;
+		for (int child = 0; child < 8; child++)
+		{
+			OctreeNode node = children[child];
+			if (node.indirection == 0)
+			{
+				stats.leaves_per_layer[block.layer]++;
+				stats.num_leaves++;
+				if (node.voxel_type == 0)
+				{
+					stats.num_air_leaves++;
+				}
+				else
+				{
+					total_leaf_depth += layer_ - block.layer;
+					num_solid_leaves++;
+				}
+				continue;
+			}
+			stats.num_interior_nodes++;
+			if (!is_visited[node.indirection])
+			{
+				is_visited[node.indirection] = true;
+				stack.push_back({node.indirection, block.layer-1});
+			}
+		}
+	}
+	if (num_solid_leaves > 0)
+	{
+		stats.average_leaf_depth = total_leaf_depth / num_solid_leaves;
+	}
+
+	stats.num_pool_blocks = num_blocks;
+	for (size_t block = 0; block < num_blocks; block++)
+	{
+		if ((*block_refcounts_)[block] == 0)
+		{
+			stats.num_free_blocks++;
+		}
+	}
+	stats.num_unreachable_blocks = num_blocks - stats.num_free_blocks - stats.num_reachable_blocks;
+	stats.fragmentation = (num_blocks > 0) ? static_cast<double>(stats.num_free_blocks) / num_blocks : 0.0;
+	stats.bytes_used = stats.num_reachable_blocks*8*sizeof(OctreeNode);
+	stats.bytes_pool = octree_pool_->size()*sizeof(OctreeNode);
+	stats.bytes_committed = octree_pool_->capacity()*sizeof(OctreeNode);
+	return stats;
+}
+
+
+Json::Value Octree::Stats::toJson() const
 {
-	if (interval == 0)
-		return val;
+	Json::Value json;
+	json["num_layers"] = num_layers;
+	json["nodes_per_layer"] = Json::Value(Json::arrayValue);
+	json["leaves_per_layer"] = Json::Value(Json::arrayValue);
+	for (int layer = 0; layer < num_layers; layer++)
+	{
+		json["nodes_per_layer"].append(static_cast<Json::UInt64>(nodes_per_layer[layer]));
+		json["leaves_per_layer"].append(static_cast<Json::UInt64>(leaves_per_layer[layer]));
+	}
+	json["num_leaves"] = static_cast<Json::UInt64>(num_leaves);
+	json["num_air_leaves"] = static_cast<Json::UInt64>(num_air_leaves);
+	json["num_interior_nodes"] = static_cast<Json::UInt64>(num_interior_nodes);
+	json["average_leaf_depth"] = average_leaf_depth;
+	json["num_reachable_blocks"] = static_cast<Json::UInt64>(num_reachable_blocks);
+	json["num_collapsible_blocks"] = static_cast<Json::UInt64>(num_collapsible_blocks);
+	json["num_shared_blocks"] = static_cast<Json::UInt64>(num_shared_blocks);
+	json["num_pool_blocks"] = static_cast<Json::UInt64>(num_pool_blocks);
+	json["num_free_blocks"] = static_cast<Json::UInt64>(num_free_blocks);
+	json["num_unreachable_blocks"] = static_cast<Json::UInt64>(num_unreachable_blocks);
+	json["fragmentation"] = fragmentation;
+	json["bytes_used"] = static_cast<Json::UInt64>(bytes_used);
+	json["bytes_pool"] = static_cast<Json::UInt64>(bytes_pool);
+	json["bytes_committed"] = static_cast<Json::UInt64>(bytes_committed);
+	return json;
+}
 
-	uint32_t remainder = val % interval;
-	return val + remainder;
+
+uint64_t Octree::mortonEncode(uint32_t x, uint32_t y, uint32_t z)
+{
+	// child index bit order is x | y << 1 | z << 2 at every layer; each
+	// coordinate's low 21 bits are spread out to every third bit
+	auto spread = [](uint64_t bits)
+	{
+		bits &= 0x1FFFFF;
+		bits = (bits | (bits << 32)) & 0x1F00000000FFFFull;
+		bits = (bits | (bits << 16)) & 0x1F0000FF0000FFull;
+		bits = (bits | (bits << 8)) & 0x100F00F00F00F00Full;
+		bits = (bits | (bits << 4)) & 0x10C30C30C30C30C3ull;
+		bits = (bits | (bits << 2)) & 0x1249249249249249ull;
+		return bits;
+	};
+	return spread(x) | (spread(y) << 1) | (spread(z) << 2);
 }
 
 
@@ -562,16 +2592,9 @@ Octree::Accessor *Octree::createAccessor()
 	// not thread-safe
 	new_accessor->self_iterator_ = accessors_.end();
 	new_accessor->self_iterator_--;
-
-	new_accessor->indirection_stack_.resize(layer_);
-	new_accessor->indirection_stack_[0] = 0;
-	new_accessor->childnum_stack_.resize(layer_);
-	new_accessor->childnum_stack_[0] = 0; // not actually anything since this is
-	                                      // root node
 	new_accessor->is_being_destroyed_ = false;
-
-	new_accessor->depth_ = 0;
-
+	new_accessor->reset();
+	new_accessor->descendToLayer(0);
 	return new_accessor;
 }
 
@@ -583,6 +2606,10 @@ Octree::Accessor::~Accessor()
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Remove the accessor from its octree. The accessor is deleted, so
+ * it must not be used afterwards.
+\* ---------------------------------------------------------------- */
 void Octree::Accessor::destroy()
 {
 	if (is_being_destroyed_)
@@ -590,27 +2617,180 @@ void Octree::Accessor::destroy()
 		return;
 	}
 	is_being_destroyed_ = true;
-	indirection_stack_.clear();
-	childnum_stack_.clear();
+	node_stack_.clear();
 	owner_->accessors_.erase(self_iterator_);
 	return;
 }
 
 
+/* ---------------------------------------------------------------- *\
+ * Go back to the root, keeping the position
+\* ---------------------------------------------------------------- */
+void Octree::Accessor::reset()
+{
+	int num_layers = owner_->layer_;
+	node_stack_.resize(num_layers+1);
+	node_stack_[num_layers].indirection = owner_->root_;
+	node_stack_[num_layers].voxel_type = calculateMaterialTypeFromChildren(
+			&(*owner_->octree_pool_)[owner_->root_ << 3]);
+	layer_ = num_layers;
+	pool_version_ = owner_->pool_version_;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Follow the position down from the current node until reaching
+ * <layer> or a leaf
+\* ---------------------------------------------------------------- */
+void Octree::Accessor::descendToLayer(int layer)
+{
+	// work on copies, since writes to the node stack could otherwise
+	// alias the members as far as the compiler knows
+	const OctreeNode *pool = owner_->octree_pool_->data();
+	OctreeNode *node_stack = node_stack_.data();
+	int current_layer = layer_;
+	uint32_t x = x_, y = y_, z = z_;
+	IndirectionElement indirection = node_stack[current_layer].indirection;
+	// the root block is usually block 0, but the root always has children
+	if (current_layer == owner_->layer_ && current_layer > layer)
+	{
+		current_layer--;
+		IndirectionElement child = ((x >> current_layer) & 1u) | (((y >> current_layer) & 1u) << 1) | (((z >> current_layer) & 1u) << 2);
+		node_stack[current_layer] = pool[(indirection << 3) | child];
+		indirection = node_stack[current_layer].indirection;
+	}
+	while (current_layer > layer && indirection != 0)
+	{
+		current_layer--;
+		IndirectionElement child = ((x >> current_layer) & 1u) | (((y >> current_layer) & 1u) << 1) | (((z >> current_layer) & 1u) << 2);
+		OctreeNode node = pool[(indirection << 3) | child];
+		node_stack[current_layer] = node;
+		indirection = node.indirection;
+	}
+	layer_ = current_layer;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Move to the leaf containing (x, y, z), going back up only as far
+ * as the highest coordinate bit that changed
+\* ---------------------------------------------------------------- */
+void Octree::Accessor::moveTo(uint32_t x, uint32_t y, uint32_t z)
+{
+	if (pool_version_ != owner_->pool_version_)
+	{
+		reset();
+	}
+	int num_layers = owner_->layer_;
+	uint32_t difference = (x ^ x_) | (y ^ y_) | (z ^ z_);
+	x_ = x;
+	y_ = y;
+	z_ = z;
+	if (difference == 0)
+	{
+		return descendToLayer(0);
+	}
+	int first_different_layer = 31 - __builtin_clz(difference);
+	if (first_different_layer >= layer_)
+	{
+		// the nodes above the changed bit are shared by both paths
+		layer_ = std::min(first_different_layer+1, num_layers);
+	}
+	return descendToLayer(0);
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Move one voxel in <direction> (+1 or -1) along <axis> (0, 1 or 2
+ * for x, y or z). Returns false without moving if that would leave
+ * the octree.
+\* ---------------------------------------------------------------- */
+bool Octree::Accessor::step(int axis, int direction)
+{
+	uint32_t position[3] = {x_, y_, z_};
+	uint32_t new_coordinate = position[axis] + direction;
+	if (new_coordinate >= (uint64_t(1) << owner_->layer_))
+	{
+		return false;
+	}
+	position[axis] = new_coordinate;
+	moveTo(position[0], position[1], position[2]);
+	return true;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Move to the next leaf in depth-first (morton) order, after the
+ * whole of the current node. Air leaves are included. Returns false
+ * without moving once the last leaf has been passed. Starting from
+ * moveTo(0, 0, 0) visits every leaf.
+\* ---------------------------------------------------------------- */
+bool Octree::Accessor::nextLeaf()
+{
+	if (pool_version_ != owner_->pool_version_)
+	{
+		reset();
+		descendToLayer(0);
+	}
+	int num_layers = owner_->layer_;
+	for (int layer = layer_; layer < num_layers; layer++)
+	{
+		IndirectionElement child = ((x_ >> layer) & 1u) | (((y_ >> layer) & 1u) << 1) | (((z_ >> layer) & 1u) << 2);
+		if (child == 7)
+		{
+			// last child of its parent, so try the parent's next sibling
+			continue;
+		}
+		child++;
+		uint32_t high_mask = ~((2u << layer) - 1);
+		x_ = (x_ & high_mask) | ((child & 1u) << layer);
+		y_ = (y_ & high_mask) | (((child >> 1) & 1u) << layer);
+		z_ = (z_ & high_mask) | (((child >> 2) & 1u) << layer);
+		layer_ = layer+1;
+		descendToLayer(0);
+		return true;
+	}
+	return false;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Move to child <child> of the current node, if it has children
+\* ---------------------------------------------------------------- */
 void Octree::Accessor::descend(int child)
 {
-	IndirectionElement next_octree_index = indirection_stack_.back() << 3 + child;
-	IndirectionElement next_indirection = (*(owner_->octree_pool_))[next_octree_index].indirection;
-	depth_++;
-	indirection_stack_[depth_] = next_indirection;
-	childnum_stack_[depth_] = child;
+	if (pool_version_ != owner_->pool_version_)
+	{
+		int layer = layer_;
+		reset();
+		descendToLayer(layer);
+	}
+	if (isLeaf())
+	{
+		return;
+	}
+	IndirectionElement indirection = node_stack_[layer_].indirection;
+	layer_--;
+	uint32_t high_mask = ~((2u << layer_) - 1);
+	x_ = (x_ & high_mask) | ((child & 1u) << layer_);
+	y_ = (y_ & high_mask) | (((child >> 1) & 1u) << layer_);
+	z_ = (z_ & high_mask) | (((child >> 2) & 1u) << layer_);
+	node_stack_[layer_] = (*owner_->octree_pool_)[(indirection << 3) | child];
 	return;
 }
 
 
 void Octree::Accessor::ascend()
 {
-	depth_--;
+	int layer = std::min(layer_+1, owner_->layer_);
+	if (pool_version_ != owner_->pool_version_)
+	{
+		reset();
+		return descendToLayer(layer);
+	}
+	layer_ = layer;
 	return;
 }
 
@@ -0,0 +1,164 @@
+/* ---------------------------------------------------------------- *\
+ * octree_file.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-03-02
+\* ---------------------------------------------------------------- */
+
+#include "octree_file.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Anthrax
+{
+
+/* ---------------------------------------------------------------- *\
+ * Map <filename> into memory and check its header. The mapping is
+ * read-only and lives as long as this object.
+\* ---------------------------------------------------------------- */
+OctreeFile::OctreeFile(const std::string &filename)
+{
+	filename_ = filename;
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw std::runtime_error("Failed to open octree file " + filename + "!");
+	}
+	struct stat file_stats;
+	if (fstat(fd, &file_stats) != 0 || static_cast<size_t>(file_stats.st_size) < sizeof(Header))
+	{
+		close(fd);
+		throw std::runtime_error("Octree file " + filename + " is too small!");
+	}
+	mapping_size_ = file_stats.st_size;
+	mapping_ = mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (mapping_ == MAP_FAILED)
+	{
+		mapping_ = nullptr;
+		throw std::runtime_error("Failed to map octree file " + filename + "!");
+	}
+	header_ = reinterpret_cast<const Header*>(mapping_);
+
+	// sizes are checked by dividing the space left after each offset, so
+	// a corrupt count can't overflow its way past the comparison
+	if (memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+	    header_->version < 1 ||
+	    header_->version > VERSION ||
+	    header_->num_layers < 1 ||
+	    header_->num_layers > 31 ||
+	    header_->num_nodes < 8 ||
+	    (header_->num_nodes & 7) != 0 ||
+	    header_->materials_offset > mapping_size_ ||
+	    header_->num_materials > (mapping_size_ - header_->materials_offset)/sizeof(Material::PackedMaterial) ||
+	    header_->pool_offset > mapping_size_ ||
+	    header_->num_nodes > (mapping_size_ - header_->pool_offset)/sizeof(Octree::OctreeNode))
+	{
+		munmap(mapping_, mapping_size_);
+		mapping_ = nullptr;
+		throw std::runtime_error("Octree file " + filename + " is corrupt or from an incompatible version!");
+	}
+
+	// the pool is read front to back exactly once, so let the kernel read ahead
+	madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+	return;
+}
+
+
+OctreeFile::~OctreeFile()
+{
+	if (mapping_)
+	{
+		munmap(mapping_, mapping_size_);
+		mapping_ = nullptr;
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Write <octree> and <materials> to <filename>. The octree is
+ * compacted first so the file holds only live blocks.
+\* ---------------------------------------------------------------- */
+void OctreeFile::save(const std::string &filename, Octree *octree,
+		const std::vector<Material> &materials)
+{
+	octree->compact();
+
+	size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	Header header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.num_layers = octree->getLayer();
+	header.num_materials = materials.size();
+	header.materials_offset = sizeof(Header);
+	header.num_nodes = octree->size();
+	header.pool_offset = header.materials_offset + header.num_materials*sizeof(Material::PackedMaterial);
+	header.pool_offset = ((header.pool_offset + page_size - 1) / page_size) * page_size;
+	header.flags = (octree->stats().num_shared_blocks > 0) ? SHARES_BLOCKS : 0;
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to create octree file " + filename + "!");
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+	for (Material material : materials)
+	{
+		Material::PackedMaterial packed_material = material.pack();
+		file.write(reinterpret_cast<const char*>(&packed_material), sizeof(Material::PackedMaterial));
+	}
+	std::vector<char> padding(header.pool_offset - static_cast<size_t>(file.tellp()), 0);
+	file.write(padding.data(), padding.size());
+	file.write(reinterpret_cast<const char*>(octree->data()), octree->size()*sizeof(Octree::OctreeNode));
+	if (!file.good())
+	{
+		throw std::runtime_error("Failed to write octree file " + filename + "!");
+	}
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * The raw pool, ready to be copied into a mapped GPU buffer
+\* ---------------------------------------------------------------- */
+const Octree::OctreeNode *OctreeFile::getPool()
+{
+	return reinterpret_cast<const Octree::OctreeNode*>(
+			reinterpret_cast<const char*>(mapping_) + header_->pool_offset);
+}
+
+
+const Material::PackedMaterial *OctreeFile::getPackedMaterials()
+{
+	return reinterpret_cast<const Material::PackedMaterial*>(
+			reinterpret_cast<const char*>(mapping_) + header_->materials_offset);
+}
+
+
+std::vector<Material> OctreeFile::getMaterials()
+{
+	std::vector<Material> materials;
+	materials.reserve(header_->num_materials);
+	const Material::PackedMaterial *packed_materials = getPackedMaterials();
+	for (size_t i = 0; i < header_->num_materials; i++)
+	{
+		glm::vec4 color = packed_materials[i].color;
+		materials.push_back(Material(color.r, color.g, color.b, color.a));
+	}
+	return materials;
+}
+
+
+void OctreeFile::loadInto(Octree *octree)
+{
+	bool may_share_blocks = (header_->version < 2) || (header_->flags & SHARES_BLOCKS);
+	return octree->loadPool(header_->num_layers, getPool(), header_->num_nodes, may_share_blocks);
+}
+
+} // namespace Anthrax
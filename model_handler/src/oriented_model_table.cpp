@@ -0,0 +1,154 @@
+/* ---------------------------------------------------------------- *\
+ * oriented_model_table.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2025-04-20
+\* ---------------------------------------------------------------- */
+
+#include "oriented_model_table.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace Anthrax
+{
+
+/* ---------------------------------------------------------------- *\
+ * Draw <model> centered on (x, y, z), an unsigned octree location,
+ * turned by its orientation (see Model::setOrientation()). Seen from
+ * the next update().
+\* ---------------------------------------------------------------- */
+OrientedModelTable::OrientedModelId OrientedModelTable::add(Model *model, uint32_t x, uint32_t y, uint32_t z)
+{
+	OrientedModel oriented_model;
+	oriented_model.model = model;
+	oriented_model.x = x;
+	oriented_model.y = y;
+	oriented_model.z = z;
+	oriented_models_.push_back(oriented_model);
+	is_pool_stale_ = true;
+	return oriented_models_.size()-1;
+}
+
+
+void OrientedModelTable::move(OrientedModelId id, uint32_t x, uint32_t y, uint32_t z)
+{
+	if (id >= oriented_models_.size() || !oriented_models_[id].model)
+	{
+		throw std::runtime_error("move(): no such oriented model!");
+	}
+	oriented_models_[id].x = x;
+	oriented_models_[id].y = y;
+	oriented_models_[id].z = z;
+	return;
+}
+
+
+void OrientedModelTable::remove(OrientedModelId id)
+{
+	if (id >= oriented_models_.size() || !oriented_models_[id].model)
+	{
+		throw std::runtime_error("remove(): no such oriented model!");
+	}
+	oriented_models_[id].model = nullptr;
+	is_pool_stale_ = true;
+	return;
+}
+
+
+void OrientedModelTable::clear()
+{
+	oriented_models_.clear();
+	is_pool_stale_ = true;
+	return;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Bring the records up to date with where the models are and how
+ * they're turned, and the pool with their voxels. Turning or moving
+ * a model only rewrites its record; the pool is rebuilt only when a
+ * model was added, removed or edited. Returns whether anything
+ * changed (and so needs uploading).
+\* ---------------------------------------------------------------- */
+bool OrientedModelTable::update()
+{
+	for (const OrientedModel &oriented_model : oriented_models_)
+	{
+		if (oriented_model.model && oriented_model.model->getOriginalVersion() != oriented_model.pooled_version)
+		{
+			is_pool_stale_ = true;
+		}
+	}
+	bool changed = is_pool_stale_;
+	if (is_pool_stale_)
+	{
+		rebuildModelPool();
+	}
+
+	std::vector<Record> records;
+	records.reserve(oriented_models_.size());
+	for (OrientedModel &oriented_model : oriented_models_)
+	{
+		if (!oriented_model.model)
+		{
+			continue;
+		}
+		// the model's rotation is orthonormal, so its transpose turns world offsets back
+		glm::mat3 rotation = glm::transpose(oriented_model.model->getOrientationMatrix());
+		int model_layer = oriented_model.model->getOriginalOctree()->getLayer();
+		Record record;
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = 0; column < 3; column++)
+			{
+				record.rotation[row][column] = rotation[column][row];
+			}
+			record.rotation[row][3] = 0.0;
+		}
+		record.center[0] = oriented_model.x;
+		record.center[1] = oriented_model.y;
+		record.center[2] = oriented_model.z;
+		record.center[3] = static_cast<float>(1u << model_layer) / 2.0;
+		record.model_root = oriented_model.root;
+		record.model_layer = model_layer;
+		record.lod_voxel_type = oriented_model.lod_voxel_type;
+		record.padding = 0;
+		records.push_back(record);
+	}
+	if (records.size() != records_.size() ||
+	    (!records.empty() && memcmp(records.data(), records_.data(), records.size()*sizeof(Record)) != 0))
+	{
+		changed = true;
+	}
+	records_ = std::move(records);
+	if (changed)
+	{
+		version_++;
+	}
+	return changed;
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Lay out every model's original octree in the pool again, so
+ * removed and edited models don't leave their old blocks behind
+\* ---------------------------------------------------------------- */
+void OrientedModelTable::rebuildModelPool()
+{
+	model_pool_.clear();
+	for (OrientedModel &oriented_model : oriented_models_)
+	{
+		if (!oriented_model.model)
+		{
+			continue;
+		}
+		oriented_model.root = oriented_model.model->getOriginalOctree()->appendPoolTo(model_pool_);
+		oriented_model.lod_voxel_type = Octree::calculateMaterialTypeFromChildren(&model_pool_[oriented_model.root << 3]);
+		oriented_model.pooled_version = oriented_model.model->getOriginalVersion();
+	}
+	is_pool_stale_ = false;
+	model_pool_version_++;
+	return;
+}
+
+} // namespace Anthrax
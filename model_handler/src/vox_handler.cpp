@@ -36,6 +36,9 @@ VoxHandler::VoxHandler(World *world)
 	{
 		traverseSceneNode(0, offset[0], offset[1], offset[2], RotationMatrix());
 	}
+	// all models have been placed - build them in one pass and add them to the world
+	world_->addVoxels(voxels_);
+	voxels_.clear();
 }
 
 
@@ -597,7 +600,12 @@ void VoxHandler::drawSingleModel(int32_t model_id, int32_t x_translation, int32_
 
 				if (voxel_value != 0)
 				{
-					world_->setVoxel(global_position[1], global_position[2], global_position[0], voxel_value);
+					Octree::VoxelRecord voxel;
+					Octree::convertToUnsignedLoc(world_->getNumLayers(),
+							global_position[1], global_position[2], global_position[0],
+							&voxel.x, &voxel.y, &voxel.z);
+					voxel.voxel_type = voxel_value;
+					voxels_.push_back(voxel);
 				}
 			}
 		}
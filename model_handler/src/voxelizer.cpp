@@ -85,6 +85,8 @@ Model *Voxelizer::createModel()
 	}
 	//std::cout << model_size[0] << " " << model_size[1] << " " << model_size[2] << std::endl;
 	Model *model = new Model(model_size[0], model_size[1], model_size[2]);
+	int model_layers = model->getOctree()->getLayer();
+	std::vector<Octree::VoxelRecord> voxels;
 
 	for (unsigned int i = 0; i < mesh_->size(); i++)
 	{
@@ -126,12 +128,26 @@ Model *Voxelizer::createModel()
 						int material = getMaterial(triangle, test_point);
 						//world->setVoxel(x+offset[0], y+offset[1], z+offset[2], material);
 						//std::cout << "set voxel |" << x << "|" << y << "|" << z << std::endl;
-						model->setVoxel(x, y, z, material);
+						Octree::VoxelRecord voxel;
+						Octree::convertToUnsignedLoc(model_layers, x, y, z,
+								&voxel.x, &voxel.y, &voxel.z);
+						voxel.voxel_type = material;
+						voxels.push_back(voxel);
 					}
 				}
 			}
 		}
 	}
+	Timer timer(Timer::MILLISECONDS);
+	timer.start();
+	model->buildFromVoxels(voxels);
+	std::cout << "Time to build model octree (" << voxels.size() << " voxels): "
+			<< timer.stop() << "ms" << std::endl;
+	size_t original_size = model->getOriginalOctree()->size();
+	model->deduplicate();
+	std::cout << "Deduplicated size: " << (original_size*sizeof(Octree::OctreeNode) >> 10) << "KB -> "
+			<< (model->getOriginalOctree()->size()*sizeof(Octree::OctreeNode) >> 10) << "KB ("
+			<< static_cast<double>(original_size)/model->getOriginalOctree()->size() << "x)" << std::endl;
 	return model;
 }
 
@@ -0,0 +1,779 @@
+/* ---------------------------------------------------------------- *\
+ * octree_tests.cpp
+ * Author: Gavin Ralston
+ * Date Created: 2026-10-17
+ *
+ * Checks edits, copies and queries of octrees against a dense grid
+ * of voxels. Run with the name of a test, or no name to run them
+ * all. Returns nonzero if any check fails.
+\* ---------------------------------------------------------------- */
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "octree.hpp"
+#include "octree_file.hpp"
+
+using namespace Anthrax;
+
+namespace
+{
+
+int num_failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			num_failures++; \
+		} \
+	} while (0)
+
+// every voxel of an octree, stored flat
+class ReferenceGrid
+{
+public:
+	ReferenceGrid(int layer) : size_(1u << layer), voxels_(size_t(size_) * size_ * size_, 0) {}
+	uint32_t getSize() { return size_; }
+	VoxelTypeElement &at(uint32_t x, uint32_t y, uint32_t z)
+	{
+		return voxels_[(size_t(z) * size_ + y) * size_ + x];
+	}
+	void fill(VoxelTypeElement voxel_type) { std::fill(voxels_.begin(), voxels_.end(), voxel_type); }
+	bool matches(Octree &octree)
+	{
+		for (uint32_t z = 0; z < size_; z++)
+			for (uint32_t y = 0; y < size_; y++)
+				for (uint32_t x = 0; x < size_; x++)
+					if (octree.getVoxel(x, y, z) != at(x, y, z))
+						return false;
+		return true;
+	}
+private:
+	uint32_t size_;
+	std::vector<VoxelTypeElement> voxels_;
+};
+
+void randomEdits(Octree &octree, ReferenceGrid &reference, std::mt19937 &rng, int num_edits)
+{
+	uint32_t size = reference.getSize();
+	for (int i = 0; i < num_edits; i++)
+	{
+		uint32_t x = rng() % size, y = rng() % size, z = rng() % size;
+		VoxelTypeElement voxel_type = rng() % 3;
+		octree.setVoxel(x, y, z, voxel_type);
+		reference.at(x, y, z) = voxel_type;
+	}
+	return;
+}
+
+// blocks below the root whose 8 children are identical leaves, so should have been merged
+size_t countCollapsibleBlocks(Octree &octree)
+{
+	const Octree::OctreeNode *pool = octree.data();
+	size_t num_collapsible = 0;
+	std::vector<IndirectionElement> stack(1, 0);
+	while (!stack.empty())
+	{
+		IndirectionElement block = stack.back();
+		stack.pop_back();
+		const Octree::OctreeNode *children = &pool[block << 3];
+		bool is_uniform = true;
+		for (int child = 0; child < 8; child++)
+		{
+			if (children[child].indirection != 0)
+			{
+				stack.push_back(children[child].indirection);
+				is_uniform = false;
+			}
+			else if (children[child].voxel_type != children[0].voxel_type)
+			{
+				is_uniform = false;
+			}
+		}
+		num_collapsible += (block != 0 && is_uniform);
+	}
+	return num_collapsible;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Erasing what was painted must merge the pool back down to where
+ * it started, and no block may be left holding 8 identical leaves.
+\* ---------------------------------------------------------------- */
+void testCollapse()
+{
+	int layer = 6;
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	size_t empty_size = octree.size();
+	for (int round = 0; round < 4; round++)
+	{
+		for (uint32_t z = 0; z < 20; z++)
+			for (uint32_t y = 5; y < 33; y++)
+				for (uint32_t x = 3; x < 40; x++)
+					octree.setVoxel(x, y, z, 1 + round % 2);
+		CHECK(octree.size() > empty_size);
+		for (uint32_t z = 0; z < 20; z++)
+			for (uint32_t y = 5; y < 33; y++)
+				for (uint32_t x = 3; x < 40; x++)
+					octree.setVoxel(x, y, z, 0);
+		CHECK(octree.size() == empty_size);
+	}
+	CHECK(reference.matches(octree));
+
+	uint32_t size = reference.getSize();
+	for (uint32_t z = 0; z < size; z++)
+		for (uint32_t y = 0; y < size; y++)
+			for (uint32_t x = 0; x < size; x++)
+				octree.setVoxel(x, y, z, 4);
+	reference.fill(4);
+	CHECK(octree.size() == empty_size);
+	CHECK(reference.matches(octree));
+
+	std::mt19937 rng(3);
+	randomEdits(octree, reference, rng, 100000);
+	CHECK(reference.matches(octree));
+	CHECK(countCollapsibleBlocks(octree) == 0);
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Copies share a pool until written, but edits to one must never
+ * show up in another, whatever happens to the pool in between.
+\* ---------------------------------------------------------------- */
+void testCopyOnWrite()
+{
+	int layer = 6;
+	std::mt19937 rng(7);
+	Octree a(layer);
+	ReferenceGrid reference_a(layer);
+	randomEdits(a, reference_a, rng, 20000);
+
+	Octree *b = new Octree(a);
+	ReferenceGrid reference_b = reference_a;
+	Octree c(1);
+	c = a;
+	ReferenceGrid reference_c = reference_a;
+	CHECK(a.isShared());
+	randomEdits(a, reference_a, rng, 3000);
+	randomEdits(*b, reference_b, rng, 3000);
+	CHECK(reference_a.matches(a));
+	CHECK(reference_b.matches(*b));
+	CHECK(reference_c.matches(c));
+
+	// the original going away mustn't take its copies' blocks with it
+	Octree d(*b);
+	ReferenceGrid reference_d = reference_b;
+	randomEdits(d, reference_d, rng, 1000);
+	delete b;
+	CHECK(reference_a.matches(a));
+	CHECK(reference_c.matches(c));
+	CHECK(reference_d.matches(d));
+
+	// exporting the pool detaches it
+	a.getOctreePoolSize();
+	CHECK(!a.isShared());
+	CHECK(reference_a.matches(a));
+	CHECK(reference_c.matches(c));
+	CHECK(reference_d.matches(d));
+
+	// whole-pool operations on one copy
+	c.deduplicate();
+	d.compact();
+	c.relayout(Octree::LayoutOrder::VAN_EMDE_BOAS);
+	CHECK(reference_a.matches(a));
+	CHECK(reference_c.matches(c));
+	CHECK(reference_d.matches(d));
+
+	Octree e(c);
+	ReferenceGrid reference_e = reference_c;
+	c.clear();
+	reference_c.fill(0);
+	CHECK(reference_c.matches(c));
+	CHECK(reference_e.matches(e));
+
+	Octree f(d);
+	ReferenceGrid reference_f = reference_d;
+	uint32_t size = reference_d.getSize();
+	for (uint32_t z = 0; z < size; z++)
+		for (uint32_t y = 0; y < size; y++)
+			for (uint32_t x = 0; x < size; x++)
+				d.setVoxel(x, y, z, 0);
+	reference_d.fill(0);
+	CHECK(reference_d.matches(d));
+	CHECK(reference_f.matches(f));
+
+	Octree &g = f;
+	f = g;
+	CHECK(reference_f.matches(f));
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Batched lookups, morton sorted or not, must agree with the grid
+ * for scattered and coherent positions, and for batches smaller
+ * than a lane group.
+\* ---------------------------------------------------------------- */
+void testGetVoxels()
+{
+	int layer = 7;
+	std::mt19937 rng(11);
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	uint32_t size = reference.getSize();
+	std::vector<Octree::VoxelRecord> voxels;
+	for (uint32_t z = 0; z < size; z++)
+		for (uint32_t x = 0; x < size; x++)
+		{
+			uint32_t height = size / 2 + (x * x / 7 + z * 13) % 23;
+			for (uint32_t y = height - 3; y <= height; y++)
+			{
+				VoxelTypeElement voxel_type = 1 + rng() % 3;
+				voxels.push_back({x, y, z, voxel_type});
+				reference.at(x, y, z) = voxel_type;
+			}
+		}
+	octree.build(voxels);
+	CHECK(reference.matches(octree));
+
+	auto checkBatch = [&](const std::vector<glm::uvec3> &positions)
+	{
+		size_t num_mismatches = 0;
+		for (bool sort_by_morton_code : {false, true})
+		{
+			std::vector<VoxelTypeElement> voxel_types(positions.size());
+			octree.getVoxels(positions.data(), positions.size(), voxel_types.data(), sort_by_morton_code);
+			for (size_t i = 0; i < positions.size(); i++)
+				num_mismatches += voxel_types[i] != reference.at(positions[i].x, positions[i].y, positions[i].z);
+		}
+		return num_mismatches;
+	};
+
+	std::vector<glm::uvec3> positions(100000);
+	for (glm::uvec3 &position : positions)
+		position = {uint32_t(rng() % size), uint32_t(rng() % size), uint32_t(rng() % size)};
+	CHECK(checkBatch(positions) == 0);
+
+	size_t i = 0;
+	for (uint32_t z = 0; z < 40; z++)
+		for (uint32_t y = size / 2 - 10; y < size / 2 + 30; y++)
+			for (uint32_t x = 0; x < 40 && i < positions.size(); x++)
+				positions[i++] = {x, y, z};
+	positions.resize(i);
+	CHECK(checkBatch(positions) == 0);
+
+	for (size_t batch_size : {1, 5, 31, 33})
+		CHECK(checkBatch(std::vector<glm::uvec3>(positions.begin(), positions.begin() + batch_size)) == 0);
+	CHECK(checkBatch({}) == 0);
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Compacting must leave the pool holding exactly the blocks reachable
+ * from the root, without changing a voxel, however many holes edits
+ * left behind.
+\* ---------------------------------------------------------------- */
+void testCompact()
+{
+	int layer = 6;
+	std::mt19937 rng(13);
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	randomEdits(octree, reference, rng, 30000);
+	// overwriting detailed regions frees their subtrees, leaving holes
+	for (int box = 0; box < 6; box++)
+	{
+		uint32_t x_min = rng() % 48, y_min = rng() % 48, z_min = rng() % 48;
+		VoxelTypeElement voxel_type = rng() % 3;
+		for (uint32_t z = z_min; z < z_min + 16; z++)
+			for (uint32_t y = y_min; y < y_min + 16; y++)
+				for (uint32_t x = x_min; x < x_min + 16; x++)
+				{
+					octree.setVoxel(x, y, z, voxel_type);
+					reference.at(x, y, z) = voxel_type;
+				}
+	}
+	Octree::Stats before = octree.stats();
+	CHECK(before.num_free_blocks > 0);
+	Octree copy(octree);
+	ReferenceGrid reference_copy = reference;
+
+	octree.compact();
+	Octree::Stats after = octree.stats();
+	CHECK(reference.matches(octree));
+	CHECK(after.num_free_blocks == 0);
+	CHECK(after.num_pool_blocks == after.num_reachable_blocks);
+	CHECK(after.num_reachable_blocks == before.num_reachable_blocks);
+	CHECK(after.num_pool_blocks < before.num_pool_blocks);
+	CHECK(octree.size() == after.num_reachable_blocks * 8);
+
+	// still editable, and compacting again changes nothing
+	randomEdits(octree, reference, rng, 5000);
+	octree.compact();
+	size_t compacted_size = octree.size();
+	octree.compact();
+	CHECK(octree.size() == compacted_size);
+	CHECK(reference.matches(octree));
+	CHECK(reference_copy.matches(copy));
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Deduplicating a repetitive octree must share its repeated blocks
+ * without changing a voxel, and editing one of the places a shared
+ * block appears must leave all the others alone.
+\* ---------------------------------------------------------------- */
+void testDeduplicate()
+{
+	int layer = 6;
+	std::mt19937 rng(17);
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	uint32_t size = reference.getSize();
+	// an 8^3 pattern tiled across the whole octree
+	std::vector<VoxelTypeElement> tile(512);
+	for (VoxelTypeElement &voxel_type : tile)
+		voxel_type = rng() % 3;
+	for (uint32_t z = 0; z < size; z++)
+		for (uint32_t y = 0; y < size; y++)
+			for (uint32_t x = 0; x < size; x++)
+			{
+				VoxelTypeElement voxel_type = tile[((z & 7) * 8 + (y & 7)) * 8 + (x & 7)];
+				octree.setVoxel(x, y, z, voxel_type);
+				reference.at(x, y, z) = voxel_type;
+			}
+	randomEdits(octree, reference, rng, 200);
+	Octree::Stats before = octree.stats();
+	Octree copy(octree);
+	ReferenceGrid reference_copy = reference;
+
+	octree.deduplicate();
+	Octree::Stats after = octree.stats();
+	CHECK(reference.matches(octree));
+	CHECK(after.num_shared_blocks > 0);
+	CHECK(after.num_reachable_blocks < before.num_reachable_blocks / 4);
+
+	// every edit lands in a block shared with untouched tiles
+	randomEdits(octree, reference, rng, 2000);
+	CHECK(reference.matches(octree));
+	CHECK(reference_copy.matches(copy));
+
+	// deduplicating again and compacting keep it intact
+	octree.deduplicate();
+	octree.compact();
+	CHECK(reference.matches(octree));
+	CHECK(octree.stats().num_shared_blocks > 0);
+	randomEdits(octree, reference, rng, 2000);
+	CHECK(reference.matches(octree));
+	return;
+}
+
+// whether loading <filename> into a fresh octree throws
+bool loadFails(const std::string &filename)
+{
+	try
+	{
+		OctreeFile file(filename);
+		Octree octree(file.getNumLayers());
+		file.loadInto(&octree);
+	}
+	catch (const std::runtime_error &)
+	{
+		return true;
+	}
+	return false;
+}
+
+// whether loading <nodes> as a raw pool throws, and if so that <octree> was left alone
+bool loadPoolFails(Octree &octree, ReferenceGrid &reference, const std::vector<Octree::OctreeNode> &nodes,
+		bool may_share_blocks)
+{
+	try
+	{
+		octree.loadPool(octree.getLayer(), nodes.data(), nodes.size(), may_share_blocks);
+	}
+	catch (const std::runtime_error &)
+	{
+		return reference.matches(octree);
+	}
+	return false;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Saved octrees, deduplicated or not, must load back voxel for voxel,
+ * and files or pools with a broken header or structure must be
+ * rejected instead of loaded.
+\* ---------------------------------------------------------------- */
+void testOctreeFile()
+{
+	int layer = 6;
+	std::mt19937 rng(19);
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	randomEdits(octree, reference, rng, 30000);
+	octree.fillBox(0, 0, 0, 63, 9, 63, 2);
+	for (uint32_t z = 0; z < 64; z++)
+		for (uint32_t y = 0; y < 10; y++)
+			for (uint32_t x = 0; x < 64; x++)
+				reference.at(x, y, z) = 2;
+	std::string filename = (std::filesystem::temp_directory_path() / "anthrax_octree_tests.octree").string();
+
+	for (bool is_deduplicated : {false, true})
+	{
+		if (is_deduplicated)
+			octree.deduplicate();
+		OctreeFile::save(filename, &octree, {});
+		OctreeFile file(filename);
+		CHECK(file.getNumLayers() == layer);
+		Octree loaded(file.getNumLayers());
+		file.loadInto(&loaded);
+		CHECK(reference.matches(loaded));
+		CHECK((loaded.stats().num_shared_blocks > 0) == is_deduplicated);
+		randomEdits(loaded, reference, rng, 1000);
+		CHECK(reference.matches(loaded));
+		octree = loaded;
+	}
+
+	// a deduplicated file whose pool is damaged in various ways; the
+	// header is magic[8], version, num_layers, num_materials,
+	// materials_offset, num_nodes, pool_offset, flags (see OctreeFile)
+	std::vector<char> bytes;
+	{
+		std::ifstream file(filename, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	uint64_t pool_offset;
+	memcpy(&pool_offset, &bytes[40], sizeof(pool_offset));
+	auto damaged = [&](auto damage)
+	{
+		std::vector<char> damaged_bytes = bytes;
+		damage(damaged_bytes);
+		std::ofstream(filename, std::ios::binary | std::ios::trunc).write(damaged_bytes.data(), damaged_bytes.size());
+		return loadFails(filename);
+	};
+	auto setField = [](std::vector<char> &file_bytes, size_t offset, auto value)
+	{
+		memcpy(&file_bytes[offset], &value, sizeof(value));
+	};
+	CHECK(!damaged([](std::vector<char> &) {}));
+	CHECK(damaged([](std::vector<char> &file_bytes) { file_bytes[0] = 'X'; }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 8, uint32_t(99)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 12, uint32_t(0)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 12, uint32_t(40)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 32, uint64_t(12)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 32, ~uint64_t(7)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 40, ~uint64_t(0)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { file_bytes.resize(pool_offset + 64); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes) { file_bytes.resize(20); }));
+	// a child pointing past the pool, then back at its own block
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, pool_offset, IndirectionElement(1u << 30)); }));
+	CHECK(damaged([&](std::vector<char> &file_bytes)
+		{
+			const Octree::OctreeNode *nodes = reinterpret_cast<const Octree::OctreeNode*>(&file_bytes[pool_offset]);
+			IndirectionElement block = 0;
+			while (nodes[block << 3].indirection != 0)
+				block = nodes[block << 3].indirection;
+			setField(file_bytes, pool_offset + (block << 3) * sizeof(Octree::OctreeNode), block);
+		}));
+	// shared blocks in a file that says it has none
+	CHECK(damaged([&](std::vector<char> &file_bytes) { setField(file_bytes, 48, uint64_t(0)); }));
+	std::filesystem::remove(filename);
+
+	// raw pools: blocks 1 and 2 hang off the root
+	Octree target(2);
+	ReferenceGrid target_reference(2);
+	randomEdits(target, target_reference, rng, 20);
+	std::vector<Octree::OctreeNode> nodes(24, {0, 1});
+	nodes[0] = {1, 1};
+	nodes[1] = {2, 1};
+	CHECK(!loadPoolFails(target, target_reference, nodes, false));
+	target_reference.fill(1);
+	CHECK(target_reference.matches(target));
+	nodes[8] = {2, 1};
+	CHECK(loadPoolFails(target, target_reference, nodes, false));
+	CHECK(!loadPoolFails(target, target_reference, nodes, true));
+	nodes[16] = {1, 1};
+	CHECK(loadPoolFails(target, target_reference, nodes, true));
+	nodes[16] = {2, 1};
+	CHECK(loadPoolFails(target, target_reference, nodes, true));
+	nodes[16] = {3, 1};
+	CHECK(loadPoolFails(target, target_reference, nodes, true));
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Merging a model must overwrite exactly the region it covers, air
+ * included, whatever the alignment of its corner, and leave the
+ * model and any copies of the destination alone.
+\* ---------------------------------------------------------------- */
+void testGraft()
+{
+	int layer = 6, model_layer = 4;
+	uint32_t model_size = 1u << model_layer, half_size = model_size / 2;
+	std::mt19937 rng(23);
+	Octree model(model_layer);
+	ReferenceGrid model_reference(model_layer);
+	randomEdits(model, model_reference, rng, 1500);
+	model.fillBox(0, 0, 0, model_size - 1, 2, model_size - 1, 3);
+	for (uint32_t z = 0; z < model_size; z++)
+		for (uint32_t y = 0; y <= 2; y++)
+			for (uint32_t x = 0; x < model_size; x++)
+				model_reference.at(x, y, z) = 3;
+
+	Octree world(layer);
+	ReferenceGrid reference(layer);
+	randomEdits(world, reference, rng, 20000);
+	// corners aligned to 16, 8, 4, 2 and 1 voxels, some to different sizes per axis
+	const uint32_t corners[][3] = {{16, 32, 0}, {40, 8, 24}, {4, 44, 12}, {18, 30, 46}, {1, 21, 37},
+		{47, 3, 13}, {48, 48, 48}, {0, 0, 0}};
+	for (const uint32_t (&corner)[3] : corners)
+	{
+		Octree before(world);
+		ReferenceGrid before_reference = reference;
+		world.mergeOctree(&model, corner[0] + half_size, corner[1] + half_size, corner[2] + half_size);
+		for (uint32_t z = 0; z < model_size; z++)
+			for (uint32_t y = 0; y < model_size; y++)
+				for (uint32_t x = 0; x < model_size; x++)
+					reference.at(corner[0] + x, corner[1] + y, corner[2] + z) = model_reference.at(x, y, z);
+		CHECK(reference.matches(world));
+		CHECK(before_reference.matches(before));
+		CHECK(model_reference.matches(model));
+		CHECK(countCollapsibleBlocks(world) == 0);
+		// the grafted blocks must be ordinary ones
+		randomEdits(world, reference, rng, 500);
+		CHECK(reference.matches(world));
+	}
+
+	// a model as big as the world can't be grafted, so takes the per-leaf path
+	Octree whole_model(world);
+	ReferenceGrid whole_model_reference = reference;
+	randomEdits(whole_model, whole_model_reference, rng, 3000);
+	randomEdits(world, reference, rng, 3000);
+	world.mergeOctree(&whole_model, 32, 32, 32);
+	CHECK(whole_model_reference.matches(world));
+
+	// erasing everything must hand every grafted block back
+	world.fillBox(0, 0, 0, 63, 63, 63, 0);
+	CHECK(world.stats().num_reachable_blocks == 1);
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Filling boxes of any size and alignment must set exactly the voxels
+ * inside them, keep the octree fully merged, and leave copies alone.
+\* ---------------------------------------------------------------- */
+void testFillBox()
+{
+	int layer = 6;
+	std::mt19937 rng(29);
+	Octree octree(layer);
+	ReferenceGrid reference(layer);
+	uint32_t size = reference.getSize();
+	size_t empty_size = octree.size();
+	randomEdits(octree, reference, rng, 20000);
+	Octree copy(octree);
+	ReferenceGrid reference_copy = reference;
+
+	auto fillBox = [&](uint32_t x_min, uint32_t y_min, uint32_t z_min, uint32_t x_max, uint32_t y_max, uint32_t z_max,
+			VoxelTypeElement voxel_type)
+	{
+		octree.fillBox(x_min, y_min, z_min, x_max, y_max, z_max, voxel_type);
+		for (uint32_t z = z_min; z <= z_max; z++)
+			for (uint32_t y = y_min; y <= y_max; y++)
+				for (uint32_t x = x_min; x <= x_max; x++)
+					reference.at(x, y, z) = voxel_type;
+		return;
+	};
+	for (int box = 0; box < 200; box++)
+	{
+		uint32_t min[3], max[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// mostly small boxes, some up to the whole octree
+			uint32_t extent = (box % 4 == 0) ? rng() % size : rng() % 12;
+			min[axis] = rng() % (size - extent);
+			max[axis] = min[axis] + extent;
+		}
+		fillBox(min[0], min[1], min[2], max[0], max[1], max[2], rng() % 4);
+	}
+	CHECK(reference.matches(octree));
+	CHECK(countCollapsibleBlocks(octree) == 0);
+
+	// single voxels, node-aligned boxes and the whole octree
+	fillBox(5, 9, 63, 5, 9, 63, 2);
+	fillBox(16, 0, 32, 31, 15, 47, 3);
+	fillBox(0, 0, 0, 31, 63, 63, 1);
+	CHECK(reference.matches(octree));
+	CHECK(countCollapsibleBlocks(octree) == 0);
+	CHECK(reference_copy.matches(copy));
+	fillBox(0, 0, 0, size - 1, size - 1, size - 1, 0);
+	CHECK(octree.size() == empty_size);
+	CHECK(reference.matches(octree));
+
+	// bad boxes throw without touching anything
+	auto fillBoxThrows = [&](uint32_t x_min, uint32_t x_max)
+	{
+		try
+		{
+			octree.fillBox(x_min, 0, 0, x_max, 0, 0, 1);
+		}
+		catch (const std::runtime_error &)
+		{
+			return true;
+		}
+		return false;
+	};
+	CHECK(fillBoxThrows(0, size));
+	CHECK(fillBoxThrows(3, 2));
+	CHECK(reference.matches(octree));
+	CHECK(reference_copy.matches(copy));
+	return;
+}
+
+/* ---------------------------------------------------------------- *\
+ * Every CSG operation must give what applying it voxel by voxel
+ * gives, whatever the alignment of the other octree's corner, and
+ * leave the other octree and any copies alone.
+\* ---------------------------------------------------------------- */
+void testCsg()
+{
+	int layer = 6, model_layer = 4;
+	uint32_t model_size = 1u << model_layer;
+	std::mt19937 rng(31);
+	// a solid slab so both octrees have big uniform nodes as well as scattered voxels
+	Octree model(model_layer);
+	ReferenceGrid model_reference(model_layer);
+	randomEdits(model, model_reference, rng, 1500);
+	model.fillBox(0, 0, 0, model_size - 1, model_size / 2 - 1, model_size - 1, 3);
+	for (uint32_t z = 0; z < model_size; z++)
+		for (uint32_t y = 0; y < model_size / 2; y++)
+			for (uint32_t x = 0; x < model_size; x++)
+				model_reference.at(x, y, z) = 3;
+
+	Octree world(layer);
+	ReferenceGrid reference(layer);
+	uint32_t size = reference.getSize();
+	world.fillBox(0, 0, 0, size - 1, size / 2 - 1, size - 1, 1);
+	for (uint32_t z = 0; z < size; z++)
+		for (uint32_t y = 0; y < size / 2; y++)
+			for (uint32_t x = 0; x < size; x++)
+				reference.at(x, y, z) = 1;
+	randomEdits(world, reference, rng, 20000);
+	CHECK(reference.matches(world));
+
+	const Octree::CsgOperation operations[] = {Octree::CsgOperation::UNION, Octree::CsgOperation::SUBTRACT,
+		Octree::CsgOperation::INTERSECT, Octree::CsgOperation::REPLACE};
+	// corners aligned to 16, 8, 4, 2 and 1 voxels, some to different sizes per axis
+	const uint32_t corners[][3] = {{16, 16, 32}, {40, 24, 8}, {4, 44, 12}, {18, 30, 46}, {1, 21, 37},
+		{47, 25, 13}, {48, 48, 48}, {0, 0, 0}};
+	for (Octree::CsgOperation operation : operations)
+		for (const uint32_t (&corner)[3] : corners)
+		{
+			Octree result(world);
+			ReferenceGrid result_reference(layer);
+			for (uint32_t z = 0; z < size; z++)
+				for (uint32_t y = 0; y < size; y++)
+					for (uint32_t x = 0; x < size; x++)
+					{
+						bool is_inside = x - corner[0] < model_size && y - corner[1] < model_size && z - corner[2] < model_size;
+						VoxelTypeElement other_voxel_type = is_inside ?
+							model_reference.at(x - corner[0], y - corner[1], z - corner[2]) : 0;
+						VoxelTypeElement voxel_type = reference.at(x, y, z);
+						switch (operation)
+						{
+							case Octree::CsgOperation::UNION:
+								voxel_type = (other_voxel_type != 0) ? other_voxel_type : voxel_type;
+								break;
+							case Octree::CsgOperation::SUBTRACT:
+								voxel_type = (other_voxel_type != 0) ? 0 : voxel_type;
+								break;
+							case Octree::CsgOperation::INTERSECT:
+								voxel_type = (other_voxel_type != 0) ? voxel_type : 0;
+								break;
+							case Octree::CsgOperation::REPLACE:
+								voxel_type = (other_voxel_type != 0 && voxel_type != 0) ? other_voxel_type : voxel_type;
+								break;
+						}
+						result_reference.at(x, y, z) = voxel_type;
+					}
+			result.applyCsg(operation, &model, corner[0], corner[1], corner[2]);
+			CHECK(result_reference.matches(result));
+			CHECK(countCollapsibleBlocks(result) == 0);
+			CHECK(reference.matches(world));
+			CHECK(model_reference.matches(model));
+		}
+
+	// a model reaching past the far edge, or the octree itself, throws without touching anything
+	auto applyCsgThrows = [&](const Octree *other, uint32_t x_min)
+	{
+		try
+		{
+			world.applyCsg(Octree::CsgOperation::UNION, other, x_min, 0, 0);
+		}
+		catch (const std::runtime_error &)
+		{
+			return true;
+		}
+		return false;
+	};
+	CHECK(applyCsgThrows(&model, size - model_size + 1));
+	CHECK(applyCsgThrows(&world, 0));
+	CHECK(reference.matches(world));
+	return;
+}
+
+struct TestCase
+{
+	const char *name;
+	void (*run)();
+};
+
+const TestCase test_cases[] =
+{
+	{"collapse", testCollapse},
+	{"compact", testCompact},
+	{"cow", testCopyOnWrite},
+	{"csg", testCsg},
+	{"dedup", testDeduplicate},
+	{"fillbox", testFillBox},
+	{"getvoxels", testGetVoxels},
+	{"graft", testGraft},
+	{"octreefile", testOctreeFile},
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	bool ran_any = false;
+	for (const TestCase &test_case : test_cases)
+	{
+		if (argc > 1 && strcmp(argv[1], test_case.name) != 0)
+			continue;
+		int previous_failures = num_failures;
+		try
+		{
+			test_case.run();
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << test_case.name << ": threw " << e.what() << std::endl;
+			num_failures++;
+		}
+		std::cout << test_case.name << ": " << ((num_failures == previous_failures) ? "passed" : "FAILED") << std::endl;
+		ran_any = true;
+	}
+	if (!ran_any)
+	{
+		std::cerr << "No test named " << argv[1] << std::endl;
+		return 1;
+	}
+	return (num_failures == 0) ? 0 : 1;
+}
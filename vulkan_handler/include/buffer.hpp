@@ -12,6 +12,7 @@
 #include <GLFW/glfw3.h>
 
 #include <iostream>
+#include <vector>
 
 #include "device.hpp"
 
@@ -44,6 +45,7 @@ public:
 	void flush();
 
 	void copy(Buffer other);
+	void copy(Buffer other, const std::vector<VkBufferCopy> &regions);
 
 	bool initialized() { return initialized_; }
 
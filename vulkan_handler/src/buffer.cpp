@@ -160,6 +160,24 @@ void* Buffer::getMappedPtr()
 
 void Buffer::copy(Buffer other)
 {
+	VkBufferCopy copy_region{};
+	copy_region.srcOffset = 0;
+	copy_region.dstOffset = 0;
+	copy_region.size = other.size();
+	return copy(other, std::vector<VkBufferCopy>(1, copy_region));
+}
+
+
+/* ---------------------------------------------------------------- *\
+ * Copy several regions of <other> into this buffer with a single
+ * submission, so scattered updates don't each pay for a round trip.
+\* ---------------------------------------------------------------- */
+void Buffer::copy(Buffer other, const std::vector<VkBufferCopy> &regions)
+{
+	if (regions.empty())
+	{
+		return;
+	}
 	// start by creating a new command buffer
 	VkCommandBufferAllocateInfo alloc_info{};
 	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -177,11 +195,7 @@ void Buffer::copy(Buffer other)
 	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	vkBeginCommandBuffer(transfer_command_buffer, &begin_info);
 
-	VkBufferCopy copy_region{};
-	copy_region.srcOffset = 0;
-	copy_region.dstOffset = 0;
-	copy_region.size = other.size();
-	vkCmdCopyBuffer(transfer_command_buffer, other.data(), buffer_, 1, &copy_region);
+	vkCmdCopyBuffer(transfer_command_buffer, other.data(), buffer_, regions.size(), regions.data());
 	vkEndCommandBuffer(transfer_command_buffer);
 
 	VkSubmitInfo submit_info{};